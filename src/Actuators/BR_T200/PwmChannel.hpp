@@ -0,0 +1,153 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef ACTUATORS_BR_T200_PWM_CHANNEL_HPP_INCLUDED_
+#define ACTUATORS_BR_T200_PWM_CHANNEL_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <stdint.h>
+
+// POSIX headers.
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Actuators {
+namespace BR_T200 {
+//! PWM channel of the Linux sysfs PWM interface. Setup attributes are
+//! written once through short lived descriptors; the duty cycle file is
+//! kept open and updated with a single pwrite per change.
+class PwmChannel {
+public:
+  //! Constructor.
+  //! @param[in] path channel sysfs directory.
+  explicit PwmChannel(const std::string &path)
+      : m_path(path), m_fd(-1), m_duty_cycle(0), m_writes(0) {}
+
+  ~PwmChannel(void) {
+    if (m_fd >= 0)
+      ::close(m_fd);
+  }
+
+  //! Configure and enable the channel.
+  //! @param[in] period PWM period (ns).
+  //! @param[in] duty_cycle initial duty cycle (ns).
+  void enable(uint32_t period, uint32_t duty_cycle) {
+    // Shrink the duty cycle first, it may not fit the new period.
+    writeAttribute("duty_cycle", 0);
+    writeAttribute("period", period);
+    writeAttribute("duty_cycle", duty_cycle);
+    writeAttribute("enable", 1);
+
+    std::string file = m_path + "/duty_cycle";
+    m_fd = ::open(file.c_str(), O_WRONLY);
+    if (m_fd < 0)
+      throw std::runtime_error("unable to open " + file + ": "
+                               + std::strerror(errno));
+    m_duty_cycle = duty_cycle;
+  }
+
+  //! Close the duty cycle file and disable the channel.
+  void disable(void) {
+    if (m_fd < 0)
+      return;
+
+    ::close(m_fd);
+    m_fd = -1;
+    writeAttribute("enable", 0);
+  }
+
+  //! Set the duty cycle, skipping unchanged values.
+  //! @param[in] duty_cycle duty cycle (ns).
+  //! @return true if the value was written, false if unchanged.
+  bool setDutyCycle(uint32_t duty_cycle) {
+    if (duty_cycle == m_duty_cycle)
+      return false;
+
+    char bfr[16];
+    int len = std::snprintf(bfr, sizeof(bfr), "%u", duty_cycle);
+    if (::pwrite(m_fd, bfr, len, 0) != len)
+      throw std::runtime_error("unable to set " + m_path + " duty cycle: "
+                               + std::strerror(errno));
+    m_duty_cycle = duty_cycle;
+    ++m_writes;
+    return true;
+  }
+
+  //! Last duty cycle written (ns).
+  uint32_t getDutyCycle(void) const { return m_duty_cycle; }
+
+  //! Number of duty cycle updates written since the channel was enabled.
+  unsigned getWrites(void) const { return m_writes; }
+
+  //! Channel sysfs directory.
+  const std::string &getPath(void) const { return m_path; }
+
+  //! Write a value to a channel attribute.
+  //! @param[in] attribute attribute name.
+  //! @param[in] value value.
+  void writeAttribute(const char *attribute, uint32_t value) {
+    std::string file = m_path + "/" + attribute;
+    char bfr[16];
+    int len = std::snprintf(bfr, sizeof(bfr), "%u", value);
+
+    int fd = ::open(file.c_str(), O_WRONLY);
+    if (fd < 0)
+      throw std::runtime_error("unable to open " + file + ": "
+                               + std::strerror(errno));
+
+    ssize_t rv = ::write(fd, bfr, len);
+    int error = errno;
+    ::close(fd);
+    if (rv != len)
+      throw std::runtime_error("unable to set " + file + ": "
+                               + std::strerror(error));
+  }
+
+private:
+  //! Channel sysfs directory.
+  std::string m_path;
+  //! Duty cycle file descriptor.
+  int m_fd;
+  //! Last duty cycle written (ns).
+  uint32_t m_duty_cycle;
+  //! Number of duty cycle updates written.
+  unsigned m_writes;
+
+  PwmChannel(const PwmChannel &);
+  PwmChannel &operator=(const PwmChannel &);
+};
+} // namespace BR_T200
+} // namespace Actuators
+
+#endif
@@ -27,125 +27,269 @@
 // Author: Jorge Ferreira                                                    *
 //***************************************************************************
 
+// ISO C++ 98 headers.
+#include <cmath>
+#include <vector>
+
 // DUNE headers.
 #include <DUNE/DUNE.hpp>
 
+// Local headers.
+#include "../../Sensors/Common/SampleRing.hpp"
+#include "PwmChannel.hpp"
+#include "ThrustTable.hpp"
+
 namespace Actuators {
 namespace BR_T200 {
 using DUNE_NAMESPACES;
 
+//! Maximum number of thrusters.
+static const unsigned c_max_thrusters = 8;
+
+struct Arguments {
+  //! PWM sysfs directory.
+  std::string pwm_root;
+  //! PWM channel directories, one per thruster.
+  std::vector<std::string> channels;
+  //! PWM period (us).
+  unsigned period;
+  //! Actuation dead-band.
+  float dead_band;
+  //! Thrust curve actuations, per thruster.
+  std::vector<float> curve_actuation[c_max_thrusters];
+  //! Thrust curve pulse widths (us), per thruster.
+  std::vector<unsigned> curve_pulse[c_max_thrusters];
+  //! Actuation update frequency.
+  double frequency;
+  //! Maximum actuation rate of change.
+  double slew_rate;
+  //! Command timeout.
+  double timeout;
+};
+
+//! Thruster channel.
+struct Channel {
+  //! PWM output.
+  PwmChannel *pwm;
+  //! Actuation to pulse width table.
+  ThrustTable table;
+  //! Requested actuation.
+  float setpoint;
+  //! Time of the last actuation request.
+  double setpoint_time;
+  //! Actuation being output.
+  float actuation;
+};
+
 struct Task : public DUNE::Tasks::Task {
-  const uint32_t period = 10000000;
-  uint32_t pulseWidth1 = 1500000;
-  uint32_t pulseWidth2 = 1500000;
-  uint8_t enable = 1;
-  char setValue[9];
-  FILE *myOutputHandle;
+  //! PWM channels, indexed by thruster id.
+  std::vector<Channel> m_channels;
+  //! Actuation update period.
+  double m_period;
+  //! Task arguments.
+  Arguments m_args;
 
   Task(const std::string &name, Tasks::Context &ctx)
-      : DUNE::Tasks::Task(name, ctx) {
+      : DUNE::Tasks::Task(name, ctx), m_period(0.01) {
+    param("PWM Sysfs Path", m_args.pwm_root)
+        .defaultValue("/sys/class/pwm")
+        .description("Sysfs directory of the PWM chips");
+
+    param("PWM Channels", m_args.channels)
+        .defaultValue("pwmchip0/pwm0, pwmchip0/pwm1")
+        .description("PWM channel directories, relative to the sysfs "
+                     "path. The n-th channel drives the thruster with "
+                     "id n");
+
+    param("PWM Period", m_args.period)
+        .defaultValue("10000")
+        .minimumValue("2500")
+        .description("PWM period (us)");
+
+    param("Dead Band", m_args.dead_band)
+        .defaultValue("0")
+        .minimumValue("0")
+        .maximumValue("1")
+        .description("Actuations smaller than this in magnitude output "
+                     "the neutral pulse width");
+
+    for (unsigned i = 0; i < c_max_thrusters; ++i) {
+      param(String::str("Thruster %u - Actuation", i),
+            m_args.curve_actuation[i])
+          .defaultValue("-1, 1")
+          .description("Actuation points of the thrust curve, strictly "
+                       "increasing");
+
+      param(String::str("Thruster %u - Pulse Width", i),
+            m_args.curve_pulse[i])
+          .defaultValue("1100, 1900")
+          .description("Pulse widths (us) at each actuation point of the "
+                       "thrust curve");
+    }
+
+    param("Actuation Frequency", m_args.frequency)
+        .defaultValue("100")
+        .minimumValue("1")
+        .maximumValue("100")
+        .units(Units::Hertz)
+        .description("Rate at which the latest actuation requests are "
+                     "written to all thrusters. Should not exceed the PWM "
+                     "frequency");
+
+    param("Maximum Slew Rate", m_args.slew_rate)
+        .defaultValue("0")
+        .minimumValue("0")
+        .description("Maximum actuation change per second. If zero, "
+                     "requests are applied at once");
+
+    param("Command Timeout", m_args.timeout)
+        .defaultValue("1.0")
+        .minimumValue("0.1")
+        .units(Units::Second)
+        .description("Thrusters go to neutral if no actuation is requested "
+                     "for this long");
+
     bind<IMC::SetThrusterActuation>(this);
   }
 
-  //! Acquire resources.
-  void onResourceAcquisition(void) {
-    if ((myOutputHandle = fopen("/sys/class/pwm/pwmchip0/pwm0/period", "ab")) ==
-        NULL) {
-      throw std::runtime_error("Unable to set PWM0 period.");
-      return;
-    }
-    sprintf(setValue, "%u", period);
-    fwrite(&setValue, sizeof(char), 7, myOutputHandle);
-    fwrite(&setValue, sizeof(char), 8, myOutputHandle);
-    fclose(myOutputHandle);
-    if ((myOutputHandle = fopen("/sys/class/pwm/pwmchip0/pwm1/period", "ab")) ==
-        NULL) {
-      throw std::runtime_error("Unable to set PWM1 period.");
-      return;
-    }
-    fwrite(&setValue, sizeof(char), 8, myOutputHandle);
-    fclose(myOutputHandle);
-    if ((myOutputHandle =
-             fopen("/sys/class/pwm/pwmchip0/pwm0/duty_cycle", "ab")) == NULL) {
-      throw std::runtime_error("Unable to set PWM0 duty-cycle.");
-      return;
-    }
-    sprintf(setValue, "%u", pulseWidth1);
-    fwrite(&setValue, sizeof(char), 7, myOutputHandle);
-    fclose(myOutputHandle);
-    if ((myOutputHandle =
-             fopen("/sys/class/pwm/pwmchip0/pwm1/duty_cycle", "ab")) == NULL) {
-      throw std::runtime_error("Unable to set PWM1 duty-cycle.");
+  //! Update internal state with new parameter values.
+  void onUpdateParameters(void) {
+    m_period = 1.0 / m_args.frequency;
+
+    if (m_channels.empty())
       return;
+
+    bool changed = paramChanged(m_args.pwm_root)
+                   || paramChanged(m_args.channels)
+                   || paramChanged(m_args.period)
+                   || paramChanged(m_args.dead_band);
+    for (unsigned i = 0; i < c_max_thrusters; ++i) {
+      changed = paramChanged(m_args.curve_actuation[i]) || changed;
+      changed = paramChanged(m_args.curve_pulse[i]) || changed;
     }
-    sprintf(setValue, "%u", pulseWidth2);
-    fwrite(&setValue, sizeof(char), 7, myOutputHandle);
-    fclose(myOutputHandle);
-    if ((myOutputHandle = fopen("/sys/class/pwm/pwmchip0/pwm0/enable", "ab")) ==
-        NULL) {
-      throw std::runtime_error("Unable to set PWM0 enable.");
-      return;
+
+    if (changed)
+      throw RestartNeeded(DTR("thruster configuration changed"), 0);
+  }
+
+  //! Build a channel from the configuration.
+  void setupChannel(unsigned id, Channel &ch) {
+    ch.pwm = NULL;
+    ch.setpoint = 0.0f;
+    ch.setpoint_time = -1.0;
+    ch.actuation = 0.0f;
+
+    std::vector<uint32_t> pulse(m_args.curve_pulse[id].size());
+    for (unsigned i = 0; i < pulse.size(); ++i)
+      pulse[i] = m_args.curve_pulse[id][i] * 1000;
+
+    try {
+      ch.table.build(m_args.curve_actuation[id], pulse, m_args.dead_band);
+    } catch (std::exception &e) {
+      throw std::runtime_error(
+          String::str("thruster %u: %s", id, e.what()));
     }
-    fwrite(&enable, sizeof(uint8_t), 1, myOutputHandle);
-    fclose(myOutputHandle);
-    if ((myOutputHandle = fopen("/sys/class/pwm/pwmchip0/pwm1/enable", "ab")) ==
-        NULL) {
-      throw std::runtime_error("Unable to set PWM1 enable.");
-      return;
+
+    if (ch.table.getMaximum() >= m_args.period * 1000)
+      throw std::runtime_error(String::str(
+          "thruster %u: pulse width exceeds the PWM period", id));
+
+    ch.pwm = new PwmChannel(m_args.pwm_root + "/" + m_args.channels[id]);
+  }
+
+  //! Acquire resources.
+  void onResourceAcquisition(void) {
+    if (m_args.channels.empty() || m_args.channels.size() > c_max_thrusters)
+      throw std::runtime_error(String::str(
+          "between 1 and %u PWM channels are supported", c_max_thrusters));
+
+    m_channels.resize(m_args.channels.size());
+    for (unsigned i = 0; i < m_channels.size(); ++i)
+      setupChannel(i, m_channels[i]);
+
+    for (unsigned i = 0; i < m_channels.size(); ++i) {
+      Channel &ch = m_channels[i];
+      ch.pwm->enable(m_args.period * 1000, ch.table.lookup(0.0f));
     }
-    fwrite(&enable, sizeof(uint8_t), 1, myOutputHandle);
-    fclose(myOutputHandle);
+
+    inf(DTR("driving %u thrusters"), (unsigned)m_channels.size());
     setEntityState(IMC::EntityState::ESTA_NORMAL, Status::CODE_ACTIVE);
   }
 
+  //! Keep the latest request, applied on the next actuation update.
   void consume(const IMC::SetThrusterActuation *msg) {
-    // inf("Recebi %d %f", msg->id, msg->value);
-    if (msg->id == 0) {
-      pulseWidth1 = (1100 + 400 * (msg->value + 1)) * 1000;
-      if ((myOutputHandle = fopen("/sys/class/pwm/pwmchip0/pwm0/duty_cycle",
-                                  "ab")) == NULL) {
-        throw std::runtime_error("Unable to set PWM0 duty-cycle.");
-        return;
-      }
-      sprintf(setValue, "%u", pulseWidth1);
-      fwrite(&setValue, sizeof(char), 7, myOutputHandle);
-      fclose(myOutputHandle);
-    } else if (msg->id == 1) {
-      pulseWidth2 = (1100 + 400 * (msg->value + 1)) * 1000;
-      if ((myOutputHandle = fopen("/sys/class/pwm/pwmchip0/pwm1/duty_cycle",
-                                  "ab")) == NULL) {
-        throw std::runtime_error("Unable to set PWM1 duty-cycle.");
-        return;
-      }
-      sprintf(setValue, "%u", pulseWidth2);
-      fwrite(&setValue, sizeof(char), 7, myOutputHandle);
-      fclose(myOutputHandle);
+    if (msg->id >= m_channels.size())
+      return;
+
+    Channel &ch = m_channels[msg->id];
+    if (std::isfinite(msg->value)) {
+      ch.setpoint = trimValue(msg->value, -1.0f, 1.0f);
+    } else {
+      war(DTR("thruster %u: invalid actuation, going neutral"),
+          (unsigned)msg->id);
+      ch.setpoint = 0.0f;
+    }
+    ch.setpoint_time = Clock::get();
+  }
+
+  //! Write all channels together, limiting the rate of change and
+  //! falling back to neutral on stale requests.
+  void actuate(double now, double dt) {
+    float step = m_args.slew_rate * dt;
+    Sensors::Common::SampleRing &ring =
+        Sensors::Common::SampleRing::get(Sensors::Common::SS_THRUST);
+    Sensors::Common::Sample sample = {Clock::getSinceEpoch(), {0}};
+
+    for (unsigned i = 0; i < m_channels.size(); ++i) {
+      Channel &ch = m_channels[i];
+      float target = ch.setpoint;
+      if (ch.setpoint_time < 0 || now - ch.setpoint_time > m_args.timeout)
+        target = 0.0f;
+
+      if (m_args.slew_rate > 0)
+        ch.actuation += trimValue(target - ch.actuation, -step, step);
+      else
+        ch.actuation = target;
+
+      ch.pwm->setDutyCycle(ch.table.lookup(ch.actuation));
+
+      sample.value[0] = i;
+      sample.value[1] = target;
+      sample.value[2] = ch.actuation;
+      sample.value[3] = ch.pwm->getDutyCycle() / 1000.0f;
+      ring.write(sample);
     }
   }
 
   //! Release resources.
   void onResourceRelease(void) {
-    enable = 0;
-    if ((myOutputHandle = fopen("/sys/class/pwm/pwmchip0/pwm0/enable", "ab")) ==
-        NULL) {
-      throw std::runtime_error("Unable to set PWM0 enable.");
-      return;
-    }
-    fwrite(&enable, sizeof(uint8_t), 1, myOutputHandle);
-    fclose(myOutputHandle);
-    if ((myOutputHandle = fopen("/sys/class/pwm/pwmchip0/pwm1/enable", "ab")) ==
-        NULL) {
-      throw std::runtime_error("Unable to set PWM1 enable.");
-      return;
+    for (unsigned i = 0; i < m_channels.size(); ++i) {
+      if (m_channels[i].pwm == NULL)
+        continue;
+
+      m_channels[i].pwm->disable();
+      Memory::clear(m_channels[i].pwm);
     }
-    fwrite(&enable, sizeof(uint8_t), 1, myOutputHandle);
-    fclose(myOutputHandle);
+
+    m_channels.clear();
   }
 
   //! Main loop.
   void onMain(void) {
+    double deadline = Clock::get();
+
     while (!stopping()) {
-      consumeMessages();
+      double now = Clock::get();
+      if (now < deadline) {
+        waitForMessages(deadline - now);
+        continue;
+      }
+
+      // Do not try to catch up with updates that were missed.
+      deadline += m_period;
+      if (deadline < now)
+        deadline = now + m_period;
+      actuate(now, m_period);
     }
   }
 };
@@ -0,0 +1,130 @@
+
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef ACTUATORS_BR_T200_THRUST_TABLE_HPP_INCLUDED_
+#define ACTUATORS_BR_T200_THRUST_TABLE_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include <stdint.h>
+
+namespace Actuators {
+namespace BR_T200 {
+//! Actuation to pulse width mapping of one thruster, sampled once over
+//! [-1, 1] so that a request costs a single table lookup.
+class ThrustTable {
+public:
+  //! Table entries per unit of actuation.
+  static const unsigned c_resolution = 1000;
+  //! Number of table entries.
+  static const unsigned c_size = 2 * c_resolution + 1;
+
+  //! Constructor.
+  ThrustTable(void) : m_table(c_size, 0) {}
+
+  //! Sample a piecewise linear curve. Actuations inside the dead-band
+  //! map to the pulse width of zero actuation, actuations outside the
+  //! curve to its end points.
+  //! @param[in] actuation strictly increasing curve actuations.
+  //! @param[in] pulse pulse widths at each actuation (ns).
+  //! @param[in] dead_band dead-band half width.
+  void build(const std::vector<float> &actuation,
+             const std::vector<uint32_t> &pulse, float dead_band) {
+    if (actuation.size() < 2 || actuation.size() != pulse.size())
+      throw std::runtime_error("thrust curve needs at least two points "
+                               "and one pulse width per actuation");
+
+    for (unsigned i = 1; i < actuation.size(); ++i) {
+      if (actuation[i] <= actuation[i - 1])
+        throw std::runtime_error("thrust curve actuations must be "
+                                 "strictly increasing");
+    }
+
+    uint32_t neutral = interpolate(actuation, pulse, 0.0f);
+    for (unsigned i = 0; i < c_size; ++i) {
+      float a = (float)i / c_resolution - 1.0f;
+      if (std::fabs(a) < dead_band)
+        m_table[i] = neutral;
+      else
+        m_table[i] = interpolate(actuation, pulse, a);
+    }
+  }
+
+  //! Pulse width of an actuation.
+  //! @param[in] actuation actuation in [-1, 1]. Values outside saturate,
+  //! NaN maps to zero actuation.
+  //! @return pulse width (ns).
+  uint32_t lookup(float actuation) const {
+    if (std::isnan(actuation))
+      actuation = 0.0f;
+    else if (actuation < -1.0f)
+      actuation = -1.0f;
+    else if (actuation > 1.0f)
+      actuation = 1.0f;
+    return m_table[(unsigned)((actuation + 1.0f) * c_resolution + 0.5f)];
+  }
+
+  //! Largest pulse width in the table (ns).
+  uint32_t getMaximum(void) const {
+    uint32_t max = 0;
+    for (unsigned i = 0; i < c_size; ++i) {
+      if (m_table[i] > max)
+        max = m_table[i];
+    }
+    return max;
+  }
+
+private:
+  //! Sampled pulse widths (ns).
+  std::vector<uint32_t> m_table;
+
+  //! Evaluate the curve at an actuation.
+  static uint32_t interpolate(const std::vector<float> &actuation,
+                              const std::vector<uint32_t> &pulse, float a) {
+    if (a <= actuation.front())
+      return pulse.front();
+    if (a >= actuation.back())
+      return pulse.back();
+
+    unsigned i = 1;
+    while (actuation[i] < a)
+      ++i;
+
+    double t = (a - actuation[i - 1]) / (actuation[i] - actuation[i - 1]);
+    double p = pulse[i - 1] + t * ((double)pulse[i] - pulse[i - 1]);
+    return (uint32_t)(p + 0.5);
+  }
+};
+} // namespace BR_T200
+} // namespace Actuators
+
+#endif
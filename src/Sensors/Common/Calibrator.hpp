@@ -0,0 +1,159 @@
+
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef SENSORS_COMMON_CALIBRATOR_HPP_INCLUDED_
+#define SENSORS_COMMON_CALIBRATOR_HPP_INCLUDED_
+
+// ISO C++ 11 headers.
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// POSIX headers.
+#include <pthread.h>
+#include <sched.h>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "EllipsoidFit.hpp"
+
+namespace Sensors {
+namespace Common {
+using DUNE_NAMESPACES;
+
+//! Solves ellipsoid fits in a background thread of idle priority. The
+//! acquisition thread submits snapshots of its fit and picks up new
+//! corrections; neither call ever waits for the solver.
+class Calibrator : public Concurrency::Thread {
+public:
+  //! Constructor.
+  //! @param[in] fit initial fit, defines the sample normalization.
+  //! @param[in] radius sphere radius (raw units), zero to keep the
+  //! geometric mean radius of the ellipsoid.
+  //! @param[in] min_count minimum sample weight to solve.
+  //! @param[in] max_ratio largest accepted ratio between the ellipsoid
+  //! axes.
+  //! @param[in] max_residual largest accepted relative residual.
+  Calibrator(const EllipsoidFit &fit, double radius, double min_count,
+             double max_ratio, double max_residual)
+      : m_fit(fit), m_fit_new(false), m_result_new(false), m_radius(radius),
+        m_min_count(min_count), m_max_ratio(max_ratio),
+        m_max_residual(max_residual), m_rejected(0) {}
+
+  //! Submit a snapshot of a fit to be solved.
+  //! @param[in] fit fit.
+  //! @return true if the snapshot was taken, false if the solver was
+  //! busy copying and the snapshot should be submitted again later.
+  bool submit(const EllipsoidFit &fit) {
+    std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+      return false;
+    m_fit = fit;
+    m_fit_new = true;
+    m_cond.notify_one();
+    return true;
+  }
+
+  //! Get a new correction.
+  //! @param[out] c correction.
+  //! @return true if a correction was accepted since the previous call.
+  bool fetch(EllipsoidCorrection &c) {
+    std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+    if (!lock.owns_lock() || !m_result_new)
+      return false;
+    c = m_result;
+    m_result_new = false;
+    return true;
+  }
+
+  //! @return number of fits with enough samples that did not define an
+  //! acceptable ellipsoid, e.g. for lack of attitude changes.
+  unsigned getRejected(void) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_rejected;
+  }
+
+private:
+  //! Fit waiting to be solved, and last accepted correction.
+  EllipsoidFit m_fit;
+  bool m_fit_new;
+  EllipsoidCorrection m_result;
+  bool m_result_new;
+  //! Solution constraints.
+  double m_radius;
+  double m_min_count;
+  double m_max_ratio;
+  double m_max_residual;
+  //! Number of rejected solutions.
+  unsigned m_rejected;
+  //! Guards the fields above.
+  std::mutex m_mutex;
+  //! Signalled on submission.
+  std::condition_variable m_cond;
+
+  void run(void) {
+    // Only use the CPU left over by acquisition.
+    struct sched_param param;
+    param.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+    while (!isStopping()) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      if (!m_fit_new) {
+        m_cond.wait_for(lock, std::chrono::milliseconds(500));
+        continue;
+      }
+      EllipsoidFit fit = m_fit;
+      m_fit_new = false;
+      lock.unlock();
+
+      if (fit.getCount() < m_min_count)
+        continue;
+
+      EllipsoidCorrection c;
+      bool ok = fit.solve(m_radius, c) && c.ratio <= m_max_ratio
+                && c.residual <= m_max_residual;
+
+      lock.lock();
+      if (ok) {
+        m_result = c;
+        m_result_new = true;
+      } else {
+        ++m_rejected;
+      }
+    }
+  }
+};
+} // namespace Common
+} // namespace Sensors
+
+#endif
@@ -0,0 +1,159 @@
+
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef SENSORS_COMMON_DATA_READY_HPP_INCLUDED_
+#define SENSORS_COMMON_DATA_READY_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+// POSIX headers.
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Sensors {
+namespace Common {
+using DUNE_NAMESPACES;
+
+//! Paces sensor acquisition. Waits for the rising edge of a data ready
+//! line, exported through the sysfs GPIO interface, or, when no line is
+//! wired, for the next tick of a timer running at the output data rate.
+class DataReady {
+public:
+  //! Constructor.
+  //! @param[in] gpio data ready GPIO number, negative to use the timer.
+  //! @param[in] period sampling period of the sensor.
+  DataReady(int gpio, double period)
+      : m_gpio(gpio), m_fd(-1), m_period(period), m_deadline(-1.0) {
+    if (m_gpio < 0)
+      return;
+
+    // Exporting fails if the line is already exported.
+    writeAttribute("/sys/class/gpio/export", String::str(m_gpio), false);
+    writeAttribute(path("direction"), "in", true);
+    writeAttribute(path("edge"), "rising", true);
+
+    m_fd = ::open(path("value").c_str(), O_RDONLY | O_NONBLOCK);
+    if (m_fd < 0)
+      throw std::runtime_error(String::str("unable to open GPIO %d: %s",
+                                           m_gpio, std::strerror(errno)));
+    clear();
+  }
+
+  ~DataReady(void) {
+    if (m_fd >= 0)
+      ::close(m_fd);
+  }
+
+  //! Sleep until the sensor has a new sample.
+  //! @return false if the data ready line timed out, true otherwise.
+  bool wait(void) {
+    if (m_fd < 0)
+      return waitTimer();
+
+    pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLPRI | POLLERR;
+    pfd.revents = 0;
+
+    // Give up after a few missed samples so that a stuck line does not
+    // stall the task.
+    int timeout = (int)(std::max(10 * m_period, 0.1) * 1000);
+    int rv = ::poll(&pfd, 1, timeout);
+    if (rv < 0 && errno != EINTR)
+      throw std::runtime_error(String::str("unable to poll GPIO %d: %s",
+                                           m_gpio, std::strerror(errno)));
+    if (rv <= 0)
+      return false;
+
+    clear();
+    return true;
+  }
+
+private:
+  //! GPIO number.
+  int m_gpio;
+  //! GPIO value file descriptor.
+  int m_fd;
+  //! Sampling period.
+  double m_period;
+  //! Next timer deadline.
+  double m_deadline;
+
+  //! Get the path of a sysfs attribute of the GPIO.
+  std::string path(const char *attribute) const {
+    return String::str("/sys/class/gpio/gpio%d/%s", m_gpio, attribute);
+  }
+
+  //! Write a value to a sysfs attribute.
+  void writeAttribute(const std::string &file, const std::string &value,
+                      bool required) {
+    int fd = ::open(file.c_str(), O_WRONLY);
+    bool ok = fd >= 0 && ::write(fd, value.c_str(), value.size()) ==
+                             (ssize_t)value.size();
+    int error = errno;
+    if (fd >= 0)
+      ::close(fd);
+    if (!ok && required)
+      throw std::runtime_error(String::str(
+          "unable to write %s: %s", file.c_str(), std::strerror(error)));
+  }
+
+  //! Acknowledge the pending edge.
+  void clear(void) {
+    char value[4];
+    ::lseek(m_fd, 0, SEEK_SET);
+    if (::read(m_fd, value, sizeof(value)) < 0 && errno != EAGAIN)
+      throw std::runtime_error(String::str("unable to read GPIO %d: %s",
+                                           m_gpio, std::strerror(errno)));
+  }
+
+  //! Sleep until the next tick of the sampling period.
+  bool waitTimer(void) {
+    double now = Clock::get();
+    // Do not try to catch up with ticks that were missed.
+    if (m_deadline < 0 || now > m_deadline + m_period)
+      m_deadline = now;
+    m_deadline += m_period;
+    if (m_deadline > now)
+      Delay::wait(m_deadline - now);
+    return true;
+  }
+};
+} // namespace Common
+} // namespace Sensors
+
+#endif
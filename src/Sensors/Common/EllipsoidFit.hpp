@@ -0,0 +1,325 @@
+
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef SENSORS_COMMON_ELLIPSOID_FIT_HPP_INCLUDED_
+#define SENSORS_COMMON_ELLIPSOID_FIT_HPP_INCLUDED_
+
+// ISO C++ 11 headers.
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace Sensors {
+namespace Common {
+//! Correction of a vector sensor: corrected = matrix * (raw - offset).
+struct EllipsoidCorrection {
+  //! Offset, hard iron for magnetometers (raw units).
+  double offset[3];
+  //! Scale and cross axis matrix, soft iron for magnetometers.
+  double matrix[3][3];
+  //! Mean relative distance of the samples to the ellipsoid.
+  double residual;
+  //! Ratio between the longest and the shortest ellipsoid axes.
+  double ratio;
+
+  //! Set an axis aligned correction.
+  //! @param[in] bias offset (raw units).
+  //! @param[in] scale per axis scale factors.
+  template <typename B, typename S>
+  void setDiagonal(const B &bias, const S &scale) {
+    for (unsigned i = 0; i < 3; ++i) {
+      offset[i] = bias[i];
+      for (unsigned j = 0; j < 3; ++j)
+        matrix[i][j] = (i == j) ? scale[i] : 0.0;
+    }
+    residual = 0.0;
+    ratio = 1.0;
+  }
+
+  //! Correct a sample.
+  //! @param[in] raw raw sample.
+  //! @param[out] out corrected sample.
+  void apply(const double *raw, double *out) const {
+    double d[3] = {raw[0] - offset[0], raw[1] - offset[1], raw[2] - offset[2]};
+    for (unsigned i = 0; i < 3; ++i)
+      out[i] = matrix[i][0] * d[0] + matrix[i][1] * d[1] + matrix[i][2] * d[2];
+  }
+};
+
+//! Incremental least squares fit of an ellipsoid to vector samples, for
+//! hard and soft iron magnetometer calibration and accelerometer
+//! calibration. Samples are folded into the normal equations of the
+//! quadric x'Ax + 2g'x = 1, so memory and time per sample are constant.
+//! Old samples are forgotten exponentially, so the fit follows slow
+//! changes of the surroundings.
+class EllipsoidFit {
+public:
+  //! Number of quadric coefficients.
+  static const unsigned c_terms = 9;
+
+  //! Constructor.
+  //! @param[in] scale typical sample magnitude (raw units), used to keep
+  //! the normal equations well conditioned.
+  //! @param[in] memory number of samples after which a sample weighs
+  //! 1/e, zero to never forget.
+  EllipsoidFit(double scale, double memory)
+      : m_scale(1.0 / scale), m_decay(memory > 0 ? 1.0 - 1.0 / memory : 1.0) {
+    clear();
+  }
+
+  //! Forget all samples.
+  void clear(void) {
+    std::memset(m_ata, 0, sizeof(m_ata));
+    std::memset(m_atb, 0, sizeof(m_atb));
+    m_count = 0.0;
+  }
+
+  //! Add a sample.
+  //! @param[in] v sample (raw units).
+  void add(const double *v) {
+    double x = v[0] * m_scale;
+    double y = v[1] * m_scale;
+    double z = v[2] * m_scale;
+    double d[c_terms] = {x * x,     y * y,     z * z, 2 * x * y, 2 * x * z,
+                         2 * y * z, 2 * x,     2 * y, 2 * z};
+
+    unsigned k = 0;
+    for (unsigned i = 0; i < c_terms; ++i) {
+      m_atb[i] = m_decay * m_atb[i] + d[i];
+      for (unsigned j = i; j < c_terms; ++j, ++k)
+        m_ata[k] = m_decay * m_ata[k] + d[i] * d[j];
+    }
+    m_count = m_decay * m_count + 1.0;
+  }
+
+  //! @return weight of the samples, their number if nothing is forgotten.
+  double getCount(void) const { return m_count; }
+
+  //! Fit the ellipsoid and compute the correction mapping it to a sphere.
+  //! @param[in] radius sphere radius (raw units), zero to keep the
+  //! geometric mean radius of the ellipsoid.
+  //! @param[out] c correction.
+  //! @return true if the samples define an ellipsoid, false if they are
+  //! degenerate, e.g. confined to a plane.
+  bool solve(double radius, EllipsoidCorrection &c) const {
+    if (m_count <= c_terms)
+      return false;
+
+    // Cholesky factorization of the normal matrix.
+    double l[c_terms][c_terms];
+    double max_diag = 0.0;
+    unsigned k = 0;
+    for (unsigned i = 0; i < c_terms; ++i) {
+      for (unsigned j = i; j < c_terms; ++j, ++k)
+        l[j][i] = m_ata[k];
+      max_diag = std::max(max_diag, l[i][i]);
+    }
+
+    for (unsigned j = 0; j < c_terms; ++j) {
+      double s = l[j][j];
+      for (unsigned p = 0; p < j; ++p)
+        s -= l[j][p] * l[j][p];
+      if (s <= c_min_pivot * max_diag)
+        return false;
+      l[j][j] = std::sqrt(s);
+      for (unsigned i = j + 1; i < c_terms; ++i) {
+        double t = l[i][j];
+        for (unsigned p = 0; p < j; ++p)
+          t -= l[i][p] * l[j][p];
+        l[i][j] = t / l[j][j];
+      }
+    }
+
+    // Forward and back substitution.
+    double q[c_terms];
+    for (unsigned i = 0; i < c_terms; ++i) {
+      double t = m_atb[i];
+      for (unsigned p = 0; p < i; ++p)
+        t -= l[i][p] * q[p];
+      q[i] = t / l[i][i];
+    }
+    for (unsigned i = c_terms; i-- > 0;) {
+      double t = q[i];
+      for (unsigned p = i + 1; p < c_terms; ++p)
+        t -= l[p][i] * q[p];
+      q[i] = t / l[i][i];
+    }
+
+    // Quadric matrix and center.
+    double a[3][3] = {
+        {q[0], q[3], q[4]}, {q[3], q[1], q[5]}, {q[4], q[5], q[2]}};
+    double inv[3][3];
+    if (!invert(a, inv))
+      return false;
+
+    double center[3];
+    for (unsigned i = 0; i < 3; ++i)
+      center[i] = -(inv[i][0] * q[6] + inv[i][1] * q[7] + inv[i][2] * q[8]);
+
+    double kk = 1.0;
+    for (unsigned i = 0; i < 3; ++i)
+      for (unsigned j = 0; j < 3; ++j)
+        kk += center[i] * a[i][j] * center[j];
+    if (kk <= 0.0)
+      return false;
+
+    // Residual of x'Ax + 2g'x - 1, relative to the ellipsoid size. For
+    // small errors it is twice the relative radial distance.
+    double res = m_count;
+    k = 0;
+    for (unsigned i = 0; i < c_terms; ++i) {
+      res -= 2 * q[i] * m_atb[i];
+      for (unsigned j = i; j < c_terms; ++j, ++k)
+        res += (i == j ? 1 : 2) * q[i] * q[j] * m_ata[k];
+    }
+    c.residual = std::sqrt(std::max(res, 0.0) / m_count) / (2 * kk);
+
+    // Eigen decomposition of the ellipsoid matrix, semi axes are the
+    // inverse square roots of the eigenvalues.
+    double m[3][3];
+    double r[3][3];
+    for (unsigned i = 0; i < 3; ++i)
+      for (unsigned j = 0; j < 3; ++j)
+        m[i][j] = a[i][j] / kk;
+    eigen(m, r);
+
+    double lmin = std::min(m[0][0], std::min(m[1][1], m[2][2]));
+    double lmax = std::max(m[0][0], std::max(m[1][1], m[2][2]));
+    if (lmin <= 0.0)
+      return false;
+    c.ratio = std::sqrt(lmax / lmin);
+
+    double gain;
+    if (radius > 0)
+      gain = radius * m_scale;
+    else
+      gain = std::pow(m[0][0] * m[1][1] * m[2][2], -1.0 / 6.0);
+
+    // Matrix square root, scaled to the sphere radius.
+    for (unsigned i = 0; i < 3; ++i) {
+      c.offset[i] = center[i] / m_scale;
+      for (unsigned j = 0; j < 3; ++j) {
+        double t = 0.0;
+        for (unsigned p = 0; p < 3; ++p)
+          t += r[i][p] * std::sqrt(m[p][p]) * r[j][p];
+        c.matrix[i][j] = gain * t;
+      }
+    }
+
+    return true;
+  }
+
+private:
+  //! Smallest Cholesky pivot, relative to the largest diagonal element.
+  static constexpr double c_min_pivot = 1e-12;
+  //! Normal matrix, upper triangle by rows.
+  double m_ata[c_terms * (c_terms + 1) / 2];
+  //! Normal equations right hand side.
+  double m_atb[c_terms];
+  //! Sample weight.
+  double m_count;
+  //! Sample normalization factor.
+  double m_scale;
+  //! Forgetting factor.
+  double m_decay;
+
+  //! Invert a 3x3 matrix.
+  //! @return false if the matrix is singular.
+  static bool invert(const double a[3][3], double inv[3][3]) {
+    inv[0][0] = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+    inv[0][1] = a[0][2] * a[2][1] - a[0][1] * a[2][2];
+    inv[0][2] = a[0][1] * a[1][2] - a[0][2] * a[1][1];
+    inv[1][0] = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+    inv[1][1] = a[0][0] * a[2][2] - a[0][2] * a[2][0];
+    inv[1][2] = a[0][2] * a[1][0] - a[0][0] * a[1][2];
+    inv[2][0] = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+    inv[2][1] = a[0][1] * a[2][0] - a[0][0] * a[2][1];
+    inv[2][2] = a[0][0] * a[1][1] - a[0][1] * a[1][0];
+
+    double det =
+        a[0][0] * inv[0][0] + a[0][1] * inv[1][0] + a[0][2] * inv[2][0];
+    if (det == 0.0)
+      return false;
+    for (unsigned i = 0; i < 3; ++i)
+      for (unsigned j = 0; j < 3; ++j)
+        inv[i][j] /= det;
+    return true;
+  }
+
+  //! Jacobi eigen decomposition of a symmetric 3x3 matrix. On return the
+  //! diagonal of m holds the eigenvalues and the columns of r the
+  //! eigenvectors.
+  static void eigen(double m[3][3], double r[3][3]) {
+    for (unsigned i = 0; i < 3; ++i)
+      for (unsigned j = 0; j < 3; ++j)
+        r[i][j] = (i == j) ? 1.0 : 0.0;
+
+    for (unsigned sweep = 0; sweep < 16; ++sweep) {
+      double off = m[0][1] * m[0][1] + m[0][2] * m[0][2] + m[1][2] * m[1][2];
+      if (off < 1e-30)
+        break;
+
+      for (unsigned p = 0; p < 2; ++p) {
+        for (unsigned q = p + 1; q < 3; ++q) {
+          if (m[p][q] == 0.0)
+            continue;
+          double theta = (m[q][q] - m[p][p]) / (2 * m[p][q]);
+          double t = (theta >= 0 ? 1.0 : -1.0)
+                     / (std::fabs(theta) + std::sqrt(theta * theta + 1));
+          double cs = 1.0 / std::sqrt(t * t + 1);
+          double sn = t * cs;
+
+          for (unsigned k = 0; k < 3; ++k) {
+            double mkp = m[k][p];
+            double mkq = m[k][q];
+            m[k][p] = cs * mkp - sn * mkq;
+            m[k][q] = sn * mkp + cs * mkq;
+          }
+          for (unsigned k = 0; k < 3; ++k) {
+            double mpk = m[p][k];
+            double mqk = m[q][k];
+            m[p][k] = cs * mpk - sn * mqk;
+            m[q][k] = sn * mpk + cs * mqk;
+          }
+          for (unsigned k = 0; k < 3; ++k) {
+            double rkp = r[k][p];
+            double rkq = r[k][q];
+            r[k][p] = cs * rkp - sn * rkq;
+            r[k][q] = sn * rkp + cs * rkq;
+          }
+        }
+      }
+    }
+  }
+};
+} // namespace Common
+} // namespace Sensors
+
+#endif
@@ -0,0 +1,465 @@
+
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef SENSORS_COMMON_I2C_BUS_HPP_INCLUDED_
+#define SENSORS_COMMON_I2C_BUS_HPP_INCLUDED_
+
+// ISO C++ 11 headers.
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// POSIX headers.
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// Linux headers.
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+
+namespace Sensors {
+namespace Common {
+//! I2C adapter. Performs combined transfers, with a repeated start
+//! between messages. Implemented in user space to run drivers against a
+//! fake bus. As on the BCM2835 controller, a combined transfer holds at
+//! most one read, and only as its last message.
+class I2CAdapter {
+public:
+  virtual ~I2CAdapter(void) {}
+
+  //! Perform a combined transfer.
+  //! @param[in,out] msgs messages to transfer.
+  //! @param[in] count number of messages.
+  virtual void transfer(struct i2c_msg *msgs, unsigned count) = 0;
+};
+
+//! Linux I2C adapter, driven through the I2C_RDWR ioctl of an i2c-dev
+//! character device.
+class LinuxI2CAdapter : public I2CAdapter {
+public:
+  //! Constructor.
+  //! @param[in] path i2c-dev device path.
+  explicit LinuxI2CAdapter(const std::string &path) {
+    m_fd = ::open(path.c_str(), O_RDWR);
+    if (m_fd < 0)
+      throw std::runtime_error("unable to open " + path + ": "
+                               + std::strerror(errno));
+  }
+
+  //! Adapter factory, for I2CBus::open.
+  //! @param[in] path i2c-dev device path.
+  //! @return new adapter.
+  static I2CAdapter *create(const std::string &path) {
+    return new LinuxI2CAdapter(path);
+  }
+
+  ~LinuxI2CAdapter(void) { ::close(m_fd); }
+
+  void transfer(struct i2c_msg *msgs, unsigned count) {
+    struct i2c_rdwr_ioctl_data data;
+    data.msgs = msgs;
+    data.nmsgs = count;
+    if (::ioctl(m_fd, I2C_RDWR, &data) < 0) {
+      char error[64];
+      std::snprintf(error, sizeof(error), "I2C transfer to 0x%02x failed: ",
+                    msgs[0].addr);
+      throw std::runtime_error(error + std::string(std::strerror(errno)));
+    }
+  }
+
+private:
+  //! Device file descriptor.
+  int m_fd;
+};
+
+//! Register operations sent to a device in one combined transfer. Lives on
+//! the stack of the caller; no memory is allocated. Any number of writes
+//! may be followed by a single read, which ends the transaction.
+class I2CTransaction {
+public:
+  //! Maximum number of register operations.
+  static const unsigned c_max_ops = 16;
+
+  I2CTransaction(void) : m_count(0), m_bytes(0), m_read(false) {}
+
+  //! Read a block of consecutive registers. No operation can follow.
+  //! @param[in] reg first register.
+  //! @param[out] data register values, valid after execution.
+  //! @param[in] size number of registers.
+  void read(uint8_t reg, uint8_t *data, size_t size) {
+    reserve();
+    m_read = true;
+    m_buffer[m_count][0] = reg;
+    add(0, m_buffer[m_count], 1);
+    add(I2C_M_RD, data, size);
+  }
+
+  //! Write one register.
+  //! @param[in] reg register.
+  //! @param[in] value register value.
+  void write(uint8_t reg, uint8_t value) {
+    reserve();
+    m_buffer[m_count][0] = reg;
+    m_buffer[m_count][1] = value;
+    add(0, m_buffer[m_count], 2);
+  }
+
+  //! @return true if there are no operations.
+  bool empty(void) const { return m_count == 0; }
+
+private:
+  friend class I2CDevice;
+
+  //! Messages, one per write and two for the final read.
+  struct i2c_msg m_msgs[c_max_ops + 1];
+  //! Register address and written value of each message.
+  uint8_t m_buffer[c_max_ops + 1][2];
+  //! Number of messages.
+  unsigned m_count;
+  //! Number of bytes transferred, without addressing.
+  size_t m_bytes;
+  //! True once the transaction ends with a read.
+  bool m_read;
+
+  void reserve(void) {
+    if (m_read)
+      throw std::logic_error("an I2C read must be the last operation of a "
+                             "transaction");
+    if (m_count >= c_max_ops)
+      throw std::length_error("too many I2C operations in one transaction");
+  }
+
+  void add(uint16_t flags, uint8_t *data, size_t size) {
+    m_msgs[m_count].flags = flags;
+    m_msgs[m_count].len = (uint16_t)size;
+    m_msgs[m_count].buf = data;
+    ++m_count;
+    m_bytes += size;
+  }
+};
+
+class I2CDevice;
+
+//! Shared I2C bus. Owns the adapter and serializes the transactions of
+//! all devices on it. When the bus is released it is granted to the
+//! waiting device with the highest priority, then to the one with the
+//! earliest deadline, so a device is delayed by at most one transaction
+//! of a lower priority device.
+class I2CBus {
+public:
+  //! Constructor.
+  //! @param[in] adapter adapter, owned by the bus.
+  explicit I2CBus(I2CAdapter *adapter)
+      : m_adapter(adapter), m_owner(NULL), m_busy(0.0) {}
+
+  //! Creates the adapter of a bus.
+  typedef I2CAdapter *(*AdapterFactory)(const std::string &path);
+
+  //! Get the bus of an i2c-dev device, shared by all drivers in the
+  //! process. The device is closed with the last handle.
+  //! @param[in] path i2c-dev device path.
+  //! @return bus handle.
+  static std::shared_ptr<I2CBus> open(const std::string &path) {
+    return open(path, &LinuxI2CAdapter::create);
+  }
+
+  //! Get a shared bus, creating its adapter with the given factory if it
+  //! is not open yet.
+  //! @param[in] path bus path.
+  //! @param[in] factory adapter factory.
+  //! @return bus handle.
+  static std::shared_ptr<I2CBus> open(const std::string &path,
+                                      AdapterFactory factory) {
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<I2CBus>> buses;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<I2CBus> bus = buses[path].lock();
+    if (!bus) {
+      bus = std::make_shared<I2CBus>(factory(path));
+      buses[path] = bus;
+    }
+    return bus;
+  }
+
+  //! @return time spent transferring since the bus was created.
+  double getBusyTime(void) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_busy;
+  }
+
+private:
+  friend class I2CDevice;
+
+  //! Adapter.
+  std::unique_ptr<I2CAdapter> m_adapter;
+  //! Devices on the bus.
+  std::vector<I2CDevice *> m_devices;
+  //! Device holding the bus, NULL if idle.
+  I2CDevice *m_owner;
+  //! Time spent transferring.
+  double m_busy;
+  //! Arbitration lock.
+  std::mutex m_mutex;
+
+  I2CBus(const I2CBus &);
+  I2CBus &operator=(const I2CBus &);
+
+  void attach(I2CDevice *device) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_devices.push_back(device);
+  }
+
+  void detach(I2CDevice *device) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_devices.size(); ++i) {
+      if (m_devices[i] == device) {
+        m_devices.erase(m_devices.begin() + i);
+        break;
+      }
+    }
+  }
+
+  inline void acquire(I2CDevice *device, double deadline);
+
+  inline void release(double busy);
+};
+
+//! Device on a shared I2C bus. Used by one thread at a time.
+class I2CDevice {
+public:
+  //! Bus usage since the previous snapshot.
+  struct Stats {
+    //! Number of transactions.
+    uint64_t transactions;
+    //! Number of bytes transferred, without addressing.
+    uint64_t bytes;
+    //! Fraction of time spent transferring for this device.
+    double utilization;
+    //! Fraction of time spent transferring for all devices.
+    double bus_utilization;
+    //! Average time waiting for the bus (s).
+    double wait;
+    //! Maximum time waiting for the bus (s).
+    double max_wait;
+  };
+
+  //! Constructor.
+  //! @param[in] bus bus.
+  //! @param[in] address 7 bit device address.
+  //! @param[in] priority bus priority, higher goes first.
+  //! @param[in] latency time after a request within which the transaction
+  //! should complete, used to order requests of equal priority.
+  I2CDevice(const std::shared_ptr<I2CBus> &bus, uint8_t address,
+            unsigned priority, double latency)
+      : m_bus(bus), m_address(address), m_priority(priority),
+        m_latency(latency), m_waiting(false), m_deadline(0.0),
+        m_stats_tstamp(now()), m_stats_bus_busy(bus->getBusyTime()) {
+    resetStats();
+    m_bus->attach(this);
+  }
+
+  ~I2CDevice(void) { m_bus->detach(this); }
+
+  //! Execute the operations of a transaction in one combined transfer.
+  //! @param[in,out] t transaction.
+  void execute(I2CTransaction &t) {
+    if (t.empty())
+      return;
+
+    for (unsigned i = 0; i < t.m_count; ++i)
+      t.m_msgs[i].addr = m_address;
+
+    double request = now();
+    m_bus->acquire(this, request + m_latency);
+    double start = now();
+    try {
+      m_bus->m_adapter->transfer(t.m_msgs, t.m_count);
+    } catch (...) {
+      m_bus->release(now() - start);
+      throw;
+    }
+    double busy = now() - start;
+    m_bus->release(busy);
+
+    double wait = start - request;
+    ++m_transactions;
+    m_bytes += t.m_bytes;
+    m_busy += busy;
+    m_wait += wait;
+    if (wait > m_max_wait)
+      m_max_wait = wait;
+  }
+
+  //! Read a block of consecutive registers.
+  //! @param[in] reg first register.
+  //! @param[out] data register values.
+  //! @param[in] size number of registers.
+  void read(uint8_t reg, uint8_t *data, size_t size) {
+    I2CTransaction t;
+    t.read(reg, data, size);
+    execute(t);
+  }
+
+  //! Read one register.
+  //! @param[in] reg register.
+  //! @return register value.
+  uint8_t read(uint8_t reg) {
+    uint8_t value = 0;
+    read(reg, &value, 1);
+    return value;
+  }
+
+  //! Write one register.
+  //! @param[in] reg register.
+  //! @param[in] value register value.
+  void write(uint8_t reg, uint8_t value) {
+    I2CTransaction t;
+    t.write(reg, value);
+    execute(t);
+  }
+
+  //! Get the bus usage since the previous call and restart counting.
+  //! @return bus usage.
+  Stats takeStats(void) {
+    double tstamp = now();
+    double bus_busy = m_bus->getBusyTime();
+    double period = tstamp - m_stats_tstamp;
+
+    Stats s;
+    s.transactions = m_transactions;
+    s.bytes = m_bytes;
+    s.utilization = period > 0 ? m_busy / period : 0.0;
+    s.bus_utilization =
+        period > 0 ? (bus_busy - m_stats_bus_busy) / period : 0.0;
+    s.wait = m_transactions > 0 ? m_wait / m_transactions : 0.0;
+    s.max_wait = m_max_wait;
+
+    resetStats();
+    m_stats_tstamp = tstamp;
+    m_stats_bus_busy = bus_busy;
+    return s;
+  }
+
+private:
+  friend class I2CBus;
+
+  //! Bus.
+  std::shared_ptr<I2CBus> m_bus;
+  //! Device address.
+  uint16_t m_address;
+  //! Bus priority.
+  unsigned m_priority;
+  //! Requested transaction latency.
+  double m_latency;
+  //! Waiting for the bus, guarded by the bus lock.
+  bool m_waiting;
+  //! Deadline of the pending request, guarded by the bus lock.
+  double m_deadline;
+  //! Signalled when the bus is granted to this device.
+  std::condition_variable m_granted;
+  //! Statistics counters.
+  uint64_t m_transactions;
+  uint64_t m_bytes;
+  double m_busy;
+  double m_wait;
+  double m_max_wait;
+  //! Time of the previous statistics snapshot.
+  double m_stats_tstamp;
+  //! Bus busy time at the previous statistics snapshot.
+  double m_stats_bus_busy;
+
+  I2CDevice(const I2CDevice &);
+  I2CDevice &operator=(const I2CDevice &);
+
+  //! @return monotonic time (s).
+  static double now(void) {
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  void resetStats(void) {
+    m_transactions = 0;
+    m_bytes = 0;
+    m_busy = 0.0;
+    m_wait = 0.0;
+    m_max_wait = 0.0;
+  }
+};
+
+void I2CBus::acquire(I2CDevice *device, double deadline) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_owner == NULL) {
+    m_owner = device;
+    return;
+  }
+
+  device->m_deadline = deadline;
+  device->m_waiting = true;
+  while (m_owner != device)
+    device->m_granted.wait(lock);
+}
+
+void I2CBus::release(double busy) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_busy += busy;
+
+  I2CDevice *next = NULL;
+  for (size_t i = 0; i < m_devices.size(); ++i) {
+    I2CDevice *d = m_devices[i];
+    if (!d->m_waiting)
+      continue;
+    if (next == NULL || d->m_priority > next->m_priority
+        || (d->m_priority == next->m_priority
+            && d->m_deadline < next->m_deadline))
+      next = d;
+  }
+
+  m_owner = next;
+  if (next != NULL) {
+    next->m_waiting = false;
+    next->m_granted.notify_one();
+  }
+}
+} // namespace Common
+} // namespace Sensors
+
+#endif
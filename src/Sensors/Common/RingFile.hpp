@@ -0,0 +1,269 @@
+
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef SENSORS_COMMON_RING_FILE_HPP_INCLUDED_
+#define SENSORS_COMMON_RING_FILE_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+
+// POSIX headers.
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Local headers.
+#include "SampleRing.hpp"
+
+namespace Sensors {
+namespace Common {
+//! Layout of a sample stream.
+struct StreamInfo {
+  //! Stream name, also used in file names.
+  const char *name;
+  //! Number of sample values in use.
+  unsigned values;
+  //! Comma separated value names.
+  const char *columns;
+};
+
+//! Get the layout of a sample stream.
+//! @param[in] stream stream.
+//! @return stream layout.
+inline const StreamInfo &getStreamInfo(Stream stream) {
+  static const StreamInfo info[SS_COUNT] = {
+      {"imu", 6, "ax,ay,az,gx,gy,gz"},
+      {"magnetic_field", 3, "x,y,z"},
+      {"range", 6,
+       "distance,strength,temperature,filtered,closing_speed,contact_time"},
+      {"target", 6, "bearing,range,confidence,latency,x,size"},
+      {"thrust", 4, "id,requested,applied,pulse_width"}};
+  return info[stream];
+}
+
+//! Ring file header, at the start of the file, little endian.
+struct RingFileHeader {
+  //! File magic, c_ring_file_magic.
+  char magic[8];
+  //! Sample stream.
+  uint32_t stream;
+  //! Record size (bytes).
+  uint32_t record_size;
+  //! Number of records.
+  uint64_t capacity;
+  //! Number of records written since the file was created. The newest
+  //! record is at (head - 1) % capacity.
+  uint64_t head;
+  //! Number of samples lost by the recorder.
+  uint64_t lost;
+  //! Creation time (seconds since epoch).
+  double created;
+  //! Reserved, zero.
+  uint8_t reserved[16];
+};
+
+//! Ring file record, a fixed width timestamped sample.
+struct RingFileRecord {
+  //! Acquisition time (seconds since epoch).
+  double tstamp;
+  //! Sample values, see Sample.
+  float value[6];
+};
+
+static_assert(sizeof(RingFileHeader) == 64, "unexpected header padding");
+static_assert(sizeof(RingFileRecord) == 32, "unexpected record padding");
+
+//! Ring file magic, without the terminator.
+static const char c_ring_file_magic[] = "RAWREC01";
+
+//! Memory mapped file holding a ring of samples of one stream. The file
+//! is allocated and its pages faulted in when it is created, so writing a
+//! sample is a copy to memory: the kernel writes the pages back in the
+//! background.
+class RingFile {
+public:
+  //! Create a ring file for writing. An existing file is replaced.
+  //! @param[in] path file path.
+  //! @param[in] stream sample stream.
+  //! @param[in] capacity number of records.
+  //! @param[in] created creation time (seconds since epoch).
+  RingFile(const std::string &path, Stream stream, uint64_t capacity,
+           double created)
+      : m_path(path), m_writable(true), m_fd(-1), m_size(0), m_data(NULL) {
+    m_size = sizeof(RingFileHeader) + capacity * sizeof(RingFileRecord);
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0)
+      fail("unable to create");
+
+    int rv = ::posix_fallocate(m_fd, 0, m_size);
+    if (rv != 0) {
+      errno = rv;
+      fail("unable to allocate");
+    }
+
+    map(PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE);
+
+    RingFileHeader *h = header();
+    std::memset(h, 0, sizeof(*h));
+    std::memcpy(h->magic, c_ring_file_magic, sizeof(h->magic));
+    h->stream = stream;
+    h->record_size = sizeof(RingFileRecord);
+    h->capacity = capacity;
+    h->created = created;
+  }
+
+  //! Open a ring file for reading. It may still be being written.
+  //! @param[in] path file path.
+  explicit RingFile(const std::string &path)
+      : m_path(path), m_writable(false), m_fd(-1), m_size(0), m_data(NULL) {
+    m_fd = ::open(path.c_str(), O_RDONLY);
+    if (m_fd < 0)
+      fail("unable to open");
+
+    struct stat st;
+    if (::fstat(m_fd, &st) < 0)
+      fail("unable to stat");
+    m_size = st.st_size;
+    if (m_size < sizeof(RingFileHeader))
+      invalid("truncated header");
+
+    map(PROT_READ, MAP_SHARED);
+
+    const RingFileHeader *h = header();
+    if (std::memcmp(h->magic, c_ring_file_magic, sizeof(h->magic)) != 0)
+      invalid("not a ring file");
+    if (h->stream >= SS_COUNT || h->record_size != sizeof(RingFileRecord))
+      invalid("unsupported layout");
+    if (m_size < sizeof(RingFileHeader) + h->capacity * h->record_size)
+      invalid("truncated records");
+  }
+
+  ~RingFile(void) {
+    if (m_writable)
+      ::msync(m_data, m_size, MS_SYNC);
+    ::munmap(m_data, m_size);
+    ::close(m_fd);
+  }
+
+  //! Append a sample, overwriting the oldest one when full.
+  //! @param[in] sample sample.
+  void write(const Sample &sample) {
+    RingFileHeader *h = header();
+    uint64_t head = h->head;
+    RingFileRecord &r = records()[head % h->capacity];
+    r.tstamp = sample.tstamp;
+    std::memcpy(r.value, sample.value, sizeof(r.value));
+    // Readers of a live file see the record before the new head.
+    __atomic_store_n(&h->head, head + 1, __ATOMIC_RELEASE);
+  }
+
+  //! Account for samples lost before they were written.
+  //! @param[in] count number of samples.
+  void addLost(uint64_t count) { header()->lost += count; }
+
+  //! Schedule the write back of the file.
+  void flush(void) { ::msync(m_data, m_size, MS_ASYNC); }
+
+  //! @return file header.
+  const RingFileHeader &getHeader(void) const { return *header(); }
+
+  //! @return number of records held, at most the capacity.
+  uint64_t getCount(void) const {
+    const RingFileHeader *h = header();
+    return count(h, __atomic_load_n(&h->head, __ATOMIC_ACQUIRE));
+  }
+
+  //! Get a record, oldest first.
+  //! @param[in] index record index, below getCount().
+  //! @return record.
+  const RingFileRecord &getRecord(uint64_t index) const {
+    const RingFileHeader *h = header();
+    uint64_t head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+    return records()[(head - count(h, head) + index) % h->capacity];
+  }
+
+private:
+  //! File path.
+  std::string m_path;
+  //! Opened for writing.
+  bool m_writable;
+  //! File descriptor.
+  int m_fd;
+  //! File size.
+  size_t m_size;
+  //! Mapped file.
+  void *m_data;
+
+  RingFile(const RingFile &);
+  RingFile &operator=(const RingFile &);
+
+  void map(int prot, int flags) {
+    void *data = ::mmap(NULL, m_size, prot, flags, m_fd, 0);
+    if (data == MAP_FAILED)
+      fail("unable to map");
+    m_data = data;
+  }
+
+  RingFileHeader *header(void) const {
+    return static_cast<RingFileHeader *>(m_data);
+  }
+
+  RingFileRecord *records(void) const {
+    return reinterpret_cast<RingFileRecord *>(header() + 1);
+  }
+
+  static uint64_t count(const RingFileHeader *h, uint64_t head) {
+    return head < h->capacity ? head : h->capacity;
+  }
+
+  void fail(const char *what) {
+    std::string error = what + (" " + m_path) + ": " + std::strerror(errno);
+    if (m_fd >= 0)
+      ::close(m_fd);
+    throw std::runtime_error(error);
+  }
+
+  void invalid(const char *what) {
+    std::string error = m_path + ": " + what;
+    if (m_data != NULL)
+      ::munmap(m_data, m_size);
+    ::close(m_fd);
+    throw std::runtime_error(error);
+  }
+};
+} // namespace Common
+} // namespace Sensors
+
+#endif
@@ -0,0 +1,177 @@
+
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef SENSORS_COMMON_SAMPLE_RING_HPP_INCLUDED_
+#define SENSORS_COMMON_SAMPLE_RING_HPP_INCLUDED_
+
+// ISO C++ 11 headers.
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+namespace Sensors {
+namespace Common {
+//! Timestamped sensor sample.
+struct Sample {
+  //! Acquisition time (seconds since epoch).
+  double tstamp;
+  //! Sample values, depending on the stream:
+  //! - SS_IMU: acceleration x, y, z (m/s/s), angular velocity x, y, z
+  //!   (rad/s).
+  //! - SS_MAGNETIC_FIELD: magnetic field x, y, z (G).
+  //! - SS_RANGE: distance (m), signal strength, temperature (degrees
+  //!   Celsius), filtered range (m, negative if unknown), closing speed
+  //!   (m/s), time to contact (s, negative if not approaching).
+  //! - SS_TARGET: docking target bearing (rad, positive to starboard),
+  //!   range (m, negative if unknown), detection confidence (zero if not
+  //!   detected), processing latency (s), image position (px), apparent
+  //!   diameter (px). Stamped with the frame capture time.
+  //! - SS_THRUST: thruster id, requested actuation (neutral after a
+  //!   command timeout), applied actuation, pulse width (us). One sample
+  //!   per thruster and actuation update.
+  float value[6];
+};
+
+//! Sample streams. Each stream is written by one driver only.
+enum Stream {
+  SS_IMU,
+  SS_MAGNETIC_FIELD,
+  SS_RANGE,
+  SS_TARGET,
+  SS_THRUST,
+  SS_COUNT
+};
+
+//! Single-producer, multiple-consumer ring of samples shared by the tasks
+//! of one process. The producer never blocks: old samples are overwritten
+//! and slow consumers skip ahead, counting what they lost. Each slot is
+//! guarded by a sequence number, so a consumer detects a slot being
+//! rewritten under it.
+class SampleRing {
+public:
+  //! Number of slots (power of two).
+  static const uint64_t c_capacity = 1024;
+
+  //! Consumer position.
+  struct Cursor {
+    //! Sequence number of the next sample to read.
+    uint64_t next;
+    //! Number of samples overwritten before they were read.
+    uint64_t lost;
+  };
+
+  //! Get the ring of a stream.
+  static SampleRing &get(Stream stream) {
+    static SampleRing rings[SS_COUNT];
+    return rings[stream];
+  }
+
+  //! Get a cursor positioned after the newest sample.
+  Cursor cursor(void) const {
+    Cursor c = {m_head.load(std::memory_order_acquire), 0};
+    return c;
+  }
+
+  //! Publish a sample. Must only be called by the stream's producer.
+  void write(const Sample &sample) {
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    Slot &slot = m_slots[head & (c_capacity - 1)];
+
+    slot.seq.store(2 * head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.sample = sample;
+    slot.seq.store(2 * head + 2, std::memory_order_release);
+    m_head.store(head + 1, std::memory_order_release);
+  }
+
+  //! Read the next sample.
+  //! @param[in,out] c consumer cursor.
+  //! @param[out] sample sample read.
+  //! @return true if a sample was read, false if there are no new samples.
+  bool read(Cursor &c, Sample &sample) const {
+    while (true) {
+      uint64_t head = m_head.load(std::memory_order_acquire);
+      if (c.next >= head)
+        return false;
+
+      if (head - c.next > c_capacity) {
+        c.lost += head - c_capacity - c.next;
+        c.next = head - c_capacity;
+      }
+
+      const Slot &slot = m_slots[c.next & (c_capacity - 1)];
+      uint64_t seq = slot.seq.load(std::memory_order_acquire);
+      if (seq == 2 * c.next + 2) {
+        sample = slot.sample;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == seq) {
+          ++c.next;
+          return true;
+        }
+      }
+
+      // The producer lapped us while reading.
+      ++c.lost;
+      ++c.next;
+    }
+  }
+
+  //! Read all new samples and keep the newest one.
+  //! @return true if a sample was read, false otherwise.
+  bool readLatest(Cursor &c, Sample &sample) const {
+    bool rv = false;
+    while (read(c, sample))
+      rv = true;
+    return rv;
+  }
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> seq;
+    Sample sample;
+  };
+
+  //! Sequence number of the next sample to write.
+  alignas(64) std::atomic<uint64_t> m_head;
+  //! Sample slots.
+  alignas(64) Slot m_slots[c_capacity];
+
+  SampleRing(void) : m_head(0) {
+    for (uint64_t i = 0; i < c_capacity; ++i)
+      m_slots[i].seq.store(0, std::memory_order_relaxed);
+  }
+
+  SampleRing(const SampleRing &);
+  SampleRing &operator=(const SampleRing &);
+};
+} // namespace Common
+} // namespace Sensors
+
+#endif
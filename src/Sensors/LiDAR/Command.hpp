@@ -0,0 +1,220 @@
+
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef SENSORS_LIDAR_COMMAND_HPP_INCLUDED_
+#define SENSORS_LIDAR_COMMAND_HPP_INCLUDED_
+
+// ISO C++ 11 headers.
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace Sensors {
+namespace LiDAR {
+//! TFmini Plus command identifiers.
+enum CommandId {
+  CMD_FRAME_RATE = 0x03,
+  CMD_OUTPUT_FORMAT = 0x05,
+  CMD_BAUD_RATE = 0x06,
+  CMD_OUTPUT_ENABLE = 0x07,
+  CMD_SAVE_SETTINGS = 0x11
+};
+
+//! TFmini Plus output formats.
+enum OutputFormat { OF_STANDARD_CM = 0x01, OF_STANDARD_MM = 0x06 };
+
+//! Command frame header byte.
+static const uint8_t c_command_header = 0x5a;
+//! Maximum size of a command or response frame.
+static const size_t c_command_max_size = 16;
+
+//! Encode a command frame: 0x5A LEN ID PAYLOAD CHECKSUM.
+//! @param[in] id command identifier.
+//! @param[in] payload command payload.
+//! @param[in] size payload size.
+//! @param[out] frame encoded frame, at least size + 4 bytes.
+//! @return frame size.
+inline size_t
+encodeCommand(uint8_t id, const uint8_t *payload, size_t size, uint8_t *frame) {
+  size_t len = size + 4;
+
+  frame[0] = c_command_header;
+  frame[1] = (uint8_t)len;
+  frame[2] = id;
+  for (size_t i = 0; i < size; ++i)
+    frame[3 + i] = payload[i];
+
+  uint8_t sum = 0;
+  for (size_t i = 0; i < len - 1; ++i)
+    sum += frame[i];
+  frame[len - 1] = sum;
+
+  return len;
+}
+
+//! Finds the response to a command in a byte stream that may also carry
+//! data frames.
+class ResponseScanner {
+public:
+  //! Constructor.
+  //! @param[in] id identifier of the expected response.
+  ResponseScanner(uint8_t id) : m_id(id), m_size(0), m_start(-1) {}
+
+  //! Feed one byte.
+  //! @return true if a valid response was completed by this byte.
+  bool push(uint8_t byte) {
+    if (m_start >= 0 || m_size == c_command_max_size)
+      discard();
+    m_frame[m_size++] = byte;
+
+    // A header byte inside other data may hide the response, so every
+    // frame ending at this byte is checked.
+    for (size_t i = 0; i + 4 <= m_size; ++i) {
+      const uint8_t *frame = &m_frame[i];
+      size_t len = frame[1];
+
+      if (frame[0] != c_command_header || len != m_size - i)
+        continue;
+
+      uint8_t sum = 0;
+      for (size_t j = 0; j < len - 1; ++j)
+        sum += frame[j];
+
+      if (sum == frame[len - 1] && frame[2] == m_id) {
+        m_start = (int)i;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  //! Response payload.
+  const uint8_t *getPayload(void) const { return &m_frame[m_start + 3]; }
+
+  //! Response payload size.
+  size_t getPayloadSize(void) const { return m_frame[m_start + 1] - 4; }
+
+private:
+  //! Expected identifier.
+  uint8_t m_id;
+  //! Last bytes received.
+  uint8_t m_frame[c_command_max_size];
+  //! Number of bytes received.
+  size_t m_size;
+  //! Offset of the response found, negative if none.
+  int m_start;
+
+  //! Drop the oldest byte, or everything after a response was found.
+  void discard(void) {
+    if (m_start >= 0) {
+      m_size = 0;
+      m_start = -1;
+      return;
+    }
+
+    for (size_t i = 1; i < m_size; ++i)
+      m_frame[i - 1] = m_frame[i];
+    --m_size;
+  }
+};
+//! Outcome of a command.
+enum CommandResult {
+  //! Acknowledged by the sensor.
+  CR_ACCEPTED,
+  //! Answered with other settings or a failure status.
+  CR_REJECTED,
+  //! Not answered in time.
+  CR_TIMEOUT
+};
+
+//! Check the response to a command. Configuration commands are echoed
+//! back; saving settings is answered with a status byte.
+//! @param[in] id command identifier.
+//! @param[in] payload command payload.
+//! @param[in] size payload size.
+//! @param[in] response scanner holding the response.
+//! @return true if the command was accepted.
+inline bool
+isAccepted(uint8_t id, const uint8_t *payload, size_t size,
+           const ResponseScanner &response) {
+  if (id == CMD_SAVE_SETTINGS)
+    return response.getPayloadSize() == 1 && response.getPayload()[0] == 0;
+
+  return response.getPayloadSize() == size
+         && (size == 0
+             || std::memcmp(response.getPayload(), payload, size) == 0);
+}
+
+//! Send one command and wait for its response, skipping the data frames
+//! still being received.
+//! @param[in] port serial port, with flushInput(), write(data, size) and
+//! read(data, size, timeout) returning zero on timeout.
+//! @param[in] id command identifier.
+//! @param[in] payload command payload.
+//! @param[in] size payload size.
+//! @param[in] timeout response timeout (s).
+//! @return outcome.
+template <typename Port>
+CommandResult
+sendCommand(Port &port, uint8_t id, const uint8_t *payload, size_t size,
+            double timeout) {
+  typedef std::chrono::steady_clock Clock;
+  uint8_t frame[c_command_max_size];
+  size_t len = encodeCommand(id, payload, size, frame);
+
+  port.flushInput();
+  port.write(frame, len);
+
+  ResponseScanner scanner(id);
+  uint8_t bfr[64];
+  Clock::time_point deadline =
+      Clock::now()
+      + std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(timeout));
+
+  for (Clock::time_point now = Clock::now(); now < deadline;
+       now = Clock::now()) {
+    double left = std::chrono::duration<double>(deadline - now).count();
+    size_t rv = port.read(bfr, sizeof(bfr), left);
+    for (size_t i = 0; i < rv; ++i) {
+      if (scanner.push(bfr[i]))
+        return isAccepted(id, payload, size, scanner) ? CR_ACCEPTED
+                                                      : CR_REJECTED;
+    }
+  }
+
+  return CR_TIMEOUT;
+}
+} // namespace LiDAR
+} // namespace Sensors
+
+#endif
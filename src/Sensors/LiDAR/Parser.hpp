@@ -0,0 +1,164 @@
+
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef SENSORS_LIDAR_PARSER_HPP_INCLUDED_
+#define SENSORS_LIDAR_PARSER_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cstddef>
+#include <stdexcept>
+#include <stdint.h>
+
+namespace Sensors {
+namespace LiDAR {
+//! TFmini Plus measurement.
+struct Frame {
+  //! Distance (cm or mm, depending on the output format).
+  uint16_t distance;
+  //! Signal strength.
+  uint16_t strength;
+  //! Chip temperature (degrees Celsius).
+  float temperature;
+};
+
+//! Streaming parser of TFmini Plus 9-byte data frames:
+//! 0x59 0x59 DIST_L DIST_H STRENGTH_L STRENGTH_H TEMP_L TEMP_H CHECKSUM.
+//! Bytes are pushed in chunks of any size and alignment; frames are
+//! extracted after finding the header and validating the checksum.
+class Parser {
+public:
+  //! Frame header byte.
+  static const uint8_t c_header = 0x59;
+  //! Frame size.
+  static const size_t c_frame_size = 9;
+  //! Ring buffer size (power of two).
+  static const size_t c_buffer_size = 1024;
+
+  Parser(void)
+      : m_head(0), m_tail(0), m_frames(0), m_bad_frames(0),
+        m_skipped_bytes(0), m_bad_bytes(0) {}
+
+  //! Free space in the buffer.
+  size_t free(void) const { return c_buffer_size - (m_head - m_tail); }
+
+  //! Append received bytes.
+  //! @param[in] data bytes.
+  //! @param[in] size number of bytes, at most free().
+  void push(const uint8_t *data, size_t size) {
+    if (size > free())
+      throw std::runtime_error("parser buffer overflow");
+
+    for (size_t i = 0; i < size; ++i)
+      m_buffer[(m_head + i) & (c_buffer_size - 1)] = data[i];
+    m_head += size;
+  }
+
+  //! Extract the next valid frame.
+  //! @param[out] frame decoded frame.
+  //! @return true if a frame was extracted, false if more bytes are needed.
+  bool next(Frame &frame) {
+    while (m_head - m_tail >= c_frame_size) {
+      if (at(0) != c_header || at(1) != c_header) {
+        skip();
+        continue;
+      }
+
+      uint8_t sum = 0;
+      for (size_t i = 0; i < c_frame_size - 1; ++i)
+        sum += at(i);
+
+      // A header inside a corrupted frame; resynchronize on the next byte.
+      // The rest of the frame is accounted for as part of the bad frame.
+      if (sum != at(c_frame_size - 1)) {
+        if (m_bad_bytes == 0)
+          ++m_bad_frames;
+        m_bad_bytes = c_frame_size;
+        skip();
+        continue;
+      }
+
+      frame.distance = word(2);
+      frame.strength = word(4);
+      frame.temperature = word(6) / 8.0f - 256.0f;
+      m_tail += c_frame_size;
+      m_bad_bytes = 0;
+      ++m_frames;
+      return true;
+    }
+
+    return false;
+  }
+
+  //! Number of valid frames extracted.
+  uint64_t getFrames(void) const { return m_frames; }
+
+  //! Number of frames with a wrong checksum.
+  uint64_t getBadFrames(void) const { return m_bad_frames; }
+
+  //! Number of bytes discarded while searching for a frame header, not
+  //! counting the bytes of frames with a wrong checksum.
+  uint64_t getSkippedBytes(void) const { return m_skipped_bytes; }
+
+private:
+  //! Ring buffer.
+  uint8_t m_buffer[c_buffer_size];
+  //! Write position.
+  size_t m_head;
+  //! Read position.
+  size_t m_tail;
+  //! Valid frames.
+  uint64_t m_frames;
+  //! Frames with a wrong checksum.
+  uint64_t m_bad_frames;
+  //! Discarded bytes.
+  uint64_t m_skipped_bytes;
+  //! Bytes left of the last frame with a wrong checksum.
+  size_t m_bad_bytes;
+
+  void skip(void) {
+    if (m_bad_bytes > 0)
+      --m_bad_bytes;
+    else
+      ++m_skipped_bytes;
+    ++m_tail;
+  }
+
+  uint8_t at(size_t offset) const {
+    return m_buffer[(m_tail + offset) & (c_buffer_size - 1)];
+  }
+
+  uint16_t word(size_t offset) const {
+    return at(offset) | (at(offset + 1) << 8);
+  }
+};
+} // namespace LiDAR
+} // namespace Sensors
+
+#endif
@@ -0,0 +1,197 @@
+
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef SENSORS_LIDAR_RANGE_FILTER_HPP_INCLUDED_
+#define SENSORS_LIDAR_RANGE_FILTER_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cmath>
+#include <stdint.h>
+
+namespace Sensors {
+namespace LiDAR {
+//! Maximum time between measurements, either way, before the range filter
+//! starts over.
+static const double c_max_gap = 1.0;
+
+//! Incremental range filter. Measurements with a weak or saturated signal
+//! are dropped, the rest go through a short running median and feed a
+//! constant velocity Kalman filter of range and range rate, gated on the
+//! innovation. Every update costs the same, whatever the sample rate.
+class RangeFilter {
+public:
+  //! Median window size.
+  static const unsigned c_window = 5;
+  //! Consecutive rejections after which the filter starts over.
+  static const unsigned c_max_rejections = 10;
+
+  //! Constructor.
+  //! @param[in] accel_noise acceleration noise spectral density
+  //! ((m/s/s)^2/Hz).
+  //! @param[in] range_noise measurement standard deviation (m).
+  //! @param[in] min_strength minimum signal strength of a reliable
+  //! measurement.
+  RangeFilter(float accel_noise, float range_noise, uint16_t min_strength)
+      : m_q(accel_noise), m_r(range_noise * range_noise),
+        m_min_strength(min_strength) {
+    reset();
+  }
+
+  //! Forget all measurements.
+  void reset(void) {
+    m_count = 0;
+    m_pos = 0;
+    m_init = false;
+    m_rejections = 0;
+    m_tstamp = 0.0;
+    m_range = 0.0f;
+    m_rate = 0.0f;
+    m_p00 = m_r;
+    m_p01 = 0.0f;
+    m_p11 = 1.0f;
+  }
+
+  //! Update with a new measurement. A measurement stamped at or slightly
+  //! before the last one only corrects the estimate.
+  //! @param[in] tstamp measurement time (s).
+  //! @param[in] distance measured distance (m).
+  //! @param[in] strength signal strength.
+  //! @return true if the measurement was used, false if it was rejected.
+  bool update(double tstamp, float distance, uint16_t strength) {
+    if (strength < m_min_strength || strength == 0xffff)
+      return false;
+
+    if (m_init && std::fabs(tstamp - m_tstamp) > c_max_gap)
+      reset();
+
+    m_window[m_pos] = distance;
+    m_pos = (m_pos + 1) % c_window;
+    if (m_count < c_window)
+      ++m_count;
+    float z = median();
+
+    if (!m_init) {
+      m_init = true;
+      m_tstamp = tstamp;
+      m_range = z;
+      return true;
+    }
+
+    // Predict, unless time did not move forward.
+    float dt = 0.0f;
+    if (tstamp > m_tstamp) {
+      dt = (float)(tstamp - m_tstamp);
+      m_tstamp = tstamp;
+    }
+    m_range += m_rate * dt;
+    m_p00 += dt * (2.0f * m_p01 + dt * m_p11) + m_q * dt * dt * dt / 3.0f;
+    m_p01 += dt * m_p11 + m_q * dt * dt / 2.0f;
+    m_p11 += m_q * dt;
+
+    // Gate on the innovation (3 sigma).
+    float y = z - m_range;
+    float s = m_p00 + m_r;
+    if (y * y > 9.0f * s) {
+      if (++m_rejections >= c_max_rejections)
+        reset();
+      return false;
+    }
+    m_rejections = 0;
+
+    // Correct.
+    float k0 = m_p00 / s;
+    float k1 = m_p01 / s;
+    m_range += k0 * y;
+    m_rate += k1 * y;
+    m_p11 -= k1 * m_p01;
+    m_p01 -= k0 * m_p01;
+    m_p00 -= k0 * m_p00;
+    return true;
+  }
+
+  //! Check if there is an estimate.
+  bool isValid(void) const { return m_init; }
+
+  //! Filtered range (m).
+  float getRange(void) const { return m_range; }
+
+  //! Closing speed, positive when approaching (m/s).
+  float getClosingSpeed(void) const { return -m_rate; }
+
+  //! Time to contact at the current closing speed (s), negative if not
+  //! approaching.
+  float getTimeToContact(void) const {
+    if (m_rate >= -1e-3f)
+      return -1.0f;
+    return -m_range / m_rate;
+  }
+
+private:
+  //! Acceleration noise spectral density.
+  float m_q;
+  //! Measurement variance.
+  float m_r;
+  //! Minimum signal strength.
+  uint16_t m_min_strength;
+  //! Last measurements.
+  float m_window[c_window];
+  //! Number of measurements in the window.
+  unsigned m_count;
+  //! Next window position.
+  unsigned m_pos;
+  //! True if the filter has a state.
+  bool m_init;
+  //! Consecutive rejected measurements.
+  unsigned m_rejections;
+  //! Time of the last update.
+  double m_tstamp;
+  //! Range estimate.
+  float m_range;
+  //! Range rate estimate.
+  float m_rate;
+  //! State covariance.
+  float m_p00, m_p01, m_p11;
+
+  //! Median of the measurements in the window.
+  float median(void) const {
+    float v[c_window];
+    for (unsigned i = 0; i < m_count; ++i) {
+      unsigned j = i;
+      for (; j > 0 && v[j - 1] > m_window[i]; --j)
+        v[j] = v[j - 1];
+      v[j] = m_window[i];
+    }
+    return v[m_count / 2];
+  }
+};
+} // namespace LiDAR
+} // namespace Sensors
+
+#endif
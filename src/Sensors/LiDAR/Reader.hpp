@@ -31,28 +31,53 @@
 #ifndef SENSORS_LIDAR_READER_HPP_INCLUDED_
 #define SENSORS_LIDAR_READER_HPP_INCLUDED_
 
+// ISO C++ 11 headers.
+#include <atomic>
+
 // DUNE headers.
 #include <DUNE/DUNE.hpp>
 
+// Local headers.
+#include "../Common/SampleRing.hpp"
+#include "Parser.hpp"
+#include "RangeFilter.hpp"
+
 namespace Sensors {
 namespace LiDAR {
 using DUNE_NAMESPACES;
 
 //! Read buffer size.
-static const size_t c_read_buffer_size = 9;
-//! Line termination character.
-static const char c_line_term = '\n';
+static const size_t c_read_buffer_size = 256;
+//! Minimum signal strength of a reliable measurement.
+static const uint16_t c_min_strength = 100;
+//! Maximum number of frames decoded from one read.
+static const size_t c_max_frames =
+    c_read_buffer_size / Parser::c_frame_size + 1;
 
 class Reader : public Concurrency::Thread {
 public:
   //! Constructor.
   //! @param[in] task parent task.
   //! @param[in] handle I/O handle.
-  Reader(Tasks::Task *task, IO::Handle *handle)
-      : m_task(task), m_handle(handle) {
+  //! @param[in] dispatch_rate distance dispatch rate, zero to dispatch
+  //! every measurement.
+  //! @param[in] unit distance unit of the data frames (m).
+  //! @param[in] frame_rate sensor frame rate.
+  //! @param[in] filter range filter.
+  Reader(Tasks::Task *task, IO::Handle *handle, double dispatch_rate,
+         double unit, double frame_rate, const RangeFilter &filter)
+      : m_task(task), m_handle(handle), m_dispatch_rate(dispatch_rate),
+        m_unit(unit), m_period(1.0 / frame_rate), m_filter(filter),
+        m_dispatch_tstamp(-1.0), m_frames(0), m_dropped(0) {
     m_buffer.resize(c_read_buffer_size);
   }
 
+  //! Number of valid frames received.
+  uint64_t getFrames(void) const { return m_frames; }
+
+  //! Number of frames dropped because of a wrong checksum or header.
+  uint64_t getDropped(void) const { return m_dropped; }
+
 private:
   //! Parent task.
   Tasks::Task *m_task;
@@ -60,8 +85,22 @@ private:
   IO::Handle *m_handle;
   //! Internal read buffer.
   std::vector<uint8_t> m_buffer;
-  //! Current line.
-  std::string m_line;
+  //! Frame parser.
+  Parser m_parser;
+  //! Distance dispatch rate.
+  double m_dispatch_rate;
+  //! Distance unit.
+  double m_unit;
+  //! Sensor frame period.
+  double m_period;
+  //! Range filter.
+  RangeFilter m_filter;
+  //! Timestamp of the last distance dispatched.
+  double m_dispatch_tstamp;
+  //! Number of valid frames.
+  std::atomic<uint64_t> m_frames;
+  //! Number of dropped frames.
+  std::atomic<uint64_t> m_dropped;
 
   void dispatch(IMC::Message &msg) {
     msg.setDestination(m_task->getSystemId());
@@ -76,8 +115,52 @@ private:
     size_t rv = m_handle->read(&m_buffer[0], m_buffer.size());
     if (rv == 0)
       throw std::runtime_error(DTR("invalid read size"));
+    double tstamp = Clock::getSinceEpoch();
+
+    m_parser.push(&m_buffer[0], rv);
+
+    Frame frames[c_max_frames];
+    size_t count = 0;
+    while (count < c_max_frames && m_parser.next(frames[count]))
+      ++count;
+
+    // Frames read together were measured one sensor period apart, the
+    // last one just before the read.
+    for (size_t i = 0; i < count; ++i)
+      onFrame(frames[i], tstamp - (count - 1 - i) * m_period);
+
+    m_frames = m_parser.getFrames();
+    m_dropped = m_parser.getBadFrames()
+                + m_parser.getSkippedBytes() / Parser::c_frame_size;
+  }
+
+  //! Filter and publish one measurement.
+  void onFrame(const Frame &frame, double tstamp) {
+    float distance = frame.distance * m_unit;
+    m_filter.update(tstamp, distance, frame.strength);
+
+    Common::Sample sample;
+    sample.tstamp = tstamp;
+    sample.value[0] = distance;
+    sample.value[1] = frame.strength;
+    sample.value[2] = frame.temperature;
+    sample.value[3] = m_filter.isValid() ? m_filter.getRange() : -1.0f;
+    sample.value[4] = m_filter.getClosingSpeed();
+    sample.value[5] = m_filter.getTimeToContact();
+    Common::SampleRing::get(Common::SS_RANGE).write(sample);
+
+    if (m_dispatch_rate > 0
+        && tstamp - m_dispatch_tstamp < 1.0 / m_dispatch_rate)
+      return;
+
+    m_dispatch_tstamp = tstamp;
     IMC::Distance dist;
-    dist.value = m_buffer[2] + m_buffer[3] * 256;
+    dist.value = sample.value[0];
+    // Weak or saturated signal.
+    if (frame.strength < c_min_strength || frame.strength == 0xffff)
+      dist.validity = IMC::Distance::DV_INVALID;
+    else
+      dist.validity = IMC::Distance::DV_VALID;
     dispatch(dist);
   }
 
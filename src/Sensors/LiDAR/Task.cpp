@@ -27,10 +27,14 @@
 // Author: Jorge Ferreira                                                   *
 //***************************************************************************
 
+// ISO C++ 98 headers.
+#include <cstring>
+
 // DUNE headers.
 #include <DUNE/DUNE.hpp>
 
 // Local header
+#include "Command.hpp"
 #include "Reader.hpp"
 
 namespace Sensors {
@@ -43,8 +47,27 @@ struct Arguments {
   std::string uart_dev;
   //! Serial port baud rate.
   unsigned uart_baud;
+  //! Distance output rate.
+  double dispatch_rate;
+  //! Send configuration commands to the sensor.
+  bool configure;
+  //! Sensor frame rate.
+  unsigned frame_rate;
+  //! Sensor output format.
+  std::string output_format;
+  //! Sensor baud rate.
+  unsigned sensor_baud;
+  //! Save configuration in the sensor.
+  bool save_settings;
+  //! Range filter acceleration noise.
+  float accel_noise;
+  //! Range filter measurement noise.
+  float range_noise;
 };
 
+//! Time to wait for a command response.
+static const double c_command_timeout = 1.0;
+
 struct Task : public DUNE::Tasks::Task {
   //! Serial port handle.
   IO::Handle *m_handle;
@@ -55,11 +78,15 @@ struct Task : public DUNE::Tasks::Task {
   //! Task arguments
   Arguments m_args;
 
-  const int HEADER = 0x59;
-  int check;
+  //! Number of dropped frames already reported.
+  uint64_t m_dropped;
+  //! Baud rate the sensor last answered at, zero if unknown. Kept across
+  //! restarts, since the sensor keeps it until power is cycled.
+  unsigned m_baud;
 
   Task(const std::string &name, Tasks::Context &ctx)
-      : Tasks::Task(name, ctx), m_handle(NULL), m_reader(NULL) {
+      : Tasks::Task(name, ctx), m_handle(NULL), m_reader(NULL), m_dropped(0),
+        m_baud(0) {
     param("Serial Port - Device", m_args.uart_dev)
         .defaultValue("")
         .description("Serial port device used to communicate with the sensor");
@@ -68,11 +95,68 @@ struct Task : public DUNE::Tasks::Task {
         .defaultValue("115200")
         .description("Serial port baud rate");
 
+    param("Dispatch Rate", m_args.dispatch_rate)
+        .defaultValue("10")
+        .minimumValue("0")
+        .units(Units::Hertz)
+        .description("Rate at which distance is dispatched. Every "
+                     "measurement is published to the range sample "
+                     "stream. If zero, every measurement is dispatched");
+
+    param("Sensor Configuration", m_args.configure)
+        .defaultValue("false")
+        .visibility(Tasks::Parameter::VISIBILITY_USER)
+        .description("Configure frame rate, output format and baud rate of "
+                     "the sensor when the task starts");
+
+    param("Sensor Frame Rate", m_args.frame_rate)
+        .defaultValue("100")
+        .minimumValue("1")
+        .maximumValue("1000")
+        .units(Units::Hertz)
+        .visibility(Tasks::Parameter::VISIBILITY_USER)
+        .description("Measurement rate of the sensor. 1000 Hz needs a baud "
+                     "rate of at least 115200");
+
+    param("Sensor Output Format", m_args.output_format)
+        .defaultValue("Centimeters")
+        .values("Centimeters, Millimeters")
+        .description("Distance unit of the sensor data frames");
+
+    param("Sensor Baud Rate", m_args.sensor_baud)
+        .defaultValue("0")
+        .description("Baud rate to switch the sensor to. If zero, the "
+                     "serial port baud rate is kept");
+
+    param("Save Sensor Settings", m_args.save_settings)
+        .defaultValue("false")
+        .description("Store the configuration in the sensor's flash");
+
+    param("Range Filter - Acceleration Noise", m_args.accel_noise)
+        .defaultValue("0.5")
+        .minimumValue("0")
+        .description("Acceleration noise spectral density of the constant "
+                     "velocity range filter, in (m/s/s)^2/Hz");
+
+    param("Range Filter - Measurement Noise", m_args.range_noise)
+        .defaultValue("0.02")
+        .minimumValue("0.001")
+        .units(Units::Meter)
+        .description("Standard deviation of the distance measurements");
+
     bind<IMC::IoEvent>(this);
   }
 
   //! Update internal state with new parameter values.
-  void onUpdateParameters(void) {}
+  void onUpdateParameters(void) {
+    if (m_reader == NULL)
+      return;
+
+    if (paramChanged(m_args.configure) || paramChanged(m_args.frame_rate)
+        || paramChanged(m_args.output_format)
+        || paramChanged(m_args.sensor_baud))
+      throw RestartNeeded(DTR("sensor configuration changed"), 0);
+  }
 
   //! Reserve entity identifiers.
   void onEntityReservation(void) {}
@@ -82,9 +166,117 @@ struct Task : public DUNE::Tasks::Task {
 
   //! Acquire resources.
   void onResourceAcquisition(void) {
-    m_handle = new SerialPort(m_args.uart_dev, m_args.uart_baud);
-    m_reader = new Reader(this, m_handle);
+    if (m_args.configure)
+      configure();
+    else
+      m_handle = new SerialPort(m_args.uart_dev,
+                                m_baud != 0 ? m_baud : m_args.uart_baud);
+
+    double unit = (m_args.output_format == "Millimeters") ? 0.001 : 0.01;
+    RangeFilter filter(m_args.accel_noise, m_args.range_noise,
+                       c_min_strength);
+    m_reader = new Reader(this, m_handle, m_args.dispatch_rate, unit,
+                          m_args.frame_rate, filter);
     m_reader->start();
+    m_dropped = 0;
+  }
+
+  //! Open the serial port at the baud rate the sensor answers at: the
+  //! one last in effect, the configured sensor rate, then the serial port
+  //! rate. Data output is left stopped.
+  void connect(void) {
+    unsigned rates[] = {m_baud, m_args.sensor_baud, m_args.uart_baud};
+    uint8_t disable = 0;
+
+    for (unsigned i = 0; i < 3; ++i) {
+      bool tried = false;
+      for (unsigned j = 0; j < i; ++j)
+        tried = tried || rates[j] == rates[i];
+      if (rates[i] == 0 || tried)
+        continue;
+
+      Memory::clear(m_handle);
+      m_handle = new SerialPort(m_args.uart_dev, rates[i]);
+      Port port = {m_handle};
+      if (sendCommand(port, CMD_OUTPUT_ENABLE, &disable, 1,
+                      c_command_timeout)
+          == CR_ACCEPTED) {
+        m_baud = rates[i];
+        return;
+      }
+    }
+
+    m_baud = 0;
+    throw RestartNeeded(DTR("sensor does not answer"), 5);
+  }
+
+  //! Send the configuration commands. Data output is stopped while the
+  //! sensor is being configured.
+  void configure(void) {
+    uint8_t data[4];
+
+    connect();
+
+    data[0] = m_args.frame_rate & 0xff;
+    data[1] = (m_args.frame_rate >> 8) & 0xff;
+    command(CMD_FRAME_RATE, data, 2);
+
+    if (m_args.output_format == "Millimeters")
+      data[0] = OF_STANDARD_MM;
+    else
+      data[0] = OF_STANDARD_CM;
+    command(CMD_OUTPUT_FORMAT, data, 1);
+
+    unsigned baud = m_args.sensor_baud != 0 ? m_args.sensor_baud
+                                            : m_args.uart_baud;
+    if (baud != m_baud) {
+      for (unsigned i = 0; i < 4; ++i)
+        data[i] = (baud >> (8 * i)) & 0xff;
+      command(CMD_BAUD_RATE, data, 4);
+      m_baud = baud;
+
+      Memory::clear(m_handle);
+      m_handle = new SerialPort(m_args.uart_dev, baud);
+    }
+
+    if (m_args.save_settings)
+      command(CMD_SAVE_SETTINGS, NULL, 0);
+
+    data[0] = 1;
+    command(CMD_OUTPUT_ENABLE, data, 1);
+
+    inf("sensor configured: %u Hz, %s", m_args.frame_rate,
+        m_args.output_format.c_str());
+  }
+
+  //! Serial port of the sensor, as seen by sendCommand().
+  struct Port {
+    IO::Handle *handle;
+
+    void flushInput(void) { handle->flushInput(); }
+
+    void write(const uint8_t *data, size_t size) { handle->write(data, size); }
+
+    size_t read(uint8_t *data, size_t size, double timeout) {
+      if (!Poll::poll(*handle, timeout))
+        return 0;
+      return handle->read(data, size);
+    }
+  };
+
+  //! Send one command and check its response.
+  void command(uint8_t id, const uint8_t *payload, size_t size) {
+    Port port = {m_handle};
+    switch (sendCommand(port, id, payload, size, c_command_timeout)) {
+      case CR_ACCEPTED:
+        return;
+      case CR_REJECTED:
+        throw RestartNeeded(
+            String::str(DTR("command 0x%02x rejected"), id), 5);
+      default:
+        throw RestartNeeded(
+            String::str(DTR("command 0x%02x timed out"), id), 5);
+    }
   }
 
   //! Initialize resources.
@@ -116,6 +308,15 @@ struct Task : public DUNE::Tasks::Task {
   void onMain(void) {
     while (!stopping()) {
       waitForMessages(1.0);
+
+      if (m_reader == NULL)
+        continue;
+
+      uint64_t dropped = m_reader->getDropped();
+      if (dropped > m_dropped) {
+        war("dropped %u invalid frames", (unsigned)(dropped - m_dropped));
+        m_dropped = dropped;
+      }
     }
   }
 };
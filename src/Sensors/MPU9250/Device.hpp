@@ -0,0 +1,237 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef SENSORS_MPU9250_DEVICE_HPP_INCLUDED_
+#define SENSORS_MPU9250_DEVICE_HPP_INCLUDED_
+
+// ISO C++ 11 headers.
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <stdint.h>
+#include <thread>
+
+// Local headers.
+#include "../Common/I2CBus.hpp"
+
+namespace Sensors {
+namespace MPU9250 {
+//! Device registers addresses.
+enum Register {
+  SMPLRT_DIV = 0x19,
+  CONFIG = 0x1A,
+  GYRO_CONFIG = 0x1B,
+  ACCEL_CONFIG = 0x1C,
+  ACCEL_CONFIG2 = 0x1D,
+  FIFO_EN = 0x23,
+  INT_PIN_CFG = 0x37,
+  INT_ENABLE = 0x38,
+  INT_STATUS = 0x3A,
+  ACCEL_XOUT_H = 0x3B,
+  GYRO_XOUT_H = 0x43,
+  USER_CTRL = 0x6A,
+  PWR_MGMT_1 = 0x6B,
+  FIFO_COUNTH = 0x72,
+  FIFO_R_W = 0x74,
+  WHO_AM_I = 0x75
+};
+
+//! Rebuilds the sampling time of FIFO frames from the output data rate,
+//! anchored to the time of the reads.
+class FifoClock {
+public:
+  //! Constructor.
+  //! @param[in] period sampling period (s).
+  explicit FifoClock(double period = 0.0) : m_period(period), m_last(-1.0) {}
+
+  //! Time the frames of a FIFO read. The newest frame was sampled at most
+  //! one period before the read. Follow the output data rate while it
+  //! agrees with the clock, re-anchor otherwise.
+  //! @param[in] frames number of frames read, at least one.
+  //! @param[in] now time of the read (s).
+  //! @return sampling time of the oldest frame (s).
+  double update(size_t frames, double now) {
+    double last = m_last + frames * m_period;
+    if (m_last < 0 || last > now || now - last > m_period)
+      last = now;
+    m_last = last;
+    return last - (frames - 1) * m_period;
+  }
+
+private:
+  //! Sampling period (s).
+  double m_period;
+  //! Sampling time of the newest frame, negative before the first read.
+  double m_last;
+};
+
+//! Accelerometer and gyroscope of an MPU-9250 on a shared I2C bus. Holds
+//! the register level protocol, so that it can be run against a fake bus.
+class Device {
+public:
+  //! Raw accelerometer and gyroscope sample.
+  struct Sample {
+    //! Accelerometer (x, y, z).
+    int16_t accel[3];
+    //! Gyroscope (x, y, z).
+    int16_t gyro[3];
+  };
+
+  //! Device I2C address.
+  static const uint8_t c_address = 0x68;
+  //! WHO_AM_I register value.
+  static const uint8_t c_who_am_i = 0x71;
+  //! Size of the ACCEL_XOUT_H..GYRO_ZOUT_L register block.
+  static const size_t c_sample_size = 14;
+  //! Internal sample rate with the digital low pass filter enabled.
+  static const unsigned c_internal_rate = 1000;
+  //! Size of one FIFO frame (accelerometer and gyroscope, no temperature).
+  static const size_t c_fifo_frame_size = 12;
+  //! Size of the hardware FIFO.
+  static const size_t c_fifo_size = 512;
+  //! Largest number of complete frames in the FIFO.
+  static const size_t c_fifo_frames = c_fifo_size / c_fifo_frame_size;
+
+  //! Constructor.
+  //! @param[in] bus I2C bus.
+  //! @param[in] priority bus priority.
+  //! @param[in] latency expected transaction latency (s).
+  Device(const std::shared_ptr<Common::I2CBus> &bus, unsigned priority,
+         double latency)
+      : m_i2c(bus, c_address, priority, latency) {}
+
+  //! Check the device identity.
+  //! @return true if an MPU-9250 answers.
+  bool probe(void) { return m_i2c.read(WHO_AM_I) == c_who_am_i; }
+
+  //! Wake the device up with 2 G and 250 dps full scale ranges, enable the
+  //! digital low pass filters and set the output data rate.
+  //! @param[in] rate output data rate (Hz).
+  //! @return sampling period of the closest rate available (s).
+  double setup(unsigned rate) {
+    unsigned divider = c_internal_rate / rate;
+    Common::I2CTransaction t;
+
+    m_i2c.write(PWR_MGMT_1, 0x00); // Activate / reset the IMU.
+    t.write(ACCEL_CONFIG, 0x00);  // 2G Full scale.
+    t.write(GYRO_CONFIG, 0x00);   // 250dps Full scale.
+    t.write(CONFIG, 0x01);        // Gyroscope DLPF at 184 Hz, 1 kHz rate.
+    t.write(ACCEL_CONFIG2, 0x01); // Accelerometer DLPF at 184 Hz.
+    t.write(SMPLRT_DIV, (uint8_t)(divider - 1));
+    m_i2c.execute(t);
+    return (double)divider / c_internal_rate;
+  }
+
+  //! Pulse the INT pin when a new sample is ready.
+  void enableDataReady(void) {
+    Common::I2CTransaction t;
+    t.write(INT_PIN_CFG, 0x10); // Active high pulse, clear on read.
+    t.write(INT_ENABLE, 0x01);  // Raw data ready interrupt.
+    m_i2c.execute(t);
+  }
+
+  //! Read accelerometer and gyroscope raw data in one burst, relying on
+  //! the register address auto-increment of the device.
+  //! @param[out] accel accelerometer raw values (x, y, z).
+  //! @param[out] gyro gyroscope raw values (x, y, z).
+  void readSample(int16_t *accel, int16_t *gyro) {
+    uint8_t data[c_sample_size];
+
+    // ACCEL_XOUT_H..ACCEL_ZOUT_L, TEMP_OUT_H..TEMP_OUT_L,
+    // GYRO_XOUT_H..GYRO_ZOUT_L.
+    m_i2c.read(ACCEL_XOUT_H, data, c_sample_size);
+    for (unsigned i = 0; i < 3; i++) {
+      accel[i] = decodeWord(&data[2 * i]);
+      gyro[i] = decodeWord(&data[8 + 2 * i]);
+    }
+  }
+
+  //! Reset and enable the hardware FIFO for accelerometer and gyroscope.
+  void resetFifo(void) {
+    m_i2c.write(FIFO_EN, 0x00);
+    m_i2c.write(USER_CTRL, 0x04); // Reset FIFO.
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    Common::I2CTransaction t;
+    t.write(USER_CTRL, 0x40); // Enable FIFO.
+    t.write(FIFO_EN, 0x78);   // Gyroscope X/Y/Z and accelerometer.
+    m_i2c.execute(t);
+  }
+
+  //! Read all complete frames available in the hardware FIFO. After an
+  //! overflow the FIFO is reset and nothing is read.
+  //! @param[out] samples samples, oldest first, room for c_fifo_frames.
+  //! @return number of samples, negative on overflow.
+  int readFifo(Sample *samples) {
+    uint8_t count[2];
+
+    // The registers are not contiguous and a combined transfer holds a
+    // single read, so this takes two transfers.
+    uint8_t status = m_i2c.read(INT_STATUS);
+    m_i2c.read(FIFO_COUNTH, count, 2);
+
+    if (status & 0x10) {
+      resetFifo();
+      return -1;
+    }
+
+    size_t bytes = ((count[0] & 0x1f) << 8) | count[1];
+    size_t frames = std::min(bytes, (size_t)c_fifo_size) / c_fifo_frame_size;
+    if (frames == 0)
+      return 0;
+
+    m_i2c.read(FIFO_R_W, m_fifo_buffer, frames * c_fifo_frame_size);
+    for (size_t i = 0; i < frames; i++) {
+      const uint8_t *frame = &m_fifo_buffer[i * c_fifo_frame_size];
+      for (unsigned j = 0; j < 3; j++) {
+        samples[i].accel[j] = decodeWord(&frame[2 * j]);
+        samples[i].gyro[j] = decodeWord(&frame[6 + 2 * j]);
+      }
+    }
+    return (int)frames;
+  }
+
+  //! Decode a two bytes value, stored as MSB and LSB, in 2's complement.
+  static int16_t decodeWord(const uint8_t *data) {
+    return (int16_t)(uint16_t)((data[0] << 8) | data[1]);
+  }
+
+  //! @return device on the bus.
+  Common::I2CDevice &getI2C(void) { return m_i2c; }
+
+private:
+  //! Device on the shared I2C bus.
+  Common::I2CDevice m_i2c;
+  //! FIFO read buffer.
+  uint8_t m_fifo_buffer[c_fifo_size];
+};
+} // namespace MPU9250
+} // namespace Sensors
+
+#endif
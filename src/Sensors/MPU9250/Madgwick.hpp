@@ -0,0 +1,365 @@
+
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef SENSORS_MPU9250_MADGWICK_HPP_INCLUDED_
+#define SENSORS_MPU9250_MADGWICK_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cmath>
+#include <cstddef>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MADGWICK_NEON 1
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define MADGWICK_SSE 1
+#endif
+
+namespace Sensors {
+namespace MPU9250 {
+//! Four single precision lanes, one per quaternion component.
+struct Float4 {
+#if defined(MADGWICK_NEON)
+  float32x4_t v;
+
+  Float4(float32x4_t x) : v(x) {}
+  Float4(float a, float b, float c, float d) {
+    const float t[4] = {a, b, c, d};
+    v = vld1q_f32(t);
+  }
+  static Float4 load(const float *p) { return vld1q_f32(p); }
+  void store(float *p) const { vst1q_f32(p, v); }
+  Float4 operator+(const Float4 &o) const { return vaddq_f32(v, o.v); }
+  Float4 operator-(const Float4 &o) const { return vsubq_f32(v, o.v); }
+  Float4 operator*(const Float4 &o) const { return vmulq_f32(v, o.v); }
+  Float4 operator*(float s) const { return vmulq_n_f32(v, s); }
+  //! Lanes (1, 0, 3, 2).
+  Float4 swapPairs(void) const { return vrev64q_f32(v); }
+  //! Lanes (2, 3, 0, 1).
+  Float4 swapHalves(void) const { return vextq_f32(v, v, 2); }
+  //! Lanes (3, 2, 1, 0).
+  Float4 reverse(void) const { return vrev64q_f32(vextq_f32(v, v, 2)); }
+  float sum(void) const {
+    float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(s, s), 0);
+  }
+#elif defined(MADGWICK_SSE)
+  __m128 v;
+
+  Float4(__m128 x) : v(x) {}
+  Float4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) {}
+  static Float4 load(const float *p) { return _mm_loadu_ps(p); }
+  void store(float *p) const { _mm_storeu_ps(p, v); }
+  Float4 operator+(const Float4 &o) const { return _mm_add_ps(v, o.v); }
+  Float4 operator-(const Float4 &o) const { return _mm_sub_ps(v, o.v); }
+  Float4 operator*(const Float4 &o) const { return _mm_mul_ps(v, o.v); }
+  Float4 operator*(float s) const { return _mm_mul_ps(v, _mm_set1_ps(s)); }
+  //! Lanes (1, 0, 3, 2).
+  Float4 swapPairs(void) const {
+    return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+  }
+  //! Lanes (2, 3, 0, 1).
+  Float4 swapHalves(void) const {
+    return _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2));
+  }
+  //! Lanes (3, 2, 1, 0).
+  Float4 reverse(void) const {
+    return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 1, 2, 3));
+  }
+  float sum(void) const {
+    __m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(s);
+  }
+#else
+  float v[4];
+
+  Float4(float a, float b, float c, float d) {
+    v[0] = a;
+    v[1] = b;
+    v[2] = c;
+    v[3] = d;
+  }
+  static Float4 load(const float *p) { return Float4(p[0], p[1], p[2], p[3]); }
+  void store(float *p) const {
+    for (unsigned i = 0; i < 4; i++)
+      p[i] = v[i];
+  }
+  Float4 operator+(const Float4 &o) const {
+    return Float4(v[0] + o.v[0], v[1] + o.v[1], v[2] + o.v[2], v[3] + o.v[3]);
+  }
+  Float4 operator-(const Float4 &o) const {
+    return Float4(v[0] - o.v[0], v[1] - o.v[1], v[2] - o.v[2], v[3] - o.v[3]);
+  }
+  Float4 operator*(const Float4 &o) const {
+    return Float4(v[0] * o.v[0], v[1] * o.v[1], v[2] * o.v[2], v[3] * o.v[3]);
+  }
+  Float4 operator*(float s) const {
+    return Float4(v[0] * s, v[1] * s, v[2] * s, v[3] * s);
+  }
+  //! Lanes (1, 0, 3, 2).
+  Float4 swapPairs(void) const { return Float4(v[1], v[0], v[3], v[2]); }
+  //! Lanes (2, 3, 0, 1).
+  Float4 swapHalves(void) const { return Float4(v[2], v[3], v[0], v[1]); }
+  //! Lanes (3, 2, 1, 0).
+  Float4 reverse(void) const { return Float4(v[3], v[2], v[1], v[0]); }
+  float sum(void) const { return (v[0] + v[1]) + (v[2] + v[3]); }
+#endif
+};
+
+//! Accelerometer and gyroscope samples in structure-of-arrays layout,
+//! already in the filter's frame of reference.
+struct ImuSamples {
+  //! Angular velocity (rad/s).
+  const float *gx;
+  const float *gy;
+  const float *gz;
+  //! Acceleration (any unit).
+  const float *ax;
+  const float *ay;
+  const float *az;
+  //! Time elapsed since the previous sample (s).
+  const float *dt;
+  //! Number of samples.
+  size_t size;
+};
+
+//! Madgwick gradient descent orientation filter, single precision only.
+//! update() uses the vectorized kernel when NEON or SSE is available and
+//! the scalar kernel otherwise; updateScalar() is always the scalar one.
+class Madgwick {
+public:
+  //! Constructor.
+  //! @param[in] beta filter gain.
+  Madgwick(float beta = 0.1f) : m_beta(beta) { reset(); }
+
+  //! Reset the orientation to identity.
+  void reset(void) {
+    m_q[0] = 1.0f;
+    m_q[1] = 0.0f;
+    m_q[2] = 0.0f;
+    m_q[3] = 0.0f;
+  }
+
+  //! Set the filter gain.
+  void setBeta(float beta) { m_beta = beta; }
+
+  //! Get the orientation quaternion (w, x, y, z).
+  const float *getQuaternion(void) const { return m_q; }
+
+  //! Update the filter with one sample.
+  void update(float gx, float gy, float gz, float ax, float ay, float az,
+              float mx, float my, float mz, float dt) {
+#if defined(MADGWICK_NEON) || defined(MADGWICK_SSE)
+    updateVector(gx, gy, gz, ax, ay, az, mx, my, mz, dt);
+#else
+    updateScalar(gx, gy, gz, ax, ay, az, mx, my, mz, dt);
+#endif
+  }
+
+  //! Update the filter with a batch of samples sharing one magnetometer
+  //! measurement.
+  void update(const ImuSamples &s, float mx, float my, float mz) {
+    for (size_t i = 0; i < s.size; ++i)
+      update(s.gx[i], s.gy[i], s.gz[i], s.ax[i], s.ay[i], s.az[i], mx, my, mz,
+             s.dt[i]);
+  }
+
+  //! Update the filter with one sample using the scalar kernel.
+  void updateScalar(float gx, float gy, float gz, float ax, float ay,
+                    float az, float mx, float my, float mz, float dt) {
+    float q0 = m_q[0], q1 = m_q[1], q2 = m_q[2], q3 = m_q[3];
+    float recipNorm;
+    float s0, s1, s2, s3;
+    float qDot1, qDot2, qDot3, qDot4;
+
+    // Rate of change of quaternion from gyroscope
+    qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+    qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+    qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+    qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+    // Compute feedback only if accelerometer measurement valid (avoids NaN in
+    // accelerometer normalisation)
+    if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
+      float f[6], b[4];
+      residuals(ax, ay, az, mx, my, mz, f, b);
+      float _4bx = b[0], _4bz = b[1], _8bx = b[2], _8bz = b[3];
+
+      // Gradient decent algorithm corrective step
+      s0 = -2.0f * q2 * f[0] + 2.0f * q1 * f[1] - _4bz * q2 * f[3] +
+           (-_4bx * q3 + _4bz * q1) * f[4] + _4bx * q2 * f[5];
+      s1 = 2.0f * q3 * f[0] + 2.0f * q0 * f[1] - 4.0f * q1 * f[2] +
+           _4bz * q3 * f[3] + (_4bx * q2 + _4bz * q0) * f[4] +
+           (_4bx * q3 - _8bz * q1) * f[5];
+      s2 = -2.0f * q0 * f[0] + 2.0f * q3 * f[1] - 4.0f * q2 * f[2] +
+           (-_8bx * q2 - _4bz * q0) * f[3] + (_4bx * q1 + _4bz * q3) * f[4] +
+           (_4bx * q0 - _8bz * q2) * f[5];
+      s3 = 2.0f * q1 * f[0] + 2.0f * q2 * f[1] +
+           (-_8bx * q3 + _4bz * q1) * f[3] + (-_4bx * q0 + _4bz * q2) * f[4] +
+           _4bx * q1 * f[5];
+      // normalise step magnitude
+      recipNorm = invSqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);
+      s0 *= recipNorm;
+      s1 *= recipNorm;
+      s2 *= recipNorm;
+      s3 *= recipNorm;
+
+      // Apply feedback step
+      qDot1 -= m_beta * s0;
+      qDot2 -= m_beta * s1;
+      qDot3 -= m_beta * s2;
+      qDot4 -= m_beta * s3;
+    }
+
+    // Integrate rate of change of quaternion to yield quaternion
+    q0 += qDot1 * dt;
+    q1 += qDot2 * dt;
+    q2 += qDot3 * dt;
+    q3 += qDot4 * dt;
+
+    // Normalise quaternion
+    recipNorm = invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    m_q[0] = q0 * recipNorm;
+    m_q[1] = q1 * recipNorm;
+    m_q[2] = q2 * recipNorm;
+    m_q[3] = q3 * recipNorm;
+  }
+
+  //! Update the filter with one sample using the four lane kernel.
+  //! Every quaternion-sized term is a lane permutation of q, so the
+  //! gradient collapses to six scaled vector accumulations.
+  void updateVector(float gx, float gy, float gz, float ax, float ay,
+                    float az, float mx, float my, float mz, float dt) {
+    const Float4 q = Float4::load(m_q);
+    const Float4 qp = q.swapPairs();
+    const Float4 qh = q.swapHalves();
+    const Float4 qr = q.reverse();
+
+    // Rate of change of quaternion from gyroscope
+    Float4 qDot = (qp * Float4(-0.5f, 0.5f, 0.5f, -0.5f) * gx)
+                  + (qh * Float4(-0.5f, -0.5f, 0.5f, 0.5f) * gy)
+                  + (qr * Float4(-0.5f, 0.5f, -0.5f, 0.5f) * gz);
+
+    if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
+      float f[6], b[4];
+      residuals(ax, ay, az, mx, my, mz, f, b);
+      float _4bx = b[0], _4bz = b[1], _8bx = b[2], _8bz = b[3];
+
+      Float4 s = (qh * Float4(-1.0f, 1.0f, -1.0f, 1.0f))
+                     * (2.0f * f[0] + _4bz * f[3])
+                 + qp * (2.0f * f[1] + _4bz * f[4])
+                 + (qr * Float4(-1.0f, 1.0f, 1.0f, -1.0f)) * (_4bx * f[4])
+                 + qh * (_4bx * f[5])
+                 - (q * Float4(0.0f, 1.0f, 1.0f, 0.0f))
+                       * (4.0f * f[2] + _8bz * f[5])
+                 - (q * Float4(0.0f, 0.0f, 1.0f, 1.0f)) * (_8bx * f[3]);
+      qDot = qDot - s * (m_beta * invSqrt((s * s).sum()));
+    }
+
+    Float4 r = q + qDot * dt;
+    (r * invSqrt((r * r).sum())).store(m_q);
+  }
+
+private:
+  //! Filter gain.
+  float m_beta;
+  //! Orientation quaternion (w, x, y, z).
+  float m_q[4];
+
+  static float invSqrt(float x) { return 1.0f / std::sqrt(x); }
+
+  //! Compute the objective function of the gradient step.
+  //! @param[out] f accelerometer (0-2) and magnetometer (3-5) residuals.
+  //! @param[out] b Earth's magnetic field reference terms (4bx, 4bz, 8bx,
+  //! 8bz).
+  void residuals(float ax, float ay, float az, float mx, float my, float mz,
+                 float *f, float *b) const {
+    float q0 = m_q[0], q1 = m_q[1], q2 = m_q[2], q3 = m_q[3];
+    float recipNorm;
+
+    // Normalise accelerometer measurement
+    recipNorm = invSqrt(ax * ax + ay * ay + az * az);
+    ax *= recipNorm;
+    ay *= recipNorm;
+    az *= recipNorm;
+
+    // Normalise magnetometer measurement
+    recipNorm = invSqrt(mx * mx + my * my + mz * mz);
+    mx *= recipNorm;
+    my *= recipNorm;
+    mz *= recipNorm;
+
+    // Auxiliary variables to avoid repeated arithmetic
+    float _2q0mx = 2.0f * q0 * mx;
+    float _2q0my = 2.0f * q0 * my;
+    float _2q0mz = 2.0f * q0 * mz;
+    float _2q1mx = 2.0f * q1 * mx;
+    float _2q1 = 2.0f * q1;
+    float _2q2 = 2.0f * q2;
+    float q0q0 = q0 * q0;
+    float q0q1 = q0 * q1;
+    float q0q2 = q0 * q2;
+    float q0q3 = q0 * q3;
+    float q1q1 = q1 * q1;
+    float q1q2 = q1 * q2;
+    float q1q3 = q1 * q3;
+    float q2q2 = q2 * q2;
+    float q2q3 = q2 * q3;
+    float q3q3 = q3 * q3;
+
+    // Reference direction of Earth's magnetic field
+    float hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 +
+               _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+    float hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 -
+               my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
+    float _2bx = std::sqrt(hx * hx + hy * hy);
+    float _2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 -
+                 mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
+    float _4bx = 2.0f * _2bx;
+    float _4bz = 2.0f * _2bz;
+
+    f[0] = 2.0f * (q1q3 - q0q2) - ax;
+    f[1] = 2.0f * (q0q1 + q2q3) - ay;
+    f[2] = 2.0f * (0.5f - q1q1 - q2q2) - az;
+    f[3] = _4bx * (0.5f - q2q2 - q3q3) + _4bz * (q1q3 - q0q2) - mx;
+    f[4] = _4bx * (q1q2 - q0q3) + _4bz * (q0q1 + q2q3) - my;
+    f[5] = _4bx * (q0q2 + q1q3) + _4bz * (0.5f - q1q1 - q2q2) - mz;
+    b[0] = _4bx;
+    b[1] = _4bz;
+    b[2] = 2.0f * _4bx;
+    b[3] = 2.0f * _4bz;
+  }
+};
+} // namespace MPU9250
+} // namespace Sensors
+
+#endif
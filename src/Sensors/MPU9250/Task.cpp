@@ -30,8 +30,13 @@
 // DUNE headers.
 #include <DUNE/DUNE.hpp>
 
-#define CALIBRATE_ACCEL 0
-#define CALIBRATE_GYRO 0
+// Local headers.
+#include "../Common/Calibrator.hpp"
+#include "../Common/DataReady.hpp"
+#include "../Common/I2CBus.hpp"
+#include "../Common/SampleRing.hpp"
+#include "Device.hpp"
+#include "Madgwick.hpp"
 
 #define G_FORCE 9.800054
 
@@ -43,12 +48,30 @@ using DUNE_NAMESPACES;
 struct Arguments {
   //! I2C device.
   std::string i2c_dev;
+  //! I2C bus priority.
+  unsigned bus_priority;
+  //! I2C bus usage report period.
+  double stats_period;
   //! Gyroscope offset bias correction value.
   std::vector<int16_t> gyroscope_offset;
   //! Accelerometer offset bias correction value.
   std::vector<float> accel_offset;
   //! Accelerometer scale correction value.
   std::vector<float> accel_scale;
+  //! Acquisition mode.
+  std::string acq_mode;
+  //! Output data rate.
+  unsigned sample_rate;
+  //! Period between hardware FIFO reads.
+  double fifo_period;
+  //! Data ready GPIO.
+  int drdy_gpio;
+  //! Euler angles output rate.
+  double euler_rate;
+  //! Angular velocity and acceleration output rate.
+  double dispatch_rate;
+  //! Online calibration enabled.
+  bool online_cal;
 };
 
 struct Task : public DUNE::Tasks::Task {
@@ -60,41 +83,98 @@ struct Task : public DUNE::Tasks::Task {
   IMC::MagneticField m_magn;
   //! Euler angles.
   IMC::EulerAngles m_euler;
-  //! I2C handle.
-  I2C *m_i2c;
-  //! Device I2C address.
-  const uint8_t dev_addr = 0x68;
-  //! Device registers addresses.
-  const uint8_t WHO_AM_I = 0x75;
-  const uint8_t PWR_MGMT_1 = 0x6B;
-  const uint8_t ACCEL_CONFIG = 0x1C;
-  const uint8_t GYRO_CONFIG = 0x1B;
-  const uint8_t ACCEL_XOUT_H = 0x3B;
-  const uint8_t ACCEL_YOUT_H = 0x3D;
-  const uint8_t ACCEL_ZOUT_H = 0x3F;
-  const uint8_t GYRO_XOUT_H = 0x43;
-  const uint8_t GYRO_YOUT_H = 0x45;
-  const uint8_t GYRO_ZOUT_H = 0x47;
+  //! Accelerometer and gyroscope.
+  Device *m_device;
+  //! FIFO mode enabled.
+  bool m_fifo;
+  //! Sampling period of the configured output data rate.
+  double m_period;
+  //! Sampling time of the frames read from the FIFO.
+  FifoClock m_fifo_clock;
+  //! Data ready waiter.
+  Common::DataReady *m_drdy;
 
   float declination = 97;
-  float beta = 0.1f;
-  float q0 = 1.0f;
-  float q1 = 0.0f;
-  float q2 = 0.0f;
-  float q3 = 0.0f;
-
-  double lastUpdate = Time::Clock::getSinceEpoch();
+  //! Orientation filter.
+  Madgwick m_filter;
+  //! Filter input samples (gx, gy, gz, ax, ay, az, dt), one column per
+  //! FIFO frame.
+  float m_batch[7][Device::c_fifo_frames];
+  //! Number of samples waiting for the filter.
+  size_t m_batch_size;
+
+  //! Timestamp of the last sample fed to the filter.
+  double m_fusion_tstamp;
+  //! Timestamp of the last Euler angles dispatched.
+  double m_euler_tstamp;
+  //! True if a magnetic field measurement was received.
+  bool m_magn_valid;
+  //! Position in the magnetic field stream.
+  Common::SampleRing::Cursor m_magn_cursor;
+  //! Timestamp of the last angular velocity and acceleration dispatched.
+  double m_dispatch_tstamp;
+  //! Time of the last bus usage report.
+  double m_stats_tstamp;
+  //! Duration of a stillness detection window.
+  static constexpr double c_still_window = 1.0;
+  //! Largest accelerometer standard deviation when still (raw units).
+  static constexpr double c_still_accel = 160;
+  //! Largest gyroscope standard deviation when still (raw units).
+  static constexpr double c_still_gyro = 40;
+  //! Weight of a still window in the gyroscope bias estimate.
+  static constexpr double c_gyro_bias_gain = 0.2;
+  //! Smallest distance between accelerometer fit points (raw units).
+  static constexpr double c_accel_spread = 3200;
+  //! Accelerometer fit memory, in points.
+  static constexpr double c_accel_memory = 50;
+  //! Accelerometer raw value of one gravity.
+  static constexpr double c_accel_1g = 16384;
+  //! Accelerometer and gyroscope sums over the current window.
+  double m_still_sum[6];
+  //! Accelerometer and gyroscope sums of squares over the current window.
+  double m_still_sq[6];
+  //! Samples in the current window.
+  unsigned m_still_count;
+  //! Gyroscope bias in use (raw units).
+  double m_gyro_bias[3];
+  //! Accelerometer correction in use.
+  Common::EllipsoidCorrection m_accel_cal;
+  //! Accelerometer calibration fit, one point per still attitude.
+  Common::EllipsoidFit m_accel_fit;
+  //! Last point added to the fit.
+  double m_accel_last[3];
+  //! Fit changed since it was last submitted.
+  bool m_accel_pending;
+  //! Online calibration solver.
+  Common::Calibrator *m_calibrator;
 
   //! Task arguments.
   Arguments m_args;
 
   Task(const std::string &name, Tasks::Context &ctx)
-      : DUNE::Tasks::Task(name, ctx) {
+      : DUNE::Tasks::Task(name, ctx), m_device(NULL), m_fifo(false),
+        m_period(0.0), m_drdy(NULL),
+        m_filter(0.1f), m_batch_size(0), m_fusion_tstamp(-1.0),
+        m_euler_tstamp(-1.0), m_magn_valid(false), m_dispatch_tstamp(-1.0),
+        m_stats_tstamp(0.0), m_still_count(0),
+        m_accel_fit(c_accel_1g, c_accel_memory), m_accel_pending(false),
+        m_calibrator(NULL) {
     // Define configuration parameters.
     param("I2C - Device", m_args.i2c_dev)
         .defaultValue("")
         .description("I2C Device");
 
+    param("I2C - Bus Priority", m_args.bus_priority)
+        .defaultValue("1")
+        .description("Priority of the IMU on the shared I2C bus. Higher "
+                     "priority devices are served first");
+
+    param("I2C - Statistics Period", m_args.stats_period)
+        .defaultValue("10")
+        .minimumValue("1")
+        .units(Units::Second)
+        .description("Period of the I2C bus usage report");
+
     param("Gyroscope Offset", m_args.gyroscope_offset)
         .defaultValue("-768, 0, 196")
         .size(3)
@@ -110,374 +190,345 @@ struct Task : public DUNE::Tasks::Task {
         .size(3)
         .description("Accelerometer scale correction values");
 
-    bind<IMC::MagneticField>(this);
+    param("Acquisition Mode", m_args.acq_mode)
+        .defaultValue("Polling")
+        .values("Polling, FIFO")
+        .description("Read data registers directly or stream samples "
+                     "through the hardware FIFO");
+
+    param("Sample Rate", m_args.sample_rate)
+        .defaultValue("1000")
+        .minimumValue("4")
+        .maximumValue("1000")
+        .units(Units::Hertz)
+        .description("Accelerometer and gyroscope output data rate");
+
+    param("FIFO Read Period", m_args.fifo_period)
+        .defaultValue("0.02")
+        .minimumValue("0.001")
+        .maximumValue("0.04")
+        .units(Units::Second)
+        .description("Period between hardware FIFO reads. Must be short "
+                     "enough for the FIFO not to overflow at the "
+                     "configured sample rate");
+
+    param("Data Ready GPIO", m_args.drdy_gpio)
+        .defaultValue("-1")
+        .description("GPIO wired to the INT pin, used to wait for new "
+                     "samples in polling mode. If negative, samples are "
+                     "read at the configured sample rate");
+
+    param("Euler Angles Rate", m_args.euler_rate)
+        .defaultValue("10")
+        .minimumValue("0.1")
+        .units(Units::Hertz)
+        .description("Rate at which fused Euler angles are dispatched");
+
+    param("Dispatch Rate", m_args.dispatch_rate)
+        .defaultValue("50")
+        .minimumValue("0")
+        .units(Units::Hertz)
+        .description("Rate at which angular velocity and acceleration are "
+                     "dispatched. Every sample is published to the IMU "
+                     "sample stream. If zero, every sample is dispatched");
+
+    param("Online Calibration", m_args.online_cal)
+        .defaultValue("false")
+        .description("Estimate the gyroscope offset whenever the vehicle "
+                     "is still, and fit the accelerometer offset and "
+                     "scale to gravity measured at different still "
+                     "attitudes, in the background. The configured values "
+                     "are used until then");
   }
 
-  //! Consume magnetic field message.
-  void consume(const IMC::MagneticField *msg) {
-    for (int i = 0; i < 10; i++)
-      MadgwickUpdate(m_ang_vel.x, -m_ang_vel.y, -m_ang_vel.z, -m_accel.x,
-                     m_accel.y, m_accel.z, msg->x, -msg->y, -msg->z);
-    computeEulerAngles();
+  //! Update internal state with new parameter values.
+  void onUpdateParameters(void) {
+    // The device is configured when resources are acquired.
+    if (m_device != NULL
+        && (paramChanged(m_args.i2c_dev) || paramChanged(m_args.bus_priority)
+            || paramChanged(m_args.acq_mode)
+            || paramChanged(m_args.sample_rate)
+            || paramChanged(m_args.fifo_period)
+            || paramChanged(m_args.drdy_gpio)
+            || paramChanged(m_args.online_cal)))
+      throw RestartNeeded(DTR("IMU configuration changed"), 0);
+
+    m_fifo = (m_args.acq_mode == "FIFO");
+    m_period = 1.0 / m_args.sample_rate;
+
+    // Take effect on the next sample, replacing any online calibration.
+    if (paramChanged(m_args.gyroscope_offset)) {
+      for (unsigned i = 0; i < 3; ++i)
+        m_gyro_bias[i] = m_args.gyroscope_offset[i];
+    }
+    if (paramChanged(m_args.accel_offset) || paramChanged(m_args.accel_scale))
+      m_accel_cal.setDiagonal(m_args.accel_offset, m_args.accel_scale);
   }
 
   //! Acquire resources.
   void onResourceAcquisition(void) {
-    uint8_t whoAmI_result = 0;
-    // Establish an I2C connection to the device.
-    m_i2c = new I2C(m_args.i2c_dev);
-    m_i2c->connect(dev_addr);
+    // Attach to the shared I2C bus. Transactions should complete within
+    // one sample, or one FIFO read in FIFO mode.
+    m_device = new Device(Common::I2CBus::open(m_args.i2c_dev),
+                          m_args.bus_priority,
+                          m_fifo ? m_args.fifo_period : m_period);
     // Check to see if there is a good connection with the MPU9250.
-    whoAmI_result = readByte(&WHO_AM_I);
-
-    inf("debug who_am_i = %d\n", whoAmI_result);
-
-    if (whoAmI_result == 0x71) {
-      writeByte(PWR_MGMT_1, 0x00);   // Activate / reset the IMU.
-      writeByte(ACCEL_CONFIG, 0x00); // 2G Full scale.
-      writeByte(GYRO_CONFIG, 0x00);  // 250dps Full scale.
+    if (m_device->probe()) {
+      m_period = m_device->setup(m_args.sample_rate);
+      if (m_fifo)
+        setupFifo();
+      else
+        setupDataReady();
+      m_magn_cursor =
+          Common::SampleRing::get(Common::SS_MAGNETIC_FIELD).cursor();
+      if (m_args.online_cal)
+        setupCalibration();
     } else
       throw std::runtime_error("IMU WHO_AM_I is wrong.");
   }
 
+  //! Release resources.
+  void onResourceRelease(void) {
+    if (m_calibrator != NULL) {
+      m_calibrator->stopAndJoin();
+      Memory::clear(m_calibrator);
+    }
+    Memory::clear(m_drdy);
+    Memory::clear(m_device);
+  }
+
   //! Initialize resources.
   void onResourceInitialization(void) {
     setEntityState(IMC::EntityState::ESTA_NORMAL, Status::CODE_ACTIVE);
-    if (CALIBRATE_ACCEL)
-      calibrateAccel(200);
-    if (CALIBRATE_GYRO)
-      calibrateGyro(200);
-  }
-
-  //! Send data using the I2C protocol.
-  void writeByte(uint8_t registerAddress, uint8_t value) {
-    uint8_t data[2];
-
-    data[0] = registerAddress;
-    data[1] = value;
-    m_i2c->write(data, 2);
   }
 
-  //! Read data using the I2C protocol.
-  uint8_t readByte(const uint8_t *registerAddress) {
-    uint8_t value = 0;
-    m_i2c->write(registerAddress, 1);
-    m_i2c->read(&value, 1);
-    return value;
+  //! Pace polling with the INT pin, or with a timer if it is not wired.
+  void setupDataReady(void) {
+    if (m_args.drdy_gpio >= 0)
+      m_device->enableDataReady();
+    m_drdy = new Common::DataReady(m_args.drdy_gpio, m_period);
   }
 
-  //! Read a two bytes value, stored as LSB and MSB, in 2's complement.
-  int16_t readWord(const uint8_t *register_addr_high) {
-    uint8_t highByte = readByte(register_addr_high);
-    uint8_t lowByte = readByte(register_addr_high + 1);
-    uint16_t word = (highByte << 8) + lowByte;
-
-    if (word >= 32768)
-      return (word - 65536);
-
-    return word;
+  //! Reset and enable the hardware FIFO for accelerometer and gyroscope.
+  void setupFifo(void) {
+    m_device->resetFifo();
+    m_fifo_clock = FifoClock(m_period);
   }
 
-  //! Print only the data from one specific axis.
-  int16_t readOneAccelAxis(uint8_t numberOfReadings, char axis) {
-    int32_t calibrationValue = 0;
-    int16_t *p;
-    uint8_t offs = 0;
-
-    switch (axis) {
-    case 'x':
-      offs = 0;
-      break;
-    case 'y':
-      offs = 1;
-      break;
-    case 'z':
-      offs = 2;
-      break;
-    default:
-      offs = 0;
+  //! Read all complete frames available in the hardware FIFO and dispatch
+  //! them with timestamps rebuilt from the output data rate.
+  void readFifo(void) {
+    Device::Sample samples[Device::c_fifo_frames];
+    double now = Clock::getSinceEpoch();
+
+    int frames = m_device->readFifo(samples);
+    if (frames < 0) {
+      war("FIFO overflow, samples were lost");
+      m_fifo_clock = FifoClock(m_period);
+      return;
     }
-    for (int i = 0; i < numberOfReadings; i++) {
-      p = readRawAccel();
-      inf("Eixo: %c\tValor: %d", axis, *(p + offs));
-      calibrationValue += *(p + offs);
-      Time::Delay::waitMsec(5);
-    }
-    return calibrationValue / numberOfReadings;
-  }
+    if (frames == 0)
+      return;
 
-  //! Calibrate the accelerometer.
-  void calibrateAccel(uint8_t numberOfReadings) {
-    int16_t zMax;
-    int16_t zMin;
-    int16_t yMax;
-    int16_t yMin;
-    int16_t xMax;
-    int16_t xMin;
-
-    inf("Calibrating accelerometer with %d points.", numberOfReadings);
-    inf("Place it on the position Z+");
-    Time::Delay::wait(10);
-    zMax = readOneAccelAxis(numberOfReadings, 'z');
-    inf("Place it on the position Z-");
-    Time::Delay::wait(10);
-    zMin = readOneAccelAxis(numberOfReadings, 'z');
-    inf("Place it on the position Y+");
-    Time::Delay::wait(10);
-    yMax = readOneAccelAxis(numberOfReadings, 'y');
-    inf("Place it on the position Y-");
-    Time::Delay::wait(10);
-    yMin = readOneAccelAxis(numberOfReadings, 'y');
-    inf("Place it on the position X+");
-    Time::Delay::wait(10);
-    xMax = readOneAccelAxis(numberOfReadings, 'x');
-    inf("Place it on the position X-");
-    Time::Delay::wait(10);
-    xMin = readOneAccelAxis(numberOfReadings, 'x');
-    // Calculate offset bias and scale correction.
-    m_args.accel_offset[0] = (float)(xMin + xMax) / 2;
-    m_args.accel_offset[1] = (float)(yMin + yMax) / 2;
-    m_args.accel_offset[2] = (float)(zMin + zMax) / 2;
-    m_args.accel_scale[0] = (float)16384 / ((abs(xMin) + abs(xMax)) / 2);
-    m_args.accel_scale[1] = (float)16384 / ((abs(yMin) + abs(yMax)) / 2);
-    m_args.accel_scale[2] = (float)16384 / ((abs(zMin) + abs(zMax)) / 2);
-
-    inf("Calibration completed!");
-    inf("X axis offset: %f\tY axis offset: %f\tZ axis offset: %f",
-        m_args.accel_offset[0], m_args.accel_offset[1], m_args.accel_offset[2]);
-    inf("X axis scale: %f\tY axis scale: %f\tZ axis scale: %f",
-        m_args.accel_scale[0], m_args.accel_scale[1], m_args.accel_scale[2]);
-    Time::Delay::wait(300); // Give some time to take note of this values
+    double tstamp = m_fifo_clock.update(frames, now);
+    for (int i = 0; i < frames; i++)
+      dispatchSample(samples[i].accel, samples[i].gyro, tstamp + i * m_period);
+    runFusion();
   }
 
-  //! Calibrate the gyroscope
-  void calibrateGyro(uint8_t numberOfReadings) {
-    int16_t *p;
-    float gyroOffset[3] = {0, 0, 0};
-
-    inf("Calibrating gyro with %d points. Please do not move the vehicle.",
-        numberOfReadings);
-    for (uint8_t i = 0; i < numberOfReadings; i++) {
-      p = readRawGyro();
-      gyroOffset[0] += (*p);
-      gyroOffset[1] += *(p + 1);
-      gyroOffset[2] += *(p + 2);
-    }
-    gyroOffset[0] /= numberOfReadings;
-    gyroOffset[1] /= numberOfReadings;
-    gyroOffset[2] /= numberOfReadings;
-
-    inf("Calibration completed!");
-    inf("X axis offset: %f\tY axis offset: %f\tZ axis offset: %f",
-        gyroOffset[0], gyroOffset[1], gyroOffset[2]);
-    for (uint8_t i = 0; i < 3; i++)
-      m_args.gyroscope_offset[i] = gyroOffset[i];
-    Time::Delay::wait(30); // Give some time to take note of this values
+  //! Start the online calibration.
+  void setupCalibration(void) {
+    std::memset(m_still_sum, 0, sizeof(m_still_sum));
+    std::memset(m_still_sq, 0, sizeof(m_still_sq));
+    m_still_count = 0;
+    m_accel_fit.clear();
+    std::memset(m_accel_last, 0, sizeof(m_accel_last));
+    m_accel_pending = false;
+    // Solve from 12 attitudes on, accept scale errors up to 10% and a 2%
+    // residual.
+    m_calibrator = new Common::Calibrator(m_accel_fit, c_accel_1g, 12, 1.1,
+                                          0.02);
+    m_calibrator->start();
   }
 
-  //! Read raw data from the accelerometer.
-  int16_t *readRawAccel() {
-    static int16_t accelRaw[3];
-
-    accelRaw[0] = readWord(&ACCEL_XOUT_H);
-    accelRaw[1] = readWord(&ACCEL_YOUT_H);
-    accelRaw[2] = readWord(&ACCEL_ZOUT_H);
+  //! Look for still windows in the raw samples. Update the gyroscope bias
+  //! from each one and feed the accelerometer fit with gravity measured at
+  //! new attitudes, then switch to its newest correction.
+  //! @param[in] accel accelerometer raw values (x, y, z).
+  //! @param[in] gyro gyroscope raw values (x, y, z).
+  void updateCalibration(const int16_t *accel, const int16_t *gyro) {
+    for (unsigned i = 0; i < 3; ++i) {
+      m_still_sum[i] += accel[i];
+      m_still_sq[i] += (double)accel[i] * accel[i];
+      m_still_sum[3 + i] += gyro[i];
+      m_still_sq[3 + i] += (double)gyro[i] * gyro[i];
+    }
 
-    return accelRaw;
-  }
+    if (++m_still_count * m_period >= c_still_window) {
+      double mean[6];
+      bool still = true;
+      for (unsigned i = 0; i < 6; ++i) {
+        double limit = (i < 3) ? c_still_accel : c_still_gyro;
+        mean[i] = m_still_sum[i] / m_still_count;
+        still = still && (m_still_sq[i] / m_still_count - mean[i] * mean[i]
+                          < limit * limit);
+      }
+      std::memset(m_still_sum, 0, sizeof(m_still_sum));
+      std::memset(m_still_sq, 0, sizeof(m_still_sq));
+      m_still_count = 0;
+
+      if (still) {
+        for (unsigned i = 0; i < 3; ++i)
+          m_gyro_bias[i] += c_gyro_bias_gain * (mean[3 + i] - m_gyro_bias[i]);
+
+        double dx = mean[0] - m_accel_last[0];
+        double dy = mean[1] - m_accel_last[1];
+        double dz = mean[2] - m_accel_last[2];
+        if (dx * dx + dy * dy + dz * dz > c_accel_spread * c_accel_spread) {
+          m_accel_fit.add(mean);
+          std::memcpy(m_accel_last, mean, sizeof(m_accel_last));
+          m_accel_pending = true;
+        }
+      }
+    }
 
-  //! Read raw data from the gyroscope.
-  int16_t *readRawGyro() {
-    static int16_t gyroRaw[3];
+    if (m_accel_pending && m_calibrator->submit(m_accel_fit))
+      m_accel_pending = false;
 
-    gyroRaw[0] = readWord(&GYRO_XOUT_H);
-    gyroRaw[1] = readWord(&GYRO_YOUT_H);
-    gyroRaw[2] = readWord(&GYRO_ZOUT_H);
+    Common::EllipsoidCorrection c;
+    if (!m_calibrator->fetch(c))
+      return;
 
-    return gyroRaw;
+    m_accel_cal = c;
+    debug("accelerometer calibration: offset %.0f, %.0f, %.0f, axis ratio "
+          "%.3f, residual %.1f%%",
+          c.offset[0], c.offset[1], c.offset[2], c.ratio, c.residual * 100);
   }
 
-  //! Read raw data from the accelerometer and do some corrections
-  void readAccel() {
-    int16_t *p;
-    double imc_tstamp = Clock::getSinceEpoch();
+  //! Correct raw accelerometer data and store it.
+  void convertAccel(const int16_t *p) {
+    double raw[3] = {(double)p[0], (double)p[1], (double)p[2]};
+    double a[3];
 
-    p = readRawAccel();
     // Convert to g force.
-    m_accel.x =
-        (((*p) - m_args.accel_offset[0]) * m_args.accel_scale[0]) / 16384;
-    m_accel.y =
-        ((*(p + 1) - m_args.accel_offset[1]) * m_args.accel_scale[1]) / 16384;
-    m_accel.z =
-        ((*(p + 2) - m_args.accel_offset[2]) * m_args.accel_scale[2]) / 16384;
+    m_accel_cal.apply(raw, a);
+    m_accel.x = a[0] / c_accel_1g;
+    m_accel.y = a[1] / c_accel_1g;
+    m_accel.z = a[2] / c_accel_1g;
     // Convert to m/s/s
     m_accel.x *= G_FORCE;
     m_accel.y *= G_FORCE;
     m_accel.z *= G_FORCE;
-    m_accel.setTimeStamp(imc_tstamp);
-    // inf("%f\t%f\t%f", m_accel.x, m_accel.y, m_accel.z);
-    dispatch(m_accel, DF_KEEP_TIME);
   }
 
-  //! Read raw data from the gyroscope and do some corrections
-  void readGyro() {
-    int16_t *p;
-    double imc_tstamp = Clock::getSinceEpoch();
-
-    p = readRawGyro();
-    m_ang_vel.x = ((*p) - m_args.gyroscope_offset[0]) / 131.072;
-    m_ang_vel.y = (*(p + 1) - m_args.gyroscope_offset[1]) / 131.072;
-    m_ang_vel.z = (*(p + 2) - m_args.gyroscope_offset[2]) / 131.072;
+  //! Correct raw gyroscope data and store it.
+  void convertGyro(const int16_t *p) {
+    m_ang_vel.x = ((*p) - m_gyro_bias[0]) / 131.072;
+    m_ang_vel.y = (*(p + 1) - m_gyro_bias[1]) / 131.072;
+    m_ang_vel.z = (*(p + 2) - m_gyro_bias[2]) / 131.072;
 
     // Convert to rad/s
     m_ang_vel.x = Angles::radians(m_ang_vel.x);
     m_ang_vel.y = Angles::radians(m_ang_vel.y);
     m_ang_vel.z = Angles::radians(m_ang_vel.z);
-    m_ang_vel.setTimeStamp(imc_tstamp);
-    dispatch(m_ang_vel, DF_KEEP_TIME);
-    // inf("%f\t%f\t%f", m_ang_vel.x, m_ang_vel.y, m_ang_vel.z);
   }
 
-  //! Apply the madwick filter (sensor fusion data)
-  void MadgwickUpdate(float gx, float gy, float gz, float ax, float ay,
-                      float az, float mx, float my, float mz) {
-    float recipNorm;
-    float s0, s1, s2, s3;
-    float qDot1, qDot2, qDot3, qDot4;
-    float hx, hy;
-    float _2q0mx, _2q0my, _2q0mz, _2q1mx, _2bx, _2bz, _4bx, _4bz, _8bx, _8bz,
-        _2q0, _2q1, _2q2, _2q3, q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2,
-        q2q3, q3q3;
-
-    double now = Time::Clock::getSinceEpoch();
-    double deltaT = now - lastUpdate;
-    lastUpdate = now;
-
-    // Rate of change of quaternion from gyroscope
-    qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
-    qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
-    qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
-    qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
-
-    // Compute feedback only if accelerometer measurement valid (avoids NaN in
-    // accelerometer normalisation)
-    if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
-
-      // Normalise accelerometer measurement
-      recipNorm = invSqrt(ax * ax + ay * ay + az * az);
-      ax *= recipNorm;
-      ay *= recipNorm;
-      az *= recipNorm;
-
-      // Normalise magnetometer measurement
-      recipNorm = invSqrt(mx * mx + my * my + mz * mz);
-      mx *= recipNorm;
-      my *= recipNorm;
-      mz *= recipNorm;
-
-      // Auxiliary variables to avoid repeated arithmetic
-      _2q0mx = 2.0f * q0 * mx;
-      _2q0my = 2.0f * q0 * my;
-      _2q0mz = 2.0f * q0 * mz;
-      _2q1mx = 2.0f * q1 * mx;
-      _2q0 = 2.0f * q0;
-      _2q1 = 2.0f * q1;
-      _2q2 = 2.0f * q2;
-      _2q3 = 2.0f * q3;
-      q0q0 = q0 * q0;
-      q0q1 = q0 * q1;
-      q0q2 = q0 * q2;
-      q0q3 = q0 * q3;
-      q1q1 = q1 * q1;
-      q1q2 = q1 * q2;
-      q1q3 = q1 * q3;
-      q2q2 = q2 * q2;
-      q2q3 = q2 * q3;
-      q3q3 = q3 * q3;
-
-      // Reference direction of Earth's magnetic field
-      hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 +
-           _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
-      hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 +
-           my * q2q2 + _2q2 * mz * q3 - my * q3q3;
-      _2bx = sqrt(hx * hx + hy * hy);
-      _2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 +
-             _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
-      _4bx = 2.0f * _2bx;
-      _4bz = 2.0f * _2bz;
-      _8bx = 2.0f * _4bx;
-      _8bz = 2.0f * _4bz;
-
-      // Gradient decent algorithm corrective step
-      s0 = -_2q2 * (2.0f * (q1q3 - q0q2) - ax) +
-           _2q1 * (2.0f * (q0q1 + q2q3) - ay) +
-           -_4bz * q2 *
-               (_4bx * (0.5 - q2q2 - q3q3) + _4bz * (q1q3 - q0q2) - mx) +
-           (-_4bx * q3 + _4bz * q1) *
-               (_4bx * (q1q2 - q0q3) + _4bz * (q0q1 + q2q3) - my) +
-           _4bx * q2 * (_4bx * (q0q2 + q1q3) + _4bz * (0.5 - q1q1 - q2q2) - mz);
-      s1 =
-          _2q3 * (2.0f * (q1q3 - q0q2) - ax) +
-          _2q0 * (2.0f * (q0q1 + q2q3) - ay) +
-          -4.0f * q1 * (2.0f * (0.5 - q1q1 - q2q2) - az) +
-          _4bz * q3 * (_4bx * (0.5 - q2q2 - q3q3) + _4bz * (q1q3 - q0q2) - mx) +
-          (_4bx * q2 + _4bz * q0) *
-              (_4bx * (q1q2 - q0q3) + _4bz * (q0q1 + q2q3) - my) +
-          (_4bx * q3 - _8bz * q1) *
-              (_4bx * (q0q2 + q1q3) + _4bz * (0.5 - q1q1 - q2q2) - mz);
-      s2 = -_2q0 * (2.0f * (q1q3 - q0q2) - ax) +
-           _2q3 * (2.0f * (q0q1 + q2q3) - ay) +
-           (-4.0f * q2) * (2.0f * (0.5 - q1q1 - q2q2) - az) +
-           (-_8bx * q2 - _4bz * q0) *
-               (_4bx * (0.5 - q2q2 - q3q3) + _4bz * (q1q3 - q0q2) - mx) +
-           (_4bx * q1 + _4bz * q3) *
-               (_4bx * (q1q2 - q0q3) + _4bz * (q0q1 + q2q3) - my) +
-           (_4bx * q0 - _8bz * q2) *
-               (_4bx * (q0q2 + q1q3) + _4bz * (0.5 - q1q1 - q2q2) - mz);
-      s3 = _2q1 * (2.0f * (q1q3 - q0q2) - ax) +
-           _2q2 * (2.0f * (q0q1 + q2q3) - ay) +
-           (-_8bx * q3 + _4bz * q1) *
-               (_4bx * (0.5 - q2q2 - q3q3) + _4bz * (q1q3 - q0q2) - mx) +
-           (-_4bx * q0 + _4bz * q2) *
-               (_4bx * (q1q2 - q0q3) + _4bz * (q0q1 + q2q3) - my) +
-           (_4bx * q1) *
-               (_4bx * (q0q2 + q1q3) + _4bz * (0.5 - q1q1 - q2q2) - mz);
-      recipNorm = invSqrt(s0 * s0 + s1 * s1 + s2 * s2 +
-                          s3 * s3); // normalise step magnitude
-      s0 *= recipNorm;
-      s1 *= recipNorm;
-      s2 *= recipNorm;
-      s3 *= recipNorm;
-
-      // Apply feedback step
-      qDot1 -= beta * s0;
-      qDot2 -= beta * s1;
-      qDot3 -= beta * s2;
-      qDot4 -= beta * s3;
+  //! Read accelerometer and gyroscope data and dispatch both with the same
+  //! timestamp.
+  void readSample() {
+    int16_t accel[3];
+    int16_t gyro[3];
+    double imc_tstamp = Clock::getSinceEpoch();
+
+    m_device->readSample(accel, gyro);
+    dispatchSample(accel, gyro, imc_tstamp);
+    runFusion();
+  }
+
+  //! Correct one accelerometer and gyroscope sample and dispatch it.
+  void dispatchSample(const int16_t *accel, const int16_t *gyro,
+                      double imc_tstamp) {
+    if (m_calibrator != NULL)
+      updateCalibration(accel, gyro);
+    convertAccel(accel);
+    convertGyro(gyro);
+
+    Common::Sample sample;
+    sample.tstamp = imc_tstamp;
+    sample.value[0] = m_accel.x;
+    sample.value[1] = m_accel.y;
+    sample.value[2] = m_accel.z;
+    sample.value[3] = m_ang_vel.x;
+    sample.value[4] = m_ang_vel.y;
+    sample.value[5] = m_ang_vel.z;
+    Common::SampleRing::get(Common::SS_IMU).write(sample);
+
+    if (m_args.dispatch_rate <= 0
+        || imc_tstamp - m_dispatch_tstamp >= 1.0 / m_args.dispatch_rate) {
+      m_dispatch_tstamp = imc_tstamp;
+      m_accel.setTimeStamp(imc_tstamp);
+      m_ang_vel.setTimeStamp(imc_tstamp);
+      dispatch(m_ang_vel, DF_KEEP_TIME);
+      dispatch(m_accel, DF_KEEP_TIME);
     }
+    // inf("%f\t%f\t%f", m_accel.x, m_accel.y, m_accel.z);
+    // inf("%f\t%f\t%f", m_ang_vel.x, m_ang_vel.y, m_ang_vel.z);
+
+    queueFusion(imc_tstamp);
+  }
 
-    // Integrate rate of change of quaternion to yield quaternion
-    q0 += qDot1 * deltaT;
-    q1 += qDot2 * deltaT;
-    q2 += qDot3 * deltaT;
-    q3 += qDot4 * deltaT;
-
-    // Normalise quaternion
-    recipNorm = invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
-    q0 *= recipNorm;
-    q1 *= recipNorm;
-    q2 *= recipNorm;
-    q3 *= recipNorm;
+  //! Queue the last accelerometer and gyroscope sample for the filter.
+  void queueFusion(double tstamp) {
+    float deltaT = tstamp - m_fusion_tstamp;
+    m_fusion_tstamp = tstamp;
+    // Do not integrate across gaps in the sample stream.
+    if (deltaT <= 0 || deltaT > 10 * m_period)
+      deltaT = 0;
+
+    size_t i = m_batch_size++;
+    m_batch[0][i] = m_ang_vel.x;
+    m_batch[1][i] = -m_ang_vel.y;
+    m_batch[2][i] = -m_ang_vel.z;
+    m_batch[3][i] = -m_accel.x;
+    m_batch[4][i] = m_accel.y;
+    m_batch[5][i] = m_accel.z;
+    m_batch[6][i] = deltaT;
   }
 
-  float invSqrt(float x) {
-    float tmp = 1 / (sqrt(x));
-    return tmp;
+  //! Fold in the newest magnetic field sample, run the filter over the
+  //! queued samples and dispatch Euler angles at the configured rate.
+  void runFusion(void) {
+    Common::Sample magn;
+    if (Common::SampleRing::get(Common::SS_MAGNETIC_FIELD)
+            .readLatest(m_magn_cursor, magn)) {
+      m_magn.x = magn.value[0];
+      m_magn.y = magn.value[1];
+      m_magn.z = magn.value[2];
+      m_magn_valid = true;
+    }
+
+    // Fusion starts with the first magnetic field measurement.
+    if (!m_magn_valid)
+      m_batch_size = 0;
+    if (m_batch_size == 0)
+      return;
+
+    ImuSamples samples = {m_batch[0], m_batch[1], m_batch[2], m_batch[3],
+                          m_batch[4], m_batch[5], m_batch[6], m_batch_size};
+    m_filter.update(samples, m_magn.x, -m_magn.y, -m_magn.z);
+    m_batch_size = 0;
+
+    if (m_fusion_tstamp - m_euler_tstamp >= 1.0 / m_args.euler_rate) {
+      m_euler_tstamp = m_fusion_tstamp;
+      computeEulerAngles(m_fusion_tstamp);
+    }
   }
 
   //! Get Euler Angles and dispatch them.
-  void computeEulerAngles() {
-    double imc_tstamp = Clock::getSinceEpoch();
+  void computeEulerAngles(double imc_tstamp) {
+    const float *q = m_filter.getQuaternion();
+    float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+
     m_euler.phi = Angles::normalizeRadian(
         atan2f(q0 * q1 + q2 * q3, 0.5f - q1 * q1 - q2 * q2));
     m_euler.theta = Angles::normalizeRadian(asinf(-2.0f * (q1 * q3 - q0 * q2)));
@@ -491,12 +542,35 @@ struct Task : public DUNE::Tasks::Task {
     // Angles::degrees(m_euler.theta), Angles::degrees(m_euler.psi_magnetic));
   }
 
+  //! Report the usage of the shared I2C bus.
+  void reportBusStats(void) {
+    Common::I2CDevice::Stats s = m_device->getI2C().takeStats();
+    debug("I2C: %.1f%% of the bus (%.1f%% total), %llu transactions, "
+          "%.3f ms wait, %.3f ms max",
+          s.utilization * 100, s.bus_utilization * 100,
+          (unsigned long long)s.transactions, s.wait * 1000,
+          s.max_wait * 1000);
+  }
+
   //! Main loop.
   void onMain(void) {
+    m_stats_tstamp = Clock::get();
+
     while (!stopping()) {
-      consumeMessages();
-      readGyro();
-      readAccel();
+      if (Clock::get() - m_stats_tstamp >= m_args.stats_period) {
+        m_stats_tstamp = Clock::get();
+        reportBusStats();
+      }
+
+      if (m_fifo) {
+        waitForMessages(m_args.fifo_period);
+        readFifo();
+      } else {
+        if (!m_drdy->wait())
+          debug("data ready timeout");
+        consumeMessages();
+        readSample();
+      }
     }
   }
 };
@@ -30,11 +30,23 @@
 // DUNE headers.
 #include <DUNE/DUNE.hpp>
 
+// Local headers.
+#include "../Common/Calibrator.hpp"
+#include "../Common/DataReady.hpp"
+#include "../Common/I2CBus.hpp"
+#include "../Common/SampleRing.hpp"
+
 //! Flags for status register #1.
 #define STAT_DRDY 0b00000001 // Data Ready.
 #define STAT_OVL 0b00000010  // Overflow flag.
 #define STAT_DOR 0b00000100  // Data skipped for reading.
 
+//! Fields of control register #1.
+#define CTRL_MODE_CONT 0b00000001 // Continuous measurement mode.
+#define CTRL_ODR_SHIFT 2          // Output data rate.
+#define CTRL_RNG_SHIFT 4          // Full scale range.
+#define CTRL_OSR_SHIFT 6          // Over sample ratio.
+
 namespace Sensors {
 namespace QMC5883L {
 using DUNE_NAMESPACES;
@@ -43,15 +55,33 @@ using DUNE_NAMESPACES;
 struct Arguments {
   //! I2C device.
   std::string i2c_dev;
+  //! I2C bus priority.
+  unsigned bus_priority;
+  //! I2C bus usage report period.
+  double stats_period;
   //! Offset bias correction value.
   std::vector<int16_t> offset_bias;
   //! Scale correction factors.
   std::vector<float> scale_correction;
+  //! Data ready GPIO.
+  int drdy_gpio;
+  //! Magnetic field output rate.
+  double dispatch_rate;
+  //! Output data rate.
+  unsigned odr;
+  //! Full scale range.
+  unsigned range;
+  //! Over sample ratio.
+  unsigned osr;
+  //! Online calibration enabled.
+  bool online_cal;
+  //! Online calibration memory.
+  double cal_memory;
 };
 
 struct Task : public DUNE::Tasks::Task {
-  //! I2C handle.
-  I2C *m_i2c;
+  //! Device on the shared I2C bus.
+  Common::I2CDevice *m_i2c;
   //! Device I2C address.
   static const uint8_t dev_addr = 0x0d;
   //! Data registers of the magnetic sensor
@@ -63,18 +93,64 @@ struct Task : public DUNE::Tasks::Task {
   const uint8_t zRegisterMSB = 0x05;
   const uint8_t tRegisterLSB = 0x07;
   const uint8_t statusRegister = 0x06;
+  //! Status and data registers, read in one burst.
+  static const size_t c_sample_size = 7;
+  //! Control register #1.
+  static const uint8_t c_control_register = 0x09;
+  //! Number of samples within the lower range before switching back.
+  static const unsigned c_range_hold = 50;
+  //! Full scale range in use.
+  unsigned m_range;
+  //! Consecutive samples that fit the configured range.
+  unsigned m_range_fit;
+  //! Discard the next sample, taken while switching range.
+  bool m_range_discard;
+  //! Typical magnetic field (2 G range counts).
+  static constexpr double c_cal_scale = 6000;
+  //! Largest accepted ratio between the calibration ellipsoid axes.
+  static constexpr double c_cal_max_ratio = 1.5;
+  //! Largest accepted calibration residual.
+  static constexpr double c_cal_max_residual = 0.05;
+  //! Magnetic field correction in use.
+  Common::EllipsoidCorrection m_cal;
+  //! Online calibration fit.
+  Common::EllipsoidFit m_cal_fit;
+  //! Samples added to the fit since it was last submitted.
+  unsigned m_cal_samples;
+  //! Online calibration solver.
+  Common::Calibrator *m_calibrator;
   //! Magnetic field.
   IMC::MagneticField m_magn;
+  //! Data ready waiter.
+  Common::DataReady *m_drdy;
+  //! Timestamp of the last magnetic field dispatched.
+  double m_dispatch_tstamp;
+  //! Time of the last bus usage report.
+  double m_stats_tstamp;
   //! Task arguments.
   Arguments m_args;
 
   Task(const std::string &name, Tasks::Context &ctx)
-      : DUNE::Tasks::Task(name, ctx) {
+      : DUNE::Tasks::Task(name, ctx), m_i2c(NULL), m_range(0),
+        m_range_fit(0), m_range_discard(false), m_cal_fit(c_cal_scale, 0),
+        m_cal_samples(0), m_calibrator(NULL), m_drdy(NULL),
+        m_dispatch_tstamp(-1.0), m_stats_tstamp(0.0) {
     // Define configuration parameters.
     param("I2C - Device", m_args.i2c_dev)
         .defaultValue("")
         .description("I2C Device");
 
+    param("I2C - Bus Priority", m_args.bus_priority)
+        .defaultValue("0")
+        .description("Priority of the magnetometer on the shared I2C bus. "
+                     "Higher priority devices are served first");
+
+    param("I2C - Statistics Period", m_args.stats_period)
+        .defaultValue("10")
+        .minimumValue("1")
+        .units(Units::Second)
+        .description("Period of the I2C bus usage report");
+
     param("Magnetometer Offset Bias", m_args.offset_bias)
         .defaultValue("")
         .size(3)
@@ -84,123 +160,312 @@ struct Task : public DUNE::Tasks::Task {
         .defaultValue("")
         .size(3)
         .description("Scale correction value");
+
+    param("Data Ready GPIO", m_args.drdy_gpio)
+        .defaultValue("-1")
+        .description("GPIO wired to the DRDY pin, used to wait for new "
+                     "samples. If negative, samples are read at the output "
+                     "data rate");
+
+    param("Dispatch Rate", m_args.dispatch_rate)
+        .defaultValue("10")
+        .minimumValue("0")
+        .units(Units::Hertz)
+        .description("Rate at which the magnetic field is dispatched. Every "
+                     "sample is published to the magnetic field sample "
+                     "stream. If zero, every sample is dispatched");
+
+    param("Output Data Rate", m_args.odr)
+        .defaultValue("10")
+        .values("10, 50, 100, 200")
+        .units(Units::Hertz)
+        .description("Sensor output data rate. Match it to the rate at "
+                     "which the heading filter consumes samples, higher "
+                     "rates only cost bus bandwidth and CPU");
+
+    param("Field Range", m_args.range)
+        .defaultValue("2")
+        .values("2, 8")
+        .description("Full scale range in gauss. When the field exceeds "
+                     "it, the sensor switches to the 8 gauss range and "
+                     "back once the field fits again");
+
+    param("Over Sample Ratio", m_args.osr)
+        .defaultValue("512")
+        .values("64, 128, 256, 512")
+        .description("Internal digital filter over sample ratio. Higher "
+                     "ratios lower the noise and raise the power "
+                     "consumption");
+
+    param("Online Calibration", m_args.online_cal)
+        .defaultValue("false")
+        .description("Fit the hard and soft iron correction in the "
+                     "background while the vehicle operates. The "
+                     "configured offset bias and scale correction are "
+                     "used until the vehicle has turned through enough "
+                     "attitudes for the fit to be accepted");
+
+    param("Calibration Memory", m_args.cal_memory)
+        .defaultValue("600")
+        .minimumValue("10")
+        .units(Units::Second)
+        .description("Time after which samples weigh 1/e in the online "
+                     "calibration");
+  }
+
+  //! Update internal state with new parameter values.
+  void onUpdateParameters(void) {
+    if (m_args.dispatch_rate > m_args.odr)
+      war("dispatch rate is above the output data rate");
+
+    // Takes effect on the next sample, replacing any online calibration.
+    if (paramChanged(m_args.offset_bias)
+        || paramChanged(m_args.scale_correction))
+      m_cal.setDiagonal(m_args.offset_bias, m_args.scale_correction);
+
+    if (m_i2c == NULL)
+      return;
+
+    if (paramChanged(m_args.odr) || paramChanged(m_args.range)
+        || paramChanged(m_args.osr) || paramChanged(m_args.online_cal)
+        || paramChanged(m_args.cal_memory))
+      throw RestartNeeded(DTR("magnetometer configuration changed"), 0);
   }
 
   //! Acquire resources.
   void onResourceAcquisition(void) {
-    m_i2c = new I2C(m_args.i2c_dev);
-    m_i2c->connect(dev_addr);
+    // Attach to the shared I2C bus. Transactions should complete within
+    // one sample.
+    m_i2c = new Common::I2CDevice(Common::I2CBus::open(m_args.i2c_dev),
+                                  dev_addr, m_args.bus_priority,
+                                  1.0 / m_args.odr);
 
     // Read chip id.
-    uint8_t chipID = 0;
-    uint8_t reg = 0x0d;
-    m_i2c->write(&reg, 1);
-    m_i2c->read(&chipID, 1);
+    uint8_t chipID = m_i2c->read(0x0d);
     if (chipID != 0xFF)
       throw std::runtime_error("Chip ID is wrong.");
 
-    // Set the device in continuous read mode.
-    reg = 0x0a;
-    uint8_t data2[2];
-    data2[0] = reg;
-    data2[1] = 0b10000000;
-    m_i2c->write(data2, 2);
+    // Soft reset.
+    m_i2c->write(0x0a, 0b10000000);
 
-    data2[1] = 0b00000001;
-    m_i2c->write(data2, 2);
+    // Let the register pointer roll over from the status register to the
+    // data registers. Enable the DRDY pin only if it is wired. Set the
+    // device in continuous read mode.
+    m_range = m_args.range;
+    m_range_fit = 0;
+    m_range_discard = false;
+    Common::I2CTransaction t;
+    t.write(0x0a, (m_args.drdy_gpio >= 0) ? 0b01000000 : 0b01000001);
+    t.write(0x0b, 0x01);
+    t.write(c_control_register, controlRegister(m_range));
+    m_i2c->execute(t);
 
-    data2[0] = 0x0b;
-    data2[1] = 0x01;
-    m_i2c->write(data2, 2);
+    m_drdy = new Common::DataReady(m_args.drdy_gpio, 1.0 / m_args.odr);
 
-    data2[0] = 0x09;
-    data2[1] = 0b00000001;
-    m_i2c->write(data2, 2);
+    if (m_args.online_cal) {
+      double memory = m_args.cal_memory * m_args.odr;
+      m_cal_fit = Common::EllipsoidFit(c_cal_scale, memory);
+      m_cal_samples = 0;
+      m_calibrator =
+          new Common::Calibrator(m_cal_fit, 0.0, memory / 2, c_cal_max_ratio,
+                                 c_cal_max_residual);
+      m_calibrator->start();
+    }
     setEntityState(IMC::EntityState::ESTA_NORMAL, Status::CODE_ACTIVE);
   }
 
-  //! Read one byte
-  uint8_t readByte(const uint8_t *register_addr) {
-    uint8_t value;
-    m_i2c->write(register_addr, 1);
-    m_i2c->read(&value, 1);
+  //! Release resources.
+  void onResourceRelease(void) {
+    if (m_calibrator != NULL) {
+      m_calibrator->stopAndJoin();
+      Memory::clear(m_calibrator);
+    }
+    Memory::clear(m_drdy);
+    Memory::clear(m_i2c);
+  }
+
+  //! Build control register #1 for continuous measurement.
+  //! @param[in] range full scale range (G).
+  //! @return register value.
+  uint8_t controlRegister(unsigned range) const {
+    uint8_t odr = 0;
+    if (m_args.odr >= 200)
+      odr = 3;
+    else if (m_args.odr >= 100)
+      odr = 2;
+    else if (m_args.odr >= 50)
+      odr = 1;
+
+    uint8_t osr = 0;
+    if (m_args.osr <= 64)
+      osr = 3;
+    else if (m_args.osr <= 128)
+      osr = 2;
+    else if (m_args.osr <= 256)
+      osr = 1;
+
+    uint8_t rng = (range >= 8) ? 1 : 0;
 
-    return value;
+    return (uint8_t)((osr << CTRL_OSR_SHIFT) | (rng << CTRL_RNG_SHIFT)
+                     | (odr << CTRL_ODR_SHIFT) | CTRL_MODE_CONT);
   }
 
-  //! Read a two bytes value, stored as LSB and MSB, in 2's complement.
-  int16_t readWord(const uint8_t *register_addr) {
-    uint8_t lowByte = readByte(register_addr);
-    uint8_t highByte = readByte(register_addr + 1);
-    uint16_t word = (highByte << 8) + lowByte;
+  //! Switch the full scale range. The sample being converted is
+  //! discarded.
+  //! @param[in] range full scale range (G).
+  void setRange(unsigned range) {
+    m_i2c->write(c_control_register, controlRegister(range));
+    m_range = range;
+    m_range_fit = 0;
+    m_range_discard = true;
+  }
+
+  //! Switch to the 8 G range when the field overflows the configured range
+  //! and back when it has fit the configured range for a while.
+  //! @param[in] status status register.
+  //! @param[in] data raw magnetic field (x, y, z).
+  //! @return true if the sample is valid, false otherwise.
+  bool updateRange(uint8_t status, const int16_t *data) {
+    if (status & STAT_OVL) {
+      if (m_range < 8) {
+        war("magnetic field over %u G, switching to 8 G range", m_range);
+        setRange(8);
+      } else {
+        debug("magnetic field over 8 G");
+      }
+      return false;
+    }
+
+    if (m_range_discard) {
+      m_range_discard = false;
+      return false;
+    }
+
+    if (m_range == m_args.range)
+      return true;
 
-    if (word >= 32768)
-      return (word - 65536);
+    // Leave half of the configured range as margin before switching back:
+    // the field must stay within 8192 counts at the configured range.
+    int32_t limit = (int32_t)(8192 * m_args.range / m_range);
+    bool fits = true;
+    for (unsigned i = 0; i < 3; ++i)
+      fits = fits && std::abs((int32_t)data[i]) < limit;
 
-    return word;
+    m_range_fit = fits ? m_range_fit + 1 : 0;
+    if (m_range_fit >= c_range_hold) {
+      inf("magnetic field within %u G, switching back", m_args.range);
+      setRange(m_args.range);
+    }
+    return true;
+  }
+
+  //! Feed the online calibration and switch to its newest correction.
+  //! Submits the fit about once per second.
+  //! @param[in] v magnetic field (2 G range counts).
+  void updateCalibration(const double *v) {
+    m_cal_fit.add(v);
+    if (++m_cal_samples >= m_args.odr && m_calibrator->submit(m_cal_fit))
+      m_cal_samples = 0;
+
+    Common::EllipsoidCorrection c;
+    if (!m_calibrator->fetch(c))
+      return;
+
+    m_cal = c;
+    debug("calibration: offset %.0f, %.0f, %.0f, axis ratio %.3f, "
+          "residual %.1f%%",
+          c.offset[0], c.offset[1], c.offset[2], c.ratio, c.residual * 100);
+  }
+
+  //! Read a block of consecutive registers in a single transfer, relying on
+  //! the register pointer auto-increment of the device.
+  void readBlock(uint8_t register_addr, uint8_t *data, size_t size) {
+    m_i2c->read(register_addr, data, size);
   }
 
-  //! Read raw data from the magnetometer
-  void readInput(void) {
+  //! Decode a two bytes value, stored as LSB and MSB, in 2's complement.
+  int16_t decodeWord(const uint8_t *data) {
+    return (int16_t)(uint16_t)((data[1] << 8) | data[0]);
+  }
+
+  //! Read raw data from the magnetometer.
+  //! @return true if a new sample was read, false otherwise.
+  bool readInput(void) {
+    uint8_t data[c_sample_size];
     uint8_t status;
-    uint8_t i = 0;
-    int16_t mag_x = 0;
-    int16_t mag_y = 0;
-    int16_t mag_z = 0;
-    float mag_x2;
-    float mag_y2;
-    float mag_z2;
+    int16_t raw[3];
+    double mag[3];
     double imc_tstamp;
-    int8_t done = 0;
-
-    while (i < 20) {
-      status = readByte(&statusRegister);
-      if (status & STAT_OVL)
-        throw std::runtime_error(String::str(
-            "Magnetic sensor overflow. Please switch to RNG_8G output range."));
-      if (status & STAT_DOR) {
-        mag_x = readWord(&xRegisterLSB);
-        mag_y = readWord(&yRegisterLSB);
-        mag_z = readWord(&zRegisterLSB);
-        if (done == 0) {
-          done = 1;
-          i++;
-        }
-        continue;
-      }
-      if (status & STAT_DRDY) {
-        mag_x = readWord(&xRegisterLSB);
-        mag_y = readWord(&yRegisterLSB);
-        mag_z = readWord(&zRegisterLSB);
-        if (done == 0) {
-          done = 1;
-          i++;
-        }
-        break;
-      }
-      Time::Delay::waitMsec(1);
-      done = 0;
-    }
-    // Remove offset bias and rescale.
-    mag_x2 =
-        (float)((mag_x - m_args.offset_bias[0]) * m_args.scale_correction[0]);
-    mag_y2 =
-        (float)((mag_y - m_args.offset_bias[1]) * m_args.scale_correction[1]);
-    mag_z2 =
-        (float)((mag_z - m_args.offset_bias[2]) * m_args.scale_correction[2]);
 
+    // Status first, so that it describes the data that follows, then the
+    // data registers after the pointer rolls over.
     imc_tstamp = Clock::getSinceEpoch();
+    readBlock(statusRegister, data, c_sample_size);
+    status = data[0];
+    // Data skipped for reading also means new data is available.
+    if (!(status & (STAT_DRDY | STAT_OVL | STAT_DOR)))
+      return false;
+
+    for (unsigned i = 0; i < 3; ++i)
+      raw[i] = decodeWord(&data[1 + 2 * i]);
+    if (!updateRange(status, raw))
+      return false;
+
+    // Calibration applies to counts of the 2 G range.
+    for (unsigned i = 0; i < 3; ++i)
+      mag[i] = raw[i] * (m_range / 2.0);
+    if (m_calibrator != NULL)
+      updateCalibration(mag);
+
+    // Remove offset bias and rescale.
+    m_cal.apply(mag, mag);
+
     m_magn.setTimeStamp(imc_tstamp);
-    m_magn.x = (float)mag_x2 / 1000;
-    m_magn.y = (float)mag_y2 / 1000;
-    m_magn.z = (float)mag_z2 / 1000;
+    m_magn.x = (float)mag[0] / 1000;
+    m_magn.y = (float)mag[1] / 1000;
+    m_magn.z = (float)mag[2] / 1000;
+
+    Common::Sample sample;
+    sample.tstamp = imc_tstamp;
+    sample.value[0] = m_magn.x;
+    sample.value[1] = m_magn.y;
+    sample.value[2] = m_magn.z;
+    Common::SampleRing::get(Common::SS_MAGNETIC_FIELD).write(sample);
+    return true;
+  }
+
+  //! Report the usage of the shared I2C bus.
+  void reportBusStats(void) {
+    Common::I2CDevice::Stats s = m_i2c->takeStats();
+    debug("I2C: %.1f%% of the bus (%.1f%% total), %llu transactions, "
+          "%.3f ms wait, %.3f ms max",
+          s.utilization * 100, s.bus_utilization * 100,
+          (unsigned long long)s.transactions, s.wait * 1000,
+          s.max_wait * 1000);
   }
 
   //! Main loop.
   void onMain(void) {
+    m_stats_tstamp = Clock::get();
+
     while (!stopping()) {
-      readInput();
-      dispatch(m_magn, DF_KEEP_TIME);
+      if (Clock::get() - m_stats_tstamp >= m_args.stats_period) {
+        m_stats_tstamp = Clock::get();
+        reportBusStats();
+      }
+
+      if (!m_drdy->wait())
+        debug("data ready timeout");
+      consumeMessages();
+      if (!readInput())
+        continue;
+
+      double tstamp = m_magn.getTimeStamp();
+      if (m_args.dispatch_rate <= 0
+          || tstamp - m_dispatch_tstamp >= 1.0 / m_args.dispatch_rate) {
+        m_dispatch_tstamp = tstamp;
+        dispatch(m_magn, DF_KEEP_TIME);
+      }
     }
   }
 };
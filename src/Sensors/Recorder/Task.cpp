@@ -0,0 +1,271 @@
+
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// ISO C++ 98 headers.
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <set>
+
+// POSIX headers.
+#include <dirent.h>
+#include <sys/stat.h>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+// Local headers.
+#include "../Common/RingFile.hpp"
+#include "../Common/SampleRing.hpp"
+
+namespace Sensors {
+namespace Recorder {
+// Full rate recorder of the sensor and actuator sample streams.
+using DUNE_NAMESPACES;
+
+struct Arguments {
+  //! Output directory.
+  std::string dir;
+  //! Recorded streams.
+  std::vector<std::string> streams;
+  //! Records per stream file.
+  unsigned capacity;
+  //! Write back period.
+  double flush_period;
+  //! Runs kept in the output directory.
+  unsigned runs;
+};
+
+//! Period between sample ring reads. The rings hold about one second of
+//! samples of the fastest stream.
+static const double c_drain_period = 0.1;
+
+struct Task : public DUNE::Tasks::Task {
+  //! Ring files, NULL for streams not recorded.
+  Common::RingFile *m_files[Common::SS_COUNT];
+  //! Positions in the sample rings.
+  Common::SampleRing::Cursor m_cursors[Common::SS_COUNT];
+  //! Time of the last write back.
+  double m_flush_tstamp;
+  //! Task arguments.
+  Arguments m_args;
+
+  Task(const std::string &name, Tasks::Context &ctx)
+      : DUNE::Tasks::Task(name, ctx), m_flush_tstamp(0.0) {
+    for (unsigned i = 0; i < Common::SS_COUNT; ++i)
+      m_files[i] = NULL;
+
+    param("Directory", m_args.dir)
+        .defaultValue("/var/tmp/rawrec")
+        .description("Directory of the ring files. Each start creates one "
+                     "file per stream, named after the start time and the "
+                     "stream");
+
+    param("Streams", m_args.streams)
+        .defaultValue("imu, magnetic_field, range, target, thrust")
+        .description("Recorded streams: imu, magnetic_field, range, target "
+                     "or thrust");
+
+    param("Records per Stream", m_args.capacity)
+        .defaultValue("1048576")
+        .minimumValue("1024")
+        .description("Capacity of each ring file, 32 bytes per record. "
+                     "When full, the oldest records are overwritten");
+
+    param("Flush Period", m_args.flush_period)
+        .defaultValue("10")
+        .minimumValue("1")
+        .units(Units::Second)
+        .description("Period at which written records are scheduled for "
+                     "write back to storage");
+
+    param("Kept Runs", m_args.runs)
+        .defaultValue("3")
+        .description("Number of runs, including the current one, kept in "
+                     "the directory. Older runs are deleted on start. If "
+                     "zero, all runs are kept");
+  }
+
+  //! Find a stream by name.
+  //! @param[in] name stream name.
+  //! @return stream, SS_COUNT if unknown.
+  Common::Stream findStream(const std::string &name) {
+    for (unsigned i = 0; i < Common::SS_COUNT; ++i) {
+      Common::Stream s = (Common::Stream)i;
+      if (name == Common::getStreamInfo(s).name)
+        return s;
+    }
+    return Common::SS_COUNT;
+  }
+
+  //! Get the run of a ring file name.
+  //! @param[in] name file name.
+  //! @return start time stamp of the run, empty if not a ring file.
+  static std::string getRun(const std::string &name) {
+    static const size_t c_stamp = 15;
+    static const char c_ext[] = ".rawrec";
+    size_t ext = sizeof(c_ext) - 1;
+
+    if (name.size() <= c_stamp + 1 + ext
+        || name.compare(name.size() - ext, ext, c_ext) != 0
+        || name[8] != '_' || name[c_stamp] != '_')
+      return "";
+
+    for (size_t i = 0; i < c_stamp; ++i) {
+      if (i != 8 && !std::isdigit((unsigned char)name[i]))
+        return "";
+    }
+    return name.substr(0, c_stamp);
+  }
+
+  //! Delete the oldest runs, leaving room for a new one.
+  void pruneRuns(void) {
+    if (m_args.runs == 0)
+      return;
+
+    DIR *d = ::opendir(m_args.dir.c_str());
+    if (d == NULL)
+      return;
+
+    std::vector<std::string> files;
+    std::set<std::string> runs;
+    while (dirent *entry = ::readdir(d)) {
+      std::string run = getRun(entry->d_name);
+      if (run.empty())
+        continue;
+      files.push_back(entry->d_name);
+      runs.insert(run);
+    }
+    ::closedir(d);
+
+    // Stamps sort in time order.
+    std::set<std::string> old;
+    for (std::set<std::string>::iterator itr = runs.begin();
+         runs.size() - old.size() >= m_args.runs; ++itr)
+      old.insert(*itr);
+
+    for (unsigned i = 0; i < files.size(); ++i) {
+      if (old.count(getRun(files[i])) == 0)
+        continue;
+
+      std::string path = m_args.dir + "/" + files[i];
+      if (std::remove(path.c_str()) == 0)
+        inf("deleted %s", path.c_str());
+      else
+        war("unable to delete %s: %s", path.c_str(), std::strerror(errno));
+    }
+  }
+
+  //! Acquire resources.
+  void onResourceAcquisition(void) {
+    if (::mkdir(m_args.dir.c_str(), 0755) < 0 && errno != EEXIST)
+      throw std::runtime_error(String::str("unable to create %s: %s",
+                                           m_args.dir.c_str(),
+                                           std::strerror(errno)));
+
+    pruneRuns();
+
+    double now = Clock::getSinceEpoch();
+    time_t secs = (time_t)now;
+    struct tm tm;
+    char stamp[32];
+    std::strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", gmtime_r(&secs, &tm));
+
+    for (unsigned i = 0; i < m_args.streams.size(); ++i) {
+      Common::Stream s = findStream(m_args.streams[i]);
+      if (s == Common::SS_COUNT)
+        throw std::runtime_error(
+            String::str("unknown stream %s", m_args.streams[i].c_str()));
+      if (m_files[s] != NULL)
+        continue;
+
+      std::string path = String::str("%s/%s_%s.rawrec", m_args.dir.c_str(),
+                                     stamp, Common::getStreamInfo(s).name);
+      m_files[s] = new Common::RingFile(path, s, m_args.capacity, now);
+      m_cursors[s] = Common::SampleRing::get(s).cursor();
+      inf("recording %s", path.c_str());
+    }
+
+    setEntityState(IMC::EntityState::ESTA_NORMAL, Status::CODE_ACTIVE);
+  }
+
+  //! Release resources, after saving the samples still in the rings.
+  void onResourceRelease(void) {
+    drain();
+    for (unsigned i = 0; i < Common::SS_COUNT; ++i)
+      Memory::clear(m_files[i]);
+  }
+
+  //! Copy new samples from the rings to the files.
+  void drain(void) {
+    for (unsigned i = 0; i < Common::SS_COUNT; ++i) {
+      if (m_files[i] == NULL)
+        continue;
+
+      Common::SampleRing &ring = Common::SampleRing::get((Common::Stream)i);
+      Common::SampleRing::Cursor &c = m_cursors[i];
+      Common::Sample sample;
+      while (ring.read(c, sample))
+        m_files[i]->write(sample);
+
+      if (c.lost > 0) {
+        war("%s: %llu samples lost",
+            Common::getStreamInfo((Common::Stream)i).name,
+            (unsigned long long)c.lost);
+        m_files[i]->addLost(c.lost);
+        c.lost = 0;
+      }
+    }
+  }
+
+  //! Main loop.
+  void onMain(void) {
+    m_flush_tstamp = Clock::get();
+
+    while (!stopping()) {
+      waitForMessages(c_drain_period);
+      drain();
+
+      if (Clock::get() - m_flush_tstamp >= m_args.flush_period) {
+        m_flush_tstamp = Clock::get();
+        for (unsigned i = 0; i < Common::SS_COUNT; ++i) {
+          if (m_files[i] != NULL)
+            m_files[i]->flush();
+        }
+      }
+    }
+  }
+};
+} // namespace Recorder
+} // namespace Sensors
+
+DUNE_TASK
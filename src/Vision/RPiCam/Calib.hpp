@@ -27,6 +27,16 @@
 // Author: Alexandre Rocha                                                  *
 //***************************************************************************
 
+// ISO C++ 98 headers.
+#include <cstdio>
+#include <cstring>
+
+// POSIX headers.
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <DUNE/DUNE.hpp>
 
 #include <opencv2/calib3d.hpp>
@@ -41,40 +51,169 @@ namespace Vision {
 using DUNE_NAMESPACES;
 namespace RPiCam {
 
-//! Intrinsic Parameters
-float intrinsic_parameters[9] = {
-    681.9474487304688,    0.000000000000000000, 279.387553359592862,
-    0.000000000000000000, 679.4100341796875,    240.90015807337113,
-    0.000000000000000000, 0.000000000000000000, 1.000000000000000000};
-//! Distortion Coeficients
-float distortion_coeficients[5] = {-0.4624503562479969, -0.43432558990654135,
-                                   0.001974482671297278, -0.008023538703377298,
-                                   2.9986277588121113};
-//! Distortion Coeficients
-float roi_limits[4] = {7, 13, 623, 453};
+//! Undistortion map cache file magic, with the format version
+static const char c_map_magic[] = "RPIMAP01";
+
+//! Undistortion maps in OpenCV fixed-point format (CV_16SC2 coordinates
+//! and CV_16UC1 interpolation indices). Maps are cached on disk under a
+//! hash of the calibration and frame size, and cached maps are used in
+//! place from a read-only mapping of the cache file.
+class UndistortionMaps {
+public:
+  UndistortionMaps(void) : m_data(NULL), m_length(0) {}
+
+  ~UndistortionMaps(void) { clear(); }
+
+  //! Cache file of a calibration.
+  //! @param[in] dir cache directory.
+  //! @param[in] camera camera matrix, row-major.
+  //! @param[in] distortion distortion coefficients.
+  //! @param[in] size frame size.
+  static std::string path(const std::string &dir,
+                          const std::vector<double> &camera,
+                          const std::vector<double> &distortion,
+                          cv::Size size) {
+    uint64_t hash = c_fnv_basis;
+    hash = fnv(hash, c_map_magic, sizeof(c_map_magic));
+    hash = fnv(hash, camera.data(), camera.size() * sizeof(double));
+    hash = fnv(hash, distortion.data(), distortion.size() * sizeof(double));
+    hash = fnv(hash, &size.width, sizeof(size.width));
+    hash = fnv(hash, &size.height, sizeof(size.height));
+    return String::str("%s/rpicam-maps-%016llx.bin", dir.c_str(),
+                       (unsigned long long)hash);
+  }
+
+  //! Use cached maps.
+  //! @param[in] file cache file.
+  //! @param[in] size frame size.
+  //! @return true if the cache file holds maps of this size.
+  bool load(const std::string &file, cv::Size size) {
+    clear();
+
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat st;
+    size_t pixels = (size_t)size.width * size.height;
+    size_t length = sizeof(Header) + pixels * c_pixel_size;
+    if (::fstat(fd, &st) < 0 || (size_t)st.st_size != length) {
+      ::close(fd);
+      return false;
+    }
+
+    void *data = ::mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+      return false;
+
+    const Header *hdr = (const Header *)data;
+    if (std::memcmp(hdr->magic, c_map_magic, sizeof(hdr->magic)) != 0
+        || hdr->width != (uint32_t)size.width
+        || hdr->height != (uint32_t)size.height) {
+      ::munmap(data, length);
+      return false;
+    }
+
+    m_data = data;
+    m_length = length;
+    uint8_t *map_1 = (uint8_t *)data + sizeof(Header);
+    uint8_t *map_2 = map_1 + pixels * 4;
+    m_map_1 = cv::Mat(size, CV_16SC2, map_1);
+    m_map_2 = cv::Mat(size, CV_16UC1, map_2);
+    return true;
+  }
+
+  //! Compute maps.
+  //! @param[in] camera camera matrix, row-major.
+  //! @param[in] distortion distortion coefficients.
+  //! @param[in] size frame size.
+  void compute(const std::vector<double> &camera,
+               const std::vector<double> &distortion, cv::Size size) {
+    clear();
+
+    cv::Mat camera_matrix(3, 3, CV_64F, (void *)camera.data());
+    cv::Mat dist_coefs(1, distortion.size(), CV_64F,
+                       (void *)distortion.data());
+    cv::initUndistortRectifyMap(camera_matrix, dist_coefs, cv::Mat(),
+                                camera_matrix, size, CV_16SC2, m_map_1,
+                                m_map_2);
+  }
+
+  //! Write the maps to a cache file.
+  //! @param[in] file cache file.
+  //! @return true on success.
+  bool store(const std::string &file) const {
+    std::string tmp = String::str("%s.%d", file.c_str(), (int)getpid());
+    FILE *f = std::fopen(tmp.c_str(), "wb");
+    if (f == NULL)
+      return false;
+
+    Header hdr;
+    std::memcpy(hdr.magic, c_map_magic, sizeof(hdr.magic));
+    hdr.width = m_map_1.cols;
+    hdr.height = m_map_1.rows;
+
+    size_t pixels = m_map_1.total();
+    bool ok = std::fwrite(&hdr, sizeof(hdr), 1, f) == 1
+              && std::fwrite(m_map_1.data, 4, pixels, f) == pixels
+              && std::fwrite(m_map_2.data, 2, pixels, f) == pixels;
+    ok = (std::fclose(f) == 0) && ok;
+
+    // Readers only ever see complete files.
+    if (ok && std::rename(tmp.c_str(), file.c_str()) == 0)
+      return true;
+
+    std::remove(tmp.c_str());
+    return false;
+  }
 
-void undistortionMaps(cv::Mat &map_1, cv::Mat &map_2, cv::VideoCapture &cap) {
+  //! Coordinates map.
+  const cv::Mat &getMap1(void) const { return m_map_1; }
 
-  cv::Mat temp;
-  cv::Mat camera_matrix, dist_coefs;
+  //! Interpolation indices map.
+  const cv::Mat &getMap2(void) const { return m_map_2; }
 
-  cap.read(temp);
-  map_1 = cv::Mat(temp.size(), CV_16SC2);
-  map_2 = cv::Mat(temp.size(), CV_16UC1);
+private:
+  //! Cache file header.
+  struct Header {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+  };
 
-  camera_matrix = cv::Mat(3, 3, CV_32F, intrinsic_parameters);
-  dist_coefs = cv::Mat(1, 5, CV_32F, distortion_coeficients);
+  //! Bytes per pixel of both maps.
+  static const size_t c_pixel_size = 6;
+  //! FNV-1a offset basis.
+  static const uint64_t c_fnv_basis = 14695981039346656037ULL;
 
-  cv::initUndistortRectifyMap(camera_matrix, dist_coefs, cv::Mat(),
-                              camera_matrix, temp.size(), CV_32F, map_1, map_2);
-}
+  //! Mapped cache file, if maps were loaded.
+  void *m_data;
+  //! Mapping length.
+  size_t m_length;
+  //! Coordinates map.
+  cv::Mat m_map_1;
+  //! Interpolation indices map.
+  cv::Mat m_map_2;
 
-void cropROI(cv::Mat &frame) {
+  //! Release the maps.
+  void clear(void) {
+    m_map_1.release();
+    m_map_2.release();
+    if (m_data != NULL)
+      ::munmap(m_data, m_length);
+    m_data = NULL;
+    m_length = 0;
+  }
 
-  cv::Rect new_roi =
-      cv::Rect(roi_limits[0], roi_limits[1], roi_limits[2], roi_limits[3]);
-  frame = frame(new_roi);
-}
+  //! FNV-1a hash step.
+  static uint64_t fnv(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < size; ++i)
+      hash = (hash ^ p[i]) * 1099511628211ULL;
+    return hash;
+  }
+};
 
 } // namespace RPiCam
-} // namespace Vision
\ No newline at end of file
+} // namespace Vision
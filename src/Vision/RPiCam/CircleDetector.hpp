@@ -0,0 +1,325 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Alexandre Rocha                                                  *
+//***************************************************************************
+
+#ifndef VISION_RPICAM_CIRCLE_DETECTOR_HPP_INCLUDED_
+#define VISION_RPICAM_CIRCLE_DETECTOR_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <stdint.h>
+
+#include <opencv2/features2d.hpp>
+
+namespace Vision {
+namespace RPiCam {
+//! Blob detector for binary masks. Blobs are labelled in a single pass
+//! over runs of pixels, with 8-connectivity, and their moments are
+//! accumulated as runs are labelled, so no contour is ever traced. Blobs
+//! are filtered like cv::SimpleBlobDetector, with approximate shape
+//! descriptors: the perimeter follows the run ends from row to row and
+//! the convex area is the sum of the blob's row extents.
+class CircleDetector {
+public:
+  //! Mask threshold.
+  static const uint8_t c_threshold = 128;
+
+  //! Set the detection parameters. Only the area, circularity,
+  //! convexity, inertia and colour filters are used.
+  void setParams(const cv::SimpleBlobDetector::Params &params) {
+    m_params = params;
+  }
+
+  //! Detect blobs.
+  //! @param[in] mask CV_8UC1 mask.
+  //! @param[out] keypoints blobs that pass the filters, large round blobs
+  //! first. The response of a keypoint is its roundness, in [0, 1].
+  void detect(const cv::Mat &mask, std::vector<cv::KeyPoint> &keypoints) {
+    keypoints.clear();
+    m_blobs.clear();
+    m_prev.clear();
+
+    bool dark = !m_params.filterByColor || m_params.blobColor == 0;
+    for (int y = 0; y < mask.rows; ++y) {
+      findRuns(mask.ptr<uint8_t>(y), mask.cols, dark);
+      labelRuns(y);
+      std::swap(m_prev, m_cur);
+    }
+    closeRuns();
+
+    for (unsigned i = 0; i < m_blobs.size(); ++i) {
+      Blob &blob = m_blobs[i];
+      if (blob.parent != (int)i)
+        continue;
+
+      blob.hull += blob.xmax - blob.xmin + 1;
+      cv::KeyPoint keypoint;
+      if (measure(blob, keypoint))
+        keypoints.push_back(keypoint);
+    }
+
+    std::sort(keypoints.begin(), keypoints.end(), better);
+  }
+
+private:
+  //! Run of foreground pixels.
+  struct Run {
+    int x0;
+    int x1;
+    //! Blob label.
+    int label;
+    //! True if continued in the next row.
+    bool continued;
+  };
+
+  //! Blob statistics, valid on the root of each label set.
+  struct Blob {
+    //! Label set parent.
+    int parent;
+    //! Raw moments.
+    int64_t m00, m10, m01, m20, m02, m11;
+    //! Perimeter.
+    double perimeter;
+    //! Area of completed row extents.
+    int64_t hull;
+    //! Last row and its extent.
+    int row, xmin, xmax;
+  };
+
+  //! Detection parameters.
+  cv::SimpleBlobDetector::Params m_params;
+  //! Runs of the previous row.
+  std::vector<Run> m_prev;
+  //! Runs of the current row.
+  std::vector<Run> m_cur;
+  //! Blobs.
+  std::vector<Blob> m_blobs;
+
+  //! Find runs of foreground pixels in a row.
+  void findRuns(const uint8_t *row, int cols, bool dark) {
+    m_cur.clear();
+
+    int x = 0;
+    while (x < cols) {
+      while (x < cols && (row[x] < c_threshold) != dark)
+        ++x;
+      if (x == cols)
+        break;
+
+      Run run;
+      run.x0 = x;
+      while (x < cols && (row[x] < c_threshold) == dark)
+        ++x;
+      run.x1 = x - 1;
+      run.label = -1;
+      run.continued = false;
+      m_cur.push_back(run);
+    }
+  }
+
+  //! Label the runs of a row against the previous row.
+  void labelRuns(int y) {
+    size_t j = 0;
+
+    for (size_t i = 0; i < m_cur.size(); ++i) {
+      Run &run = m_cur[i];
+      while (j < m_prev.size() && m_prev[j].x1 < run.x0 - 1)
+        ++j;
+
+      int label = -1;
+      size_t first = j;
+      size_t k = j;
+      for (; k < m_prev.size() && m_prev[k].x0 <= run.x1 + 1; ++k) {
+        int root = find(m_prev[k].label);
+        label = (label < 0) ? root : unite(label, root);
+        m_prev[k].continued = true;
+      }
+
+      double edges;
+      if (label < 0) {
+        label = create();
+        // Top edge.
+        edges = run.x1 - run.x0 + 1;
+      } else {
+        int dl = run.x0 - m_prev[first].x0;
+        int dr = run.x1 - m_prev[k - 1].x1;
+        edges = std::sqrt(dl * dl + 1.0) + std::sqrt(dr * dr + 1.0);
+      }
+
+      run.label = label;
+      add(m_blobs[label], run, y);
+      m_blobs[label].perimeter += edges;
+    }
+
+    closeRuns();
+  }
+
+  //! Account for the bottom edge of the runs not continued.
+  void closeRuns(void) {
+    for (size_t i = 0; i < m_prev.size(); ++i) {
+      if (!m_prev[i].continued)
+        m_blobs[find(m_prev[i].label)].perimeter +=
+            m_prev[i].x1 - m_prev[i].x0 + 1;
+      m_prev[i].continued = true;
+    }
+  }
+
+  //! Create a blob.
+  int create(void) {
+    Blob blob;
+    blob.parent = m_blobs.size();
+    blob.m00 = blob.m10 = blob.m01 = blob.m20 = blob.m02 = blob.m11 = 0;
+    blob.perimeter = 0.0;
+    blob.hull = 0;
+    blob.row = -1;
+    blob.xmin = blob.xmax = 0;
+    m_blobs.push_back(blob);
+    return blob.parent;
+  }
+
+  //! Find the root of a label.
+  int find(int label) {
+    while (m_blobs[label].parent != label) {
+      m_blobs[label].parent = m_blobs[m_blobs[label].parent].parent;
+      label = m_blobs[label].parent;
+    }
+    return label;
+  }
+
+  //! Merge two blobs.
+  //! @return root of the merged blob.
+  int unite(int a, int b) {
+    if (a == b)
+      return a;
+
+    Blob &ra = m_blobs[a];
+    Blob &rb = m_blobs[b];
+    ra.m00 += rb.m00;
+    ra.m10 += rb.m10;
+    ra.m01 += rb.m01;
+    ra.m20 += rb.m20;
+    ra.m02 += rb.m02;
+    ra.m11 += rb.m11;
+    ra.perimeter += rb.perimeter;
+    ra.hull += rb.hull;
+
+    // Keep the extent of the most recent row.
+    if (ra.row == rb.row) {
+      ra.xmin = std::min(ra.xmin, rb.xmin);
+      ra.xmax = std::max(ra.xmax, rb.xmax);
+    } else if (rb.row < ra.row) {
+      ra.hull += rb.xmax - rb.xmin + 1;
+    } else {
+      ra.hull += ra.xmax - ra.xmin + 1;
+      ra.row = rb.row;
+      ra.xmin = rb.xmin;
+      ra.xmax = rb.xmax;
+    }
+
+    rb.parent = a;
+    return a;
+  }
+
+  //! Sum of squares from 0 to k.
+  static int64_t squares(int64_t k) { return k * (k + 1) * (2 * k + 1) / 6; }
+
+  //! Add a run to a blob.
+  static void add(Blob &blob, const Run &run, int y) {
+    int64_t n = run.x1 - run.x0 + 1;
+    int64_t sx = n * (run.x0 + run.x1) / 2;
+    blob.m00 += n;
+    blob.m10 += sx;
+    blob.m01 += n * y;
+    blob.m20 += squares(run.x1) - squares(run.x0 - 1);
+    blob.m02 += n * y * y;
+    blob.m11 += sx * y;
+
+    if (blob.row != y) {
+      if (blob.row >= 0)
+        blob.hull += blob.xmax - blob.xmin + 1;
+      blob.row = y;
+      blob.xmin = run.x0;
+      blob.xmax = run.x1;
+    } else {
+      blob.xmin = std::min(blob.xmin, run.x0);
+      blob.xmax = std::max(blob.xmax, run.x1);
+    }
+  }
+
+  //! Compute the shape descriptors of a blob and filter it.
+  //! @return true if the blob passes the filters.
+  bool measure(const Blob &blob, cv::KeyPoint &keypoint) const {
+    double area = blob.m00;
+    if (m_params.filterByArea
+        && (area < m_params.minArea || area >= m_params.maxArea))
+      return false;
+
+    double circularity =
+        4 * M_PI * area / (blob.perimeter * blob.perimeter);
+    if (m_params.filterByCircularity
+        && (circularity < m_params.minCircularity
+            || circularity >= m_params.maxCircularity))
+      return false;
+
+    double cx = blob.m10 / area;
+    double cy = blob.m01 / area;
+    double mu20 = blob.m20 / area - cx * cx;
+    double mu02 = blob.m02 / area - cy * cy;
+    double mu11 = blob.m11 / area - cx * cy;
+    double denom = std::sqrt((mu20 - mu02) * (mu20 - mu02) + 4 * mu11 * mu11);
+    double inertia = 1.0;
+    if (mu20 + mu02 + denom > 0)
+      inertia = (mu20 + mu02 - denom) / (mu20 + mu02 + denom);
+    if (m_params.filterByInertia
+        && (inertia < m_params.minInertiaRatio
+            || inertia >= m_params.maxInertiaRatio))
+      return false;
+
+    double convexity = area / blob.hull;
+    if (m_params.filterByConvexity
+        && (convexity < m_params.minConvexity
+            || convexity >= m_params.maxConvexity))
+      return false;
+
+    keypoint.pt = cv::Point2f(cx, cy);
+    keypoint.size = 2 * std::sqrt(area / M_PI);
+    keypoint.response = std::min(circularity, 1.0) * inertia;
+    return true;
+  }
+
+  //! Keypoint order, best first.
+  static bool better(const cv::KeyPoint &a, const cv::KeyPoint &b) {
+    return a.size * a.size * a.response > b.size * b.size * b.response;
+  }
+};
+} // namespace RPiCam
+} // namespace Vision
+
+#endif
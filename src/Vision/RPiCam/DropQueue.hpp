@@ -0,0 +1,133 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Alexandre Rocha                                                  *
+//***************************************************************************
+
+#ifndef VISION_RPICAM_DROP_QUEUE_HPP_INCLUDED_
+#define VISION_RPICAM_DROP_QUEUE_HPP_INCLUDED_
+
+// ISO C++ 11 headers.
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <stdint.h>
+
+namespace Vision {
+namespace RPiCam {
+//! Bounded single producer, single consumer queue of pointers that never
+//! blocks the producer: pushing to a full queue evicts the oldest item,
+//! which is handed back to the producer. The consumer always gets the
+//! freshest items and a slow stage never stalls the one before it. An
+//! idle consumer sleeps until an item is pushed.
+template <typename T, unsigned N> class DropQueue {
+public:
+  DropQueue(void) : m_head(0), m_tail(0) {
+    for (unsigned i = 0; i < N; ++i)
+      m_slots[i].store(NULL, std::memory_order_relaxed);
+  }
+
+  //! Push an item. Producer side.
+  //! @param[in] item item.
+  //! @return evicted item, or NULL.
+  T *push(T *item) {
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    uint64_t tail = m_tail.load(std::memory_order_acquire);
+    T *evicted = NULL;
+
+    if (head - tail == N) {
+      T *oldest = m_slots[tail % N].load(std::memory_order_relaxed);
+      // The consumer may take the oldest item first, which frees its
+      // slot just the same.
+      if (m_tail.compare_exchange_strong(tail, tail + 1,
+                                         std::memory_order_acq_rel))
+        evicted = oldest;
+    }
+
+    m_slots[head % N].store(item, std::memory_order_relaxed);
+    m_head.store(head + 1, std::memory_order_release);
+
+    // Taking the lock orders the push with a consumer about to sleep.
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_pushed.notify_one();
+    return evicted;
+  }
+
+  //! Pop the oldest item. Consumer side.
+  //! @return item, or NULL if the queue is empty.
+  T *pop(void) {
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    while (tail != m_head.load(std::memory_order_acquire)) {
+      T *item = m_slots[tail % N].load(std::memory_order_relaxed);
+      // Fails if the producer evicted this item meanwhile.
+      if (m_tail.compare_exchange_weak(tail, tail + 1,
+                                       std::memory_order_acq_rel))
+        return item;
+    }
+
+    return NULL;
+  }
+
+  //! Pop the oldest item, waiting for one if the queue is empty.
+  //! Consumer side.
+  //! @param[in] timeout maximum waiting time (s).
+  //! @return item, or NULL if the queue is still empty.
+  T *pop(double timeout) {
+    T *item = pop();
+    if (item != NULL)
+      return item;
+
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_pushed.wait_for(lock, std::chrono::duration<double>(timeout),
+                        [this] {
+                          return m_tail.load(std::memory_order_relaxed)
+                                 != m_head.load(std::memory_order_acquire);
+                        });
+    }
+    return pop();
+  }
+
+private:
+  //! Queued items.
+  std::atomic<T *> m_slots[N];
+  //! Items pushed.
+  alignas(64) std::atomic<uint64_t> m_head;
+  //! Items popped or evicted.
+  alignas(64) std::atomic<uint64_t> m_tail;
+  //! Guards the consumer going to sleep.
+  std::mutex m_mutex;
+  //! Signalled on every push.
+  std::condition_variable m_pushed;
+};
+} // namespace RPiCam
+} // namespace Vision
+
+#endif
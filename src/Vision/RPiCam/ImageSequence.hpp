@@ -0,0 +1,150 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Alexandre Rocha                                                  *
+//***************************************************************************
+
+#ifndef VISION_RPICAM_IMAGE_SEQUENCE_HPP_INCLUDED_
+#define VISION_RPICAM_IMAGE_SEQUENCE_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// POSIX headers.
+#include <dirent.h>
+
+#include <opencv2/imgcodecs.hpp>
+
+namespace Vision {
+namespace RPiCam {
+//! Frames read from the image files of a directory, in file name order.
+class ImageSequence {
+public:
+  ImageSequence(void) : m_next(0) {}
+
+  //! Open a directory.
+  //! @param[in] dir directory.
+  //! @return true if the directory has images.
+  bool open(const std::string &dir) {
+    close();
+
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL)
+      return false;
+
+    while (dirent *entry = readdir(d)) {
+      std::string name = entry->d_name;
+      if (isImage(name))
+        m_files.push_back(dir + "/" + name);
+    }
+    closedir(d);
+
+    std::sort(m_files.begin(), m_files.end());
+    if (m_files.empty())
+      return false;
+
+    cv::Mat first = cv::imread(m_files[0], cv::IMREAD_COLOR);
+    if (first.empty()) {
+      close();
+      return false;
+    }
+
+    m_size = first.size();
+    return true;
+  }
+
+  //! Forget all images.
+  void close(void) {
+    m_files.clear();
+    m_next = 0;
+    m_size = cv::Size();
+  }
+
+  //! Check if there are images.
+  bool isOpened(void) const { return !m_files.empty(); }
+
+  //! Size of the first image.
+  cv::Size getSize(void) const { return m_size; }
+
+  //! Restart from the first image.
+  void rewind(void) { m_next = 0; }
+
+  //! Path of the last image read, empty before the first.
+  std::string getFile(void) const {
+    return m_next > 0 ? m_files[m_next - 1] : std::string();
+  }
+
+  //! Read the next image. Images must all be the size of the first.
+  //! @param[out] image BGR image.
+  //! @return false after the last image.
+  bool read(cv::Mat &image) {
+    if (m_next >= m_files.size())
+      return false;
+
+    const std::string &file = m_files[m_next++];
+    image = cv::imread(file, cv::IMREAD_COLOR);
+    if (image.empty() || image.size() != m_size)
+      throw std::runtime_error("invalid image " + file);
+    return true;
+  }
+
+private:
+  //! Image files.
+  std::vector<std::string> m_files;
+  //! Next image.
+  size_t m_next;
+  //! Image size.
+  cv::Size m_size;
+
+  //! Check if a file name has an image extension.
+  static bool isImage(const std::string &name) {
+    static const char *extensions[] = {".png", ".jpg", ".jpeg", ".bmp",
+                                       ".ppm", ".tif", ".tiff"};
+
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos)
+      return false;
+
+    std::string ext = name.substr(dot);
+    for (size_t i = 0; i < ext.size(); ++i)
+      ext[i] = std::tolower(ext[i]);
+
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i) {
+      if (ext == extensions[i])
+        return true;
+    }
+
+    return false;
+  }
+};
+} // namespace RPiCam
+} // namespace Vision
+
+#endif
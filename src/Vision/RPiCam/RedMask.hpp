@@ -0,0 +1,268 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Alexandre Rocha                                                  *
+//***************************************************************************
+
+#ifndef VISION_RPICAM_RED_MASK_HPP_INCLUDED_
+#define VISION_RPICAM_RED_MASK_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+#include <stdint.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RED_MASK_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RED_MASK_SSE2 1
+#endif
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace Vision {
+namespace RPiCam {
+//! Undistortion, colour conversion and hue threshold fused in a single
+//! pass. Each mask row is produced from a BGR frame with a bilinear
+//! remap on precomputed integer tables, followed by the hue test, and
+//! only a short run of pixels is ever held in colour. The result
+//! matches cv::remap, cv::cvtColor(COLOR_BGR2HSV) and
+//! cv::inRange((10, 0, 0), (170, 255, 255)): pixels whose hue falls
+//! outside the red band are 255, red and grey pixels are 0.
+class RedMask {
+public:
+  //! Bits of the fractional part of remap coordinates.
+  static const int c_frac_bits = 5;
+  //! Pixels held in colour at a time.
+  static const int c_run = 64;
+
+  RedMask(void) : m_step(0) {}
+
+  //! Set the undistortion maps.
+  //! @param[in] map_1 CV_32FC1 x map, or CV_16SC2 integer coordinates.
+  //! @param[in] map_2 CV_32FC1 y map, or CV_16UC1 interpolation indices.
+  //! Fixed-point maps are used in place and must outlive this object.
+  //! @param[in] src_size source frame size.
+  void setMaps(const cv::Mat &map_1, const cv::Mat &map_2,
+               cv::Size src_size) {
+    if (map_1.type() == CV_16SC2) {
+      m_xy = map_1;
+      m_frac = map_2;
+    } else {
+      cv::convertMaps(map_1, map_2, m_xy, m_frac, CV_16SC2);
+    }
+
+    m_src_size = src_size;
+    m_step = 0;
+  }
+
+  //! Compute the mask of a whole frame.
+  //! @param[in] src CV_8UC3 BGR frame.
+  //! @param[out] mask CV_8UC1 mask.
+  void apply(const cv::Mat &src, cv::Mat &mask) {
+    apply(src, mask, cv::Rect(cv::Point(0, 0), m_xy.size()));
+  }
+
+  //! Compute the mask of a window of the undistorted frame.
+  //! @param[in] src CV_8UC3 BGR frame.
+  //! @param[out] mask CV_8UC1 mask, the size of the window.
+  //! @param[in] window undistorted frame window.
+  void apply(const cv::Mat &src, cv::Mat &mask, const cv::Rect &window) {
+    prepare(src, mask, window);
+    applyRows(src, mask, window, 0, mask.rows);
+  }
+
+  //! Allocate the mask and build the source offsets for the frame
+  //! stride. Must be called before applyRows().
+  //! @param[in] src CV_8UC3 BGR frame.
+  //! @param[out] mask CV_8UC1 mask.
+  //! @param[in] window undistorted frame window.
+  void prepare(const cv::Mat &src, cv::Mat &mask, const cv::Rect &window) {
+    CV_Assert(src.type() == CV_8UC3 && src.size() == m_src_size);
+    CV_Assert((window & cv::Rect(cv::Point(0, 0), m_xy.size())) == window);
+    mask.create(window.size(), CV_8UC1);
+
+    if (m_step == src.step)
+      return;
+
+    m_step = src.step;
+    m_offset.resize(m_xy.total());
+    for (int y = 0; y < m_xy.rows; ++y) {
+      const int16_t *xy = m_xy.ptr<int16_t>(y);
+      int32_t *offset = &m_offset[y * m_xy.cols];
+
+      for (int x = 0; x < m_xy.cols; ++x) {
+        int sx = xy[2 * x];
+        int sy = xy[2 * x + 1];
+        // Pixels needing samples outside the frame are treated as black.
+        if (sx < 0 || sy < 0 || sx >= m_src_size.width - 1
+            || sy >= m_src_size.height - 1)
+          offset[x] = -1;
+        else
+          offset[x] = sy * (int32_t)m_step + sx * 3;
+      }
+    }
+  }
+
+  //! Compute a band of mask rows. Bands may be computed concurrently.
+  //! @param[in] src CV_8UC3 BGR frame.
+  //! @param[out] mask mask, allocated by prepare().
+  //! @param[in] window undistorted frame window.
+  //! @param[in] begin first mask row.
+  //! @param[in] end one past the last mask row.
+  void applyRows(const cv::Mat &src, cv::Mat &mask, const cv::Rect &window,
+                 int begin, int end) const {
+    uint8_t b[c_run], g[c_run], r[c_run];
+
+    for (int y = begin; y < end; ++y) {
+      int row = y + window.y;
+      const int32_t *offset = &m_offset[row * m_xy.cols + window.x];
+      const uint16_t *frac = m_frac.ptr<uint16_t>(row) + window.x;
+      uint8_t *dst = mask.ptr<uint8_t>(y);
+
+      for (int x = 0; x < mask.cols; x += c_run) {
+        int n = std::min(c_run, mask.cols - x);
+        for (int i = 0; i < n; ++i)
+          sample(src.data, offset[x + i], frac[x + i], b[i], g[i], r[i]);
+        threshold(b, g, r, dst + x, n);
+      }
+    }
+  }
+
+private:
+  //! Integer source coordinates.
+  cv::Mat m_xy;
+  //! Interpolation indices.
+  cv::Mat m_frac;
+  //! Source frame size.
+  cv::Size m_src_size;
+  //! Source frame stride the offsets were built for.
+  size_t m_step;
+  //! Byte offset of the top-left source pixel, -1 if outside.
+  std::vector<int32_t> m_offset;
+
+  //! Bilinear sample of the source frame.
+  void sample(const uint8_t *src, int32_t offset, uint16_t frac,
+              uint8_t &b, uint8_t &g, uint8_t &r) const {
+    if (offset < 0) {
+      b = g = r = 0;
+      return;
+    }
+
+    const int one = 1 << c_frac_bits;
+    int fx = frac & (one - 1);
+    int fy = frac >> c_frac_bits;
+    int w00 = (one - fx) * (one - fy);
+    int w01 = fx * (one - fy);
+    int w10 = (one - fx) * fy;
+    int w11 = fx * fy;
+
+    const uint8_t *p = src + offset;
+    const uint8_t *q = p + m_step;
+    const int round = 1 << (2 * c_frac_bits - 1);
+    b = (p[0] * w00 + p[3] * w01 + q[0] * w10 + q[3] * w11 + round)
+        >> (2 * c_frac_bits);
+    g = (p[1] * w00 + p[4] * w01 + q[1] * w10 + q[4] * w11 + round)
+        >> (2 * c_frac_bits);
+    r = (p[2] * w00 + p[5] * w01 + q[2] * w10 + q[5] * w11 + round)
+        >> (2 * c_frac_bits);
+  }
+
+  //! Hue test. The OpenCV hue is outside [10, 170] when red is the
+  //! largest component and 60 |g - b| < 19 (max - min), which needs no
+  //! division. Grey pixels have a null hue.
+  static void threshold(const uint8_t *b, const uint8_t *g, const uint8_t *r,
+                        uint8_t *dst, int n) {
+    int i = 0;
+
+#if defined(RED_MASK_NEON)
+    for (; i + 16 <= n; i += 16) {
+      uint8x16_t vb = vld1q_u8(b + i);
+      uint8x16_t vg = vld1q_u8(g + i);
+      uint8x16_t vr = vld1q_u8(r + i);
+      uint8x16_t max = vmaxq_u8(vr, vmaxq_u8(vg, vb));
+      uint8x16_t diff = vsubq_u8(max, vminq_u8(vr, vminq_u8(vg, vb)));
+      uint8x16_t gb = vabdq_u8(vg, vb);
+
+      uint16x8_t lt_lo =
+          vcltq_u16(vmull_u8(vget_low_u8(gb), vdup_n_u8(60)),
+                    vmull_u8(vget_low_u8(diff), vdup_n_u8(19)));
+      uint16x8_t lt_hi =
+          vcltq_u16(vmull_u8(vget_high_u8(gb), vdup_n_u8(60)),
+                    vmull_u8(vget_high_u8(diff), vdup_n_u8(19)));
+      uint8x16_t lt = vcombine_u8(vmovn_u16(lt_lo), vmovn_u16(lt_hi));
+
+      uint8x16_t red = vorrq_u8(vceqq_u8(diff, vdupq_n_u8(0)),
+                                vandq_u8(vceqq_u8(vr, max), lt));
+      vst1q_u8(dst + i, vmvnq_u8(red));
+    }
+#elif defined(RED_MASK_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i k60 = _mm_set1_epi16(60);
+    const __m128i k19 = _mm_set1_epi16(19);
+
+    for (; i + 16 <= n; i += 16) {
+      __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+      __m128i vg = _mm_loadu_si128((const __m128i *)(g + i));
+      __m128i vr = _mm_loadu_si128((const __m128i *)(r + i));
+      __m128i max = _mm_max_epu8(vr, _mm_max_epu8(vg, vb));
+      __m128i diff =
+          _mm_sub_epi8(max, _mm_min_epu8(vr, _mm_min_epu8(vg, vb)));
+      __m128i gb =
+          _mm_or_si128(_mm_subs_epu8(vg, vb), _mm_subs_epu8(vb, vg));
+
+      __m128i lt_lo =
+          _mm_cmplt_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(gb, zero), k60),
+                          _mm_mullo_epi16(_mm_unpacklo_epi8(diff, zero), k19));
+      __m128i lt_hi =
+          _mm_cmplt_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(gb, zero), k60),
+                          _mm_mullo_epi16(_mm_unpackhi_epi8(diff, zero), k19));
+      __m128i lt = _mm_packs_epi16(lt_lo, lt_hi);
+
+      __m128i red = _mm_or_si128(_mm_cmpeq_epi8(diff, zero),
+                                 _mm_and_si128(_mm_cmpeq_epi8(vr, max), lt));
+      _mm_storeu_si128((__m128i *)(dst + i),
+                       _mm_andnot_si128(red, _mm_set1_epi8(-1)));
+    }
+#endif
+
+    for (; i < n; ++i) {
+      int max = std::max(r[i], std::max(g[i], b[i]));
+      int diff = max - std::min(r[i], std::min(g[i], b[i]));
+      bool red = diff == 0
+                 || (r[i] == max && 60 * std::abs(g[i] - b[i]) < 19 * diff);
+      dst[i] = red ? 0 : 255;
+    }
+  }
+};
+} // namespace RPiCam
+} // namespace Vision
+
+#endif
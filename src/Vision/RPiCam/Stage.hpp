@@ -0,0 +1,130 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Alexandre Rocha                                                  *
+//***************************************************************************
+
+#ifndef VISION_RPICAM_STAGE_HPP_INCLUDED_
+#define VISION_RPICAM_STAGE_HPP_INCLUDED_
+
+// ISO C++ 11 headers.
+#include <atomic>
+#include <functional>
+
+// DUNE headers.
+#include <DUNE/DUNE.hpp>
+
+namespace Vision {
+namespace RPiCam {
+using DUNE_NAMESPACES;
+
+//! Throughput and latency of a pipeline stage, updated by the stage
+//! thread and sampled by the task.
+class StageStats {
+public:
+  //! Snapshot of the counters since the previous one.
+  struct Snapshot {
+    //! Items processed.
+    uint64_t items;
+    //! Items dropped.
+    uint64_t dropped;
+    //! Mean processing time (s).
+    double latency;
+    //! Mean time since capture (s).
+    double age;
+  };
+
+  StageStats(void) : m_items(0), m_dropped(0), m_latency(0), m_age(0) {}
+
+  //! Account for a processed item.
+  //! @param[in] latency processing time (s).
+  //! @param[in] age time since capture (s).
+  void add(double latency, double age) {
+    m_items.fetch_add(1, std::memory_order_relaxed);
+    m_latency.fetch_add((uint64_t)(latency * 1e6), std::memory_order_relaxed);
+    m_age.fetch_add((uint64_t)(age * 1e6), std::memory_order_relaxed);
+  }
+
+  //! Account for a dropped item.
+  void drop(void) { m_dropped.fetch_add(1, std::memory_order_relaxed); }
+
+  //! Take and reset the counters.
+  Snapshot take(void) {
+    Snapshot s;
+    s.items = m_items.exchange(0, std::memory_order_relaxed);
+    s.dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+    uint64_t latency = m_latency.exchange(0, std::memory_order_relaxed);
+    uint64_t age = m_age.exchange(0, std::memory_order_relaxed);
+    s.latency = s.items ? latency * 1e-6 / s.items : 0.0;
+    s.age = s.items ? age * 1e-6 / s.items : 0.0;
+    return s;
+  }
+
+private:
+  std::atomic<uint64_t> m_items;
+  std::atomic<uint64_t> m_dropped;
+  //! Accumulated processing time (us).
+  std::atomic<uint64_t> m_latency;
+  //! Accumulated time since capture (us).
+  std::atomic<uint64_t> m_age;
+};
+
+//! Thread running one pipeline stage step after step. Errors are sent
+//! to the task as an input error event, which restarts it.
+class Stage : public Concurrency::Thread {
+public:
+  //! Constructor.
+  //! @param[in] task parent task.
+  //! @param[in] step stage step.
+  Stage(Tasks::Task *task, const std::function<void(void)> &step)
+      : m_task(task), m_step(step) {}
+
+private:
+  //! Parent task.
+  Tasks::Task *m_task;
+  //! Stage step.
+  std::function<void(void)> m_step;
+
+  void run(void) {
+    while (!isStopping()) {
+      try {
+        m_step();
+      } catch (std::exception &e) {
+        IMC::IoEvent evt;
+        evt.type = IMC::IoEvent::IOV_TYPE_INPUT_ERROR;
+        evt.error = e.what();
+        evt.setDestination(m_task->getSystemId());
+        evt.setDestinationEntity(m_task->getEntityId());
+        m_task->dispatch(evt, DF_LOOP_BACK);
+        break;
+      }
+    }
+  }
+};
+} // namespace RPiCam
+} // namespace Vision
+
+#endif
@@ -27,10 +27,24 @@
 // Author: Alexandre Rocha                                                  *
 //***************************************************************************
 
+// ISO C++ 11 headers.
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
 // DUNE headers.
 #include <DUNE/DUNE.hpp>
 
+#include "../../Sensors/Common/SampleRing.hpp"
 #include "Calib.hpp"
+#include "CircleDetector.hpp"
+#include "DropQueue.hpp"
+#include "ImageSequence.hpp"
+#include "RedMask.hpp"
+#include "Stage.hpp"
+#include "Tracker.hpp"
+#include "V4L2Capture.hpp"
 #include <cmath>
 #include <cstring>
 
@@ -42,38 +56,132 @@ namespace Vision {
 using DUNE_NAMESPACES;
 
 namespace RPiCam {
+//! Frames queued between two stages
+static const unsigned c_queue_size = 2;
+//! Frames in flight: both queues full, one in each stage and a spare
+static const unsigned c_jobs = 2 * c_queue_size + 4;
+//! Longest a stage waits for work before checking whether to stop (s)
+static const double c_stage_wait = 0.1;
+
 struct Arguments {
   //! Maneuver-is-over threshold distance
   double finish_dist;
+  //! Capture backend
+  std::string backend;
+  //! Video device
+  std::string device;
+  //! Number of V4L2 capture buffers
+  unsigned buffers;
+  //! Replay frame rate
+  double replay_rate;
+  //! Replay in a loop
+  bool replay_loop;
+  //! Tracking window side in target diameters
+  double track_scale;
+  //! Frames without detections before searching the whole frame
+  unsigned track_misses;
+  //! Preprocessing threads
+  unsigned threads;
+  //! Pipeline statistics period
+  double stats_period;
+  //! Camera matrix
+  std::vector<double> camera;
+  //! Distortion coefficients
+  std::vector<double> distortion;
+  //! Valid region of the undistorted frame
+  std::vector<int> valid_region;
+  //! Undistortion map cache directory
+  std::string map_cache;
+  //! Docking target diameter
+  double target_diameter;
+};
+
+//! Frame going through the pipeline
+struct Job {
+  //! Captured V4L2 frame, holding a driver buffer until preprocessed
+  V4L2Capture::Frame frame;
+  //! Captured frame, when it cannot be used in place
+  cv::Mat raw;
+  //! Undistorted frame window being searched
+  cv::Rect window;
+  //! Colour mask of the window being searched
+  cv::Mat mask;
+  //! Capture time
+  double tstamp = 0;
+  //! True while in the pipeline
+  std::atomic<bool> busy{false};
 };
 
 struct Task : public DUNE::Tasks::Task {
 
   //! LiDAR frontal distance measurement
   double frontal_dist;
+  //! LiDAR closing speed
+  double closing_speed = 0;
+  //! LiDAR time to contact (negative if not approaching)
+  double time_to_contact = -1;
+  //! Position in the LiDAR range stream
+  Sensors::Common::SampleRing::Cursor range_cursor;
   //! FL_NEAR flag is activated in Path Control State message
   bool target_near = 0;
-  //! Capture RPiCam video
+  //! Capture RPiCam video through OpenCV
   cv::VideoCapture cap;
+  //! Capture RPiCam video through V4L2 buffers
+  V4L2Capture v4l2;
+  //! Replayed images
+  ImageSequence images;
+  //! True if replaying recorded frames
+  bool replay = false;
+  //! Time of the next replayed frame
+  double replay_tstamp = 0;
   //! Capture width
   int width = 640;
   //! Capture height
   int height = 480;
-  //! Video frame
-  cv::Mat cap_frame;
-  //! Undistortion map 1
-  cv::Mat map_1;
-  //! Undistortion map 2
-  cv::Mat map_2;
+  //! Undistorted frame size
+  cv::Size frame_size;
+  //! Undistortion maps
+  UndistortionMaps maps;
+  //! Fused undistortion and colour threshold
+  RedMask red_mask;
+  //! Target motion prediction
+  Tracker tracker;
+  //! Tracker lock, shared by preprocessing and detection
+  Concurrency::Mutex tracker_lock;
   //! Filter structuring element
   cv::Mat kernel;
   //! Circle detection parameters
   cv::SimpleBlobDetector::Params params;
   //! Blob algorithm detector object
-  cv::Ptr<cv::SimpleBlobDetector> detector;
+  CircleDetector detector;
   //! Detected circles centers vector
   std::vector<cv::KeyPoint> keypoints;
 
+  //! Frames in flight
+  Job jobs[c_jobs];
+  //! Guards the capture stage waiting for a free job
+  std::mutex jobs_lock;
+  //! Signalled when a job is recycled
+  std::condition_variable jobs_freed;
+  //! Captured frames
+  DropQueue<Job, c_queue_size> captured;
+  //! Preprocessed frames
+  DropQueue<Job, c_queue_size> preprocessed;
+  //! Capture thread
+  Stage *capture_stage = NULL;
+  //! Preprocessing thread
+  Stage *preprocess_stage = NULL;
+  //! Detection thread
+  Stage *detect_stage = NULL;
+  //! Capture statistics
+  StageStats capture_stats;
+  //! Preprocessing statistics
+  StageStats preprocess_stats;
+  //! Detection statistics
+  StageStats detect_stats;
+  //! Time of the last statistics report
+  double stats_tstamp = 0;
+
   //! Deviation from center in x-axis
   double delta_x;
   //! Heading reference to aim
@@ -95,13 +203,112 @@ struct Task : public DUNE::Tasks::Task {
         .description(
             "Distance used as reference to confirm docking manouver success");
 
-    bind<IMC::Distance>(this);
+    param("Capture Backend", m_args.backend)
+        .defaultValue("V4L2")
+        .values("V4L2, OpenCV, Replay")
+        .description("V4L2 processes frames in the driver buffers. OpenCV "
+                     "copies them. Replay reads recorded frames");
+
+    param("Video Device", m_args.device)
+        .defaultValue("/dev/video0")
+        .description("Video device. When replaying, a video file or a "
+                     "directory of images, read in file name order");
+
+    param("Capture Buffers", m_args.buffers)
+        .defaultValue("6")
+        .minimumValue("4")
+        .maximumValue("32")
+        .description("Number of V4L2 buffers queued for capture. Up to "
+                     "four are held by the pipeline");
+
+    param("Replay Frame Rate", m_args.replay_rate)
+        .defaultValue("30")
+        .minimumValue("0")
+        .units(Units::Hertz)
+        .description("Rate at which recorded frames are replayed. If zero, "
+                     "frames are replayed as fast as they are captured");
+
+    param("Replay Loop", m_args.replay_loop)
+        .defaultValue("false")
+        .description("Start over after the last recorded frame");
+
+    param("Tracking Window Scale", m_args.track_scale)
+        .defaultValue("3.0")
+        .minimumValue("1.5")
+        .description("Once the target is found, only a window this many "
+                     "target diameters wide around its predicted position "
+                     "is searched");
+
+    param("Tracking Misses", m_args.track_misses)
+        .defaultValue("5")
+        .minimumValue("1")
+        .description("Consecutive frames without detections before the "
+                     "whole frame is searched again");
+
+    param("Preprocessing Threads", m_args.threads)
+        .defaultValue("3")
+        .minimumValue("1")
+        .maximumValue("8")
+        .description("Each frame is split in this many horizontal bands "
+                     "preprocessed in parallel");
+
+    param("Statistics Period", m_args.stats_period)
+        .defaultValue("10")
+        .minimumValue("1")
+        .units(Units::Second)
+        .description("Period of the pipeline throughput and latency "
+                     "report");
+
+    param("Camera Matrix", m_args.camera)
+        .defaultValue("681.9474487304688, 0, 279.387553359592862, "
+                      "0, 679.4100341796875, 240.90015807337113, "
+                      "0, 0, 1")
+        .size(9)
+        .description("Camera intrinsic parameters, row-major");
+
+    param("Distortion Coefficients", m_args.distortion)
+        .defaultValue("-0.4624503562479969, -0.43432558990654135, "
+                      "0.001974482671297278, -0.008023538703377298, "
+                      "2.9986277588121113")
+        .size(5)
+        .description("Lens distortion coefficients k1, k2, p1, p2, k3");
+
+    param("Valid Region", m_args.valid_region)
+        .defaultValue("7, 13, 623, 453")
+        .size(4)
+        .description("Region of the undistorted frame with valid pixels: "
+                     "x, y, width and height");
+
+    param("Target Diameter", m_args.target_diameter)
+        .defaultValue("0.3")
+        .minimumValue("0.01")
+        .units(Units::Meter)
+        .description("Diameter of the docking target, used to estimate its "
+                     "range from its apparent size");
+
+    param("Undistortion Map Cache", m_args.map_cache)
+        .defaultValue("/var/tmp")
+        .description("Directory where undistortion maps are cached");
+
+    range_cursor =
+        Sensors::Common::SampleRing::get(Sensors::Common::SS_RANGE).cursor();
+
+    bind<IMC::IoEvent>(this);
   }
 
-  void consume(const IMC::Distance *msg) {
-
-    frontal_dist = msg->value;
-    inf("debug - lidar measurement: %f", frontal_dist);
+  //! Update the frontal distance with the newest filtered LiDAR range
+  void readRange(void) {
+    Sensors::Common::Sample sample;
+
+    if (Sensors::Common::SampleRing::get(Sensors::Common::SS_RANGE)
+            .readLatest(range_cursor, sample)
+        && sample.value[3] >= 0) {
+      frontal_dist = sample.value[3];
+      closing_speed = sample.value[4];
+      time_to_contact = sample.value[5];
+      debug("lidar range: %f, closing speed: %f, time to contact: %f",
+            frontal_dist, closing_speed, time_to_contact);
+    }
   }
 
   void consume(const IMC::PathControlState *msg) {
@@ -111,8 +318,40 @@ struct Task : public DUNE::Tasks::Task {
       target_near = false;
   }
 
+  //! Restart on pipeline errors
+  void consume(const IMC::IoEvent *msg) {
+    if (msg->getDestination() != getSystemId())
+      return;
+
+    if (msg->getDestinationEntity() != getEntityId())
+      return;
+
+    if (msg->type == IMC::IoEvent::IOV_TYPE_INPUT_ERROR)
+      throw RestartNeeded(msg->error, 5);
+  }
+
   //! Update internal state with new parameter values.
-  void onUpdateParameters(void) {}
+  void onUpdateParameters(void) {
+    if (frame_size.area() > 0) {
+      Concurrency::ScopedMutex l(tracker_lock);
+      setupTracker();
+    }
+
+    if (capture_stage != NULL && paramChanged(m_args.threads))
+      throw RestartNeeded(DTR("pipeline configuration changed"), 0);
+
+    if (capture_stage != NULL
+        && (paramChanged(m_args.camera) || paramChanged(m_args.distortion)))
+      throw RestartNeeded(DTR("calibration changed"), 0);
+  }
+
+  //! Configure target tracking over the valid undistorted region
+  void setupTracker(void) {
+    cv::Rect valid(m_args.valid_region[0], m_args.valid_region[1],
+                   m_args.valid_region[2], m_args.valid_region[3]);
+    tracker.configure(valid & cv::Rect(cv::Point(0, 0), frame_size),
+                      m_args.track_scale, m_args.track_misses);
+  }
 
   //! Reserve entity identifiers.
   void onEntityReservation(void) {}
@@ -122,12 +361,29 @@ struct Task : public DUNE::Tasks::Task {
 
   //! Acquire resources.
   void onResourceAcquisition(void) {
+    if (m_args.backend == "V4L2") {
+      try {
+        v4l2.open(m_args.device, width, height, m_args.buffers);
+      } catch (std::exception &e) {
+        inf("Unable to open camera: %s", e.what());
+        return;
+      }
+    } else if (m_args.backend == "Replay") {
+      replay = true;
+      if (!images.open(m_args.device))
+        cap.open(m_args.device, cv::CAP_ANY);
+
+      if (!images.isOpened() && !cap.isOpened()) {
+        inf("Unable to open recording %s", m_args.device.c_str());
+        return;
+      }
+    } else {
+      cap.open(m_args.device, cv::CAP_ANY);
 
-    cap.open(0, cv::CAP_V4L2);
-
-    if (!cap.isOpened()) {
-      inf("Unable to open camera");
-      return;
+      if (!cap.isOpened()) {
+        inf("Unable to open camera");
+        return;
+      }
     }
 
     setEntityState(IMC::EntityState::ESTA_NORMAL, Status::CODE_ACTIVE);
@@ -135,10 +391,25 @@ struct Task : public DUNE::Tasks::Task {
 
   //! Initialize resources.
   void onResourceInitialization(void) {
-    cap.set(cv::CAP_PROP_FRAME_WIDTH, width);
-    cap.set(cv::CAP_PROP_FRAME_HEIGHT, height);
+    cv::Size size;
+
+    if (v4l2.isOpened()) {
+      size = v4l2.getSize();
+    } else if (images.isOpened()) {
+      size = images.getSize();
+    } else if (replay) {
+      size = cv::Size(cap.get(cv::CAP_PROP_FRAME_WIDTH),
+                      cap.get(cv::CAP_PROP_FRAME_HEIGHT));
+    } else {
+      cap.set(cv::CAP_PROP_FRAME_WIDTH, width);
+      cap.set(cv::CAP_PROP_FRAME_HEIGHT, height);
+      size = cv::Size(cap.get(cv::CAP_PROP_FRAME_WIDTH),
+                      cap.get(cv::CAP_PROP_FRAME_HEIGHT));
+    }
 
-    undistortionMaps(map_1, map_2, cap);
+    setupMaps(size);
+    frame_size = size;
+    setupTracker();
 
     kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(11, 11));
 
@@ -156,49 +427,349 @@ struct Task : public DUNE::Tasks::Task {
     params.filterByInertia = true;
     params.minInertiaRatio = 0.01;
 
-    detector = cv::SimpleBlobDetector::create(params);
+    detector.setParams(params);
+
+    if (v4l2.isOpened() || cap.isOpened() || images.isOpened())
+      startPipeline();
+  }
+
+  //! Load the undistortion maps from the cache, or compute and cache them
+  void setupMaps(cv::Size size) {
+    std::string file = UndistortionMaps::path(
+        m_args.map_cache, m_args.camera, m_args.distortion, size);
+
+    if (maps.load(file, size)) {
+      debug("undistortion maps loaded from %s", file.c_str());
+    } else {
+      maps.compute(m_args.camera, m_args.distortion, size);
+      if (maps.store(file))
+        debug("undistortion maps cached in %s", file.c_str());
+      else
+        war("unable to cache undistortion maps in %s", file.c_str());
+    }
+
+    red_mask.setMaps(maps.getMap1(), maps.getMap2(), size);
   }
 
   //! Release resources.
-  void onResourceRelease(void) { cap.release(); }
+  void onResourceRelease(void) {
+    stopPipeline();
+    v4l2.close();
+    cap.release();
+    images.close();
+    replay = false;
+  }
 
-  //! Red Circle Detection
-  double redCircleDetection(void) {
+  //! Start the pipeline threads
+  void startPipeline(void) {
+    cv::setNumThreads(m_args.threads);
+
+    capture_stage = new Stage(this, [this] { captureStep(); });
+    preprocess_stage = new Stage(this, [this] { preprocessStep(); });
+    detect_stage = new Stage(this, [this] { detectStep(); });
+
+    detect_stage->start();
+    preprocess_stage->start();
+    capture_stage->start();
+  }
+
+  //! Stop the pipeline threads and drop the frames in flight
+  void stopPipeline(void) {
+    Stage *stages[] = {capture_stage, preprocess_stage, detect_stage};
+    for (Stage *stage : stages) {
+      if (stage != NULL)
+        stage->stopAndJoin();
+    }
+
+    Memory::clear(capture_stage);
+    Memory::clear(preprocess_stage);
+    Memory::clear(detect_stage);
+
+    while (captured.pop() != NULL)
+      ;
+    while (preprocessed.pop() != NULL)
+      ;
+    for (Job &job : jobs) {
+      job.frame = V4L2Capture::Frame();
+      job.busy = false;
+    }
+  }
+
+  //! Take a free job, waiting for one to be recycled if there is none
+  Job *acquireJob(void) {
+    Job *job = takeJob();
+    if (job != NULL)
+      return job;
+
+    std::unique_lock<std::mutex> l(jobs_lock);
+    jobs_freed.wait_for(l, std::chrono::duration<double>(c_stage_wait),
+                        [this, &job] { return (job = takeJob()) != NULL; });
+    return job;
+  }
+
+  //! Take a free job, if any
+  Job *takeJob(void) {
+    for (Job &job : jobs) {
+      bool expected = false;
+      if (job.busy.compare_exchange_strong(expected, true))
+        return &job;
+    }
+
+    return NULL;
+  }
+
+  //! Give a job back, along with its driver buffer
+  void recycle(Job *job) {
+    v4l2.release(job->frame);
+    job->busy.store(false, std::memory_order_release);
+
+    {
+      std::lock_guard<std::mutex> l(jobs_lock);
+    }
+    jobs_freed.notify_one();
+  }
+
+  //! Capture a frame. V4L2 frames stay in the driver buffer.
+  bool grab(Job &job) {
+    if (v4l2.isOpened()) {
+      if (!v4l2.grab(job.frame, 1.0))
+        return false;
+
+      // Fall back to the dequeue time when the driver timestamp is not
+      // on our clock.
+      job.tstamp = job.frame.monotonic ? job.frame.tstamp : Clock::get();
+      return true;
+    }
+
+    if (replay)
+      return replayFrame(job);
+
+    if (!cap.read(job.raw)) {
+      Time::Delay::wait(0.1);
+      return false;
+    }
+
+    job.tstamp = Clock::get();
+    return true;
+  }
+
+  //! Read a recorded frame, paced at the replay frame rate
+  bool replayFrame(Job &job) {
+    if (m_args.replay_rate > 0) {
+      double now = Clock::get();
+      if (replay_tstamp > now)
+        Time::Delay::wait(replay_tstamp - now);
+      replay_tstamp = std::max(replay_tstamp, now) + 1.0 / m_args.replay_rate;
+    }
+
+    bool ok = images.isOpened() ? images.read(job.raw) : cap.read(job.raw);
+    if (!ok) {
+      if (!m_args.replay_loop) {
+        Time::Delay::wait(0.1);
+        return false;
+      }
 
-    cap.read(cap_frame);
+      debug("replay finished, starting over");
+      if (images.isOpened())
+        images.rewind();
+      else
+        cap.set(cv::CAP_PROP_POS_FRAMES, 0);
+      return false;
+    }
 
-    cv::remap(cap_frame, cap_frame, map_1, map_2, cv::INTER_LINEAR);
-    // Color Detection
-    cv::cvtColor(cap_frame, cap_frame, cv::COLOR_BGR2HSV);
-    cv::inRange(cap_frame, cv::Scalar(10, 0, 0), cv::Scalar(170, 255, 255),
-                cap_frame);
+    job.tstamp = Clock::get();
+    return true;
+  }
+
+  //! Capture stage step
+  void captureStep(void) {
+    Job *job = acquireJob();
+    if (job == NULL) {
+      capture_stats.drop();
+      return;
+    }
+
+    if (!grab(*job)) {
+      recycle(job);
+      return;
+    }
+
+    double age = Clock::get() - job->tstamp;
+    capture_stats.add(age, age);
+
+    Job *evicted = captured.push(job);
+    if (evicted != NULL) {
+      recycle(evicted);
+      preprocess_stats.drop();
+    }
+  }
+
+  //! Preprocessing stage step: colour mask of the search window, computed
+  //! in bands, followed by the morphologic operations
+  void preprocessStep(void) {
+    Job *job = captured.pop(c_stage_wait);
+    if (job == NULL)
+      return;
+
+    double start = Clock::get();
+    const cv::Mat *src = &job->raw;
+    if (job->frame.index >= 0) {
+      if (job->frame.image.type() == CV_8UC2) {
+        cv::cvtColor(job->frame.image, job->raw, cv::COLOR_YUV2BGR_YUYV);
+        v4l2.release(job->frame);
+      } else {
+        src = &job->frame.image;
+      }
+    }
+
+    {
+      Concurrency::ScopedMutex l(tracker_lock);
+      job->window = tracker.getWindow(job->tstamp);
+    }
+
+    red_mask.prepare(*src, job->mask, job->window);
+    int bands = m_args.threads;
+    int rows = job->mask.rows;
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range &range) {
+      for (int b = range.start; b < range.end; ++b)
+        red_mask.applyRows(*src, job->mask, job->window, rows * b / bands,
+                           rows * (b + 1) / bands);
+    });
+    v4l2.release(job->frame);
 
     // Morphologic operations
-    cv::GaussianBlur(cap_frame, cap_frame, cv::Size(13, 13), 3);
-    cv::morphologyEx(cap_frame, cap_frame, cv::MORPH_CLOSE, kernel);
+    cv::GaussianBlur(job->mask, job->mask, cv::Size(13, 13), 3);
+    cv::morphologyEx(job->mask, job->mask, cv::MORPH_CLOSE, kernel);
+
+    double now = Clock::get();
+    preprocess_stats.add(now - start, now - job->tstamp);
+
+    Job *evicted = preprocessed.push(job);
+    if (evicted != NULL) {
+      recycle(evicted);
+      detect_stats.drop();
+    }
+  }
+
+  //! Detection stage step
+  void detectStep(void) {
+    Job *job = preprocessed.pop(c_stage_wait);
+    if (job == NULL)
+      return;
+
+    double start = Clock::get();
+    redCircleDetection(*job);
+
+    double now = Clock::get();
+    detect_stats.add(now - start, now - job->tstamp);
+    recycle(job);
+  }
+
+  //! Red Circle Detection
+  double redCircleDetection(Job &job) {
 
-    // Detect circles
-    detector->detect(cap_frame, keypoints);
+    // Detect circles, best candidate first
+    detector.detect(job.mask, keypoints);
 
-    for (auto blob_iterator : keypoints) {
+    cv::KeyPoint *target = NULL;
+    if (!keypoints.empty()) {
+      target = &keypoints.front();
+      // Back to undistorted frame coordinates
+      target->pt += cv::Point2f(job.window.tl());
 
-      delta_x = blob_iterator.pt.x - cap_frame.cols / 2;
+      delta_x = target->pt.x - frame_size.width / 2;
 
-      heading_ref =
-          atan(delta_x / cap_frame.cols * tan(MAX_PICAM_ANGLE * M_PI / 180));
+      heading_ref = atan(delta_x / frame_size.width *
+                         tan(MAX_PICAM_ANGLE * M_PI / 180));
     }
 
-    //    cv::waitKey(2000);
+    publishDetection(job, target);
+
+    Concurrency::ScopedMutex l(tracker_lock);
+    bool tracking = tracker.isTracking();
+    tracker.update(job.tstamp, target);
+    if (tracking != tracker.isTracking())
+      debug(tracking ? "target lost" : "target acquired, tracking");
 
     return heading_ref;
   }
 
+  //! Publish the outcome of a frame to the docking target stream and
+  //! over IMC, stamped with the capture time
+  void publishDetection(const Job &job, const cv::KeyPoint *target) {
+    Sensors::Common::Sample sample;
+    double now = Clock::get();
+    sample.tstamp = Clock::getSinceEpoch() - (now - job.tstamp);
+    sample.value[3] = now - job.tstamp;
+
+    if (target == NULL) {
+      sample.value[0] = 0;
+      sample.value[1] = -1;
+      sample.value[2] = 0;
+      sample.value[4] = 0;
+      sample.value[5] = 0;
+    } else {
+      // Pinhole model: the focal length is the first camera matrix entry
+      sample.value[0] = heading_ref;
+      sample.value[1] =
+          m_args.target_diameter * m_args.camera[0] / target->size;
+      sample.value[2] = target->response;
+      sample.value[4] = target->pt.x;
+      sample.value[5] = target->size;
+    }
+
+    Sensors::Common::SampleRing::get(Sensors::Common::SS_TARGET)
+        .write(sample);
+
+    // IMC has no docking target message: the detection goes out as the
+    // parameters of this entity, so it is not taken for a LiDAR range.
+    IMC::EntityParameters detection;
+    detection.setTimeStamp(sample.tstamp);
+    detection.name = getEntityLabel();
+    addParameter(detection, "Bearing", sample.value[0]);
+    addParameter(detection, "Range", sample.value[1]);
+    addParameter(detection, "Confidence", sample.value[2]);
+    addParameter(detection, "Latency", sample.value[3]);
+    dispatch(detection, DF_KEEP_TIME);
+  }
+
+  //! Append a named value to a detection message
+  static void addParameter(IMC::EntityParameters &msg, const char *name,
+                           float value) {
+    IMC::EntityParameter param;
+    param.name = name;
+    param.value = String::str("%g", value);
+    msg.params.push_back(param);
+  }
+
+  //! Report pipeline throughput and latency
+  void reportStats(void) {
+    double now = Clock::get();
+    double period = now - stats_tstamp;
+    stats_tstamp = now;
+    StageStats::Snapshot c = capture_stats.take();
+    StageStats::Snapshot p = preprocess_stats.take();
+    StageStats::Snapshot d = detect_stats.take();
+
+    debug("capture: %.1f fps, %.1f ms from sensor",
+          c.items / period, c.latency * 1000);
+    debug("preprocess: %.1f fps, %.1f ms, %u dropped", p.items / period,
+          p.latency * 1000, (unsigned)p.dropped);
+    debug("detect: %.1f fps, %.1f ms, %u dropped, %.1f ms end to end",
+          d.items / period, d.latency * 1000, (unsigned)d.dropped,
+          d.age * 1000);
+  }
+
   //! Main loop.
   void onMain(void) {
+    stats_tstamp = Clock::get();
 
     while (!stopping()) {
+      waitForMessages(1.0);
+      readRange();
 
-      redCircleDetection();
+      if (Clock::get() - stats_tstamp >= m_args.stats_period)
+        reportStats();
 
       if (isActive()) {
 
@@ -207,8 +778,6 @@ struct Task : public DUNE::Tasks::Task {
           // do something...
         }
       }
-
-      waitForMessages(1.0);
     }
   }
 };
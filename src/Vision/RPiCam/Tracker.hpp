@@ -0,0 +1,142 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Alexandre Rocha                                                  *
+//***************************************************************************
+
+#ifndef VISION_RPICAM_TRACKER_HPP_INCLUDED_
+#define VISION_RPICAM_TRACKER_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <algorithm>
+
+#include <opencv2/core.hpp>
+
+namespace Vision {
+namespace RPiCam {
+//! Predicts where the target will be in the next frame, so that only a
+//! window around it needs to be searched. The target is assumed to move
+//! at constant velocity in the image. After a number of frames without
+//! detections the window falls back to the whole search area.
+class Tracker {
+public:
+  //! Smallest window side (px).
+  static const int c_min_window = 64;
+
+  Tracker(void) : m_scale(3.0), m_max_misses(5) { reset(); }
+
+  //! Configure the tracker.
+  //! @param[in] bounds search area.
+  //! @param[in] scale window side in target diameters.
+  //! @param[in] max_misses frames without detections before searching
+  //! the whole area again.
+  void configure(const cv::Rect &bounds, double scale, unsigned max_misses) {
+    m_bounds = bounds;
+    m_scale = scale;
+    m_max_misses = max_misses;
+    reset();
+  }
+
+  //! Forget the target.
+  void reset(void) {
+    m_tracking = false;
+    m_misses = 0;
+    m_tstamp = 0.0;
+    m_size = 0.0f;
+    m_position = cv::Point2f(0, 0);
+    m_velocity = cv::Point2f(0, 0);
+  }
+
+  //! Check if the target is being tracked.
+  bool isTracking(void) const { return m_tracking; }
+
+  //! Window to search for the target.
+  //! @param[in] tstamp frame capture time (s).
+  //! @return predicted window, or the whole search area.
+  cv::Rect getWindow(double tstamp) const {
+    if (!m_tracking)
+      return m_bounds;
+
+    cv::Point2f center = m_position + m_velocity * (float)(tstamp - m_tstamp);
+    int side = std::max((int)(m_scale * m_size), c_min_window);
+    cv::Rect window(cv::Point((int)center.x - side / 2,
+                              (int)center.y - side / 2),
+                    cv::Size(side, side));
+    window &= m_bounds;
+    if (window.area() == 0)
+      return m_bounds;
+    return window;
+  }
+
+  //! Update with the outcome of a search.
+  //! @param[in] tstamp frame capture time (s).
+  //! @param[in] target detected target in frame coordinates, or NULL.
+  void update(double tstamp, const cv::KeyPoint *target) {
+    if (target == NULL) {
+      if (m_tracking && ++m_misses >= m_max_misses)
+        reset();
+      return;
+    }
+
+    double dt = tstamp - m_tstamp;
+    if (m_tracking && dt > 0) {
+      cv::Point2f velocity = (target->pt - m_position) * (float)(1.0 / dt);
+      m_velocity = (m_velocity + velocity) * 0.5f;
+    } else {
+      m_velocity = cv::Point2f(0, 0);
+    }
+
+    m_tracking = true;
+    m_misses = 0;
+    m_tstamp = tstamp;
+    m_position = target->pt;
+    m_size = target->size;
+  }
+
+private:
+  //! Search area.
+  cv::Rect m_bounds;
+  //! Window side in target diameters.
+  double m_scale;
+  //! Frames without detections before giving up.
+  unsigned m_max_misses;
+  //! True if the target is being tracked.
+  bool m_tracking;
+  //! Consecutive frames without detections.
+  unsigned m_misses;
+  //! Time of the last detection.
+  double m_tstamp;
+  //! Last target diameter (px).
+  float m_size;
+  //! Last target position (px).
+  cv::Point2f m_position;
+  //! Target velocity (px/s).
+  cv::Point2f m_velocity;
+};
+} // namespace RPiCam
+} // namespace Vision
+
+#endif
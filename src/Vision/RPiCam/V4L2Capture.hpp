@@ -0,0 +1,319 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Alexandre Rocha                                                  *
+//***************************************************************************
+
+#ifndef VISION_RPICAM_V4L2_CAPTURE_HPP_INCLUDED_
+#define VISION_RPICAM_V4L2_CAPTURE_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// POSIX headers.
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Linux headers.
+#include <linux/videodev2.h>
+
+#include <opencv2/core.hpp>
+
+namespace Vision {
+namespace RPiCam {
+//! Video4Linux2 streaming capture. Frames are captured into a ring of
+//! driver buffers mapped in our address space and handed out as cv::Mat
+//! headers over those buffers, so no pixel is copied on the way in. A
+//! frame must be given back with release() once processing is done, so
+//! that the driver can fill its buffer again. Buffers can also be
+//! exported as DMABUF descriptors to share them with other devices.
+class V4L2Capture {
+public:
+  //! Captured frame.
+  struct Frame {
+    Frame(void) : index(-1), sequence(0), tstamp(0), monotonic(false) {}
+
+    //! Image header over the driver buffer.
+    cv::Mat image;
+    //! Driver buffer index.
+    int index;
+    //! Driver frame sequence number.
+    uint32_t sequence;
+    //! Driver capture time (s).
+    double tstamp;
+    //! True if tstamp is on the monotonic clock. Some drivers stamp
+    //! buffers with another clock, or not at all.
+    bool monotonic;
+  };
+
+  V4L2Capture(void) : m_fd(-1), m_streaming(false) {}
+
+  ~V4L2Capture(void) { close(); }
+
+  //! Open a device and start streaming. BGR24 is requested, which makes
+  //! frames CV_8UC3 images; drivers that only offer YUYV produce CV_8UC2
+  //! images instead.
+  //! @param[in] device device path.
+  //! @param[in] width requested frame width.
+  //! @param[in] height requested frame height.
+  //! @param[in] buffers number of driver buffers.
+  void open(const std::string &device, unsigned width, unsigned height,
+            unsigned buffers) {
+    close();
+
+    m_fd = ::open(device.c_str(), O_RDWR | O_NONBLOCK);
+    if (m_fd < 0)
+      fail("unable to open " + device);
+
+    try {
+      start(device, width, height, buffers);
+    } catch (...) {
+      close();
+      throw;
+    }
+  }
+
+  //! Stop streaming and release all buffers. Frames still held become
+  //! invalid, so this must only be called once no thread uses them.
+  void close(void) {
+    if (m_fd < 0)
+      return;
+
+    if (m_streaming) {
+      v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      xioctl(VIDIOC_STREAMOFF, &type);
+      m_streaming = false;
+    }
+
+    for (unsigned i = 0; i < m_buffers.size(); ++i) {
+      if (m_buffers[i].start != NULL)
+        ::munmap(m_buffers[i].start, m_buffers[i].length);
+    }
+    m_buffers.clear();
+
+    ::close(m_fd);
+    m_fd = -1;
+  }
+
+  //! Check if the device is streaming.
+  bool isOpened(void) const { return m_streaming; }
+
+  //! Frame size.
+  cv::Size getSize(void) const {
+    return cv::Size(m_format.width, m_format.height);
+  }
+
+  //! Negotiated V4L2 pixel format.
+  uint32_t getPixelFormat(void) const { return m_format.pixelformat; }
+
+  //! Number of driver buffers, which may differ from the number requested.
+  unsigned getBufferCount(void) const { return m_buffers.size(); }
+
+  //! Wait for the next frame.
+  //! @param[out] frame captured frame.
+  //! @param[in] timeout maximum wait time (s).
+  //! @return true if a frame was captured, false on timeout.
+  bool grab(Frame &frame, double timeout) {
+    pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+    int rv = ::poll(&pfd, 1, (int)(timeout * 1000));
+    if (rv < 0 && errno != EINTR)
+      fail("poll");
+    if (rv <= 0)
+      return false;
+
+    v4l2_buffer buf;
+    initBuffer(buf, 0);
+    if (xioctl(VIDIOC_DQBUF, &buf) < 0) {
+      if (errno == EAGAIN)
+        return false;
+      fail("VIDIOC_DQBUF");
+    }
+
+    int type = (m_format.pixelformat == V4L2_PIX_FMT_BGR24) ? CV_8UC3
+                                                            : CV_8UC2;
+    frame.image = cv::Mat(m_format.height, m_format.width, type,
+                          m_buffers[buf.index].start, m_format.bytesperline);
+    frame.index = buf.index;
+    frame.sequence = buf.sequence;
+    frame.tstamp = buf.timestamp.tv_sec + buf.timestamp.tv_usec * 1e-6;
+    frame.monotonic = (buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK)
+                      == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    return true;
+  }
+
+  //! Give a frame buffer back to the driver. The frame image must not be
+  //! used afterwards.
+  //! @param[in,out] frame captured frame.
+  void release(Frame &frame) {
+    if (frame.index < 0)
+      return;
+
+    frame.image.release();
+    v4l2_buffer buf;
+    initBuffer(buf, frame.index);
+    frame.index = -1;
+    if (xioctl(VIDIOC_QBUF, &buf) < 0)
+      fail("VIDIOC_QBUF");
+  }
+
+  //! Export a driver buffer as a DMABUF descriptor, owned by the caller.
+  //! @param[in] index driver buffer index.
+  //! @return file descriptor.
+  int exportBuffer(unsigned index) {
+    v4l2_exportbuffer exp;
+    std::memset(&exp, 0, sizeof(exp));
+    exp.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    exp.index = index;
+    exp.flags = O_RDONLY | O_CLOEXEC;
+    if (xioctl(VIDIOC_EXPBUF, &exp) < 0)
+      fail("VIDIOC_EXPBUF");
+    return exp.fd;
+  }
+
+private:
+  //! Mapped driver buffer.
+  struct Buffer {
+    void *start;
+    size_t length;
+  };
+
+  //! Device file descriptor.
+  int m_fd;
+  //! True if streaming.
+  bool m_streaming;
+  //! Negotiated format.
+  v4l2_pix_format m_format;
+  //! Mapped buffers.
+  std::vector<Buffer> m_buffers;
+
+  //! Negotiate the format, map the buffers and start streaming.
+  void start(const std::string &device, unsigned width, unsigned height,
+             unsigned buffers) {
+    v4l2_capability cap;
+    std::memset(&cap, 0, sizeof(cap));
+    if (xioctl(VIDIOC_QUERYCAP, &cap) < 0)
+      fail("VIDIOC_QUERYCAP");
+    uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS)
+                        ? cap.device_caps
+                        : cap.capabilities;
+    if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING))
+      throw std::runtime_error(device + " does not support streaming "
+                                        "capture");
+
+    setFormat(width, height, V4L2_PIX_FMT_BGR24);
+    if (m_format.pixelformat != V4L2_PIX_FMT_BGR24) {
+      setFormat(width, height, V4L2_PIX_FMT_YUYV);
+      if (m_format.pixelformat != V4L2_PIX_FMT_YUYV)
+        throw std::runtime_error(device + " supports neither BGR24 nor "
+                                          "YUYV");
+    }
+
+    v4l2_requestbuffers req;
+    std::memset(&req, 0, sizeof(req));
+    req.count = buffers;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(VIDIOC_REQBUFS, &req) < 0)
+      fail("VIDIOC_REQBUFS");
+    if (req.count < 2)
+      throw std::runtime_error(device + ": not enough capture buffers");
+
+    m_buffers.resize(req.count);
+    for (unsigned i = 0; i < req.count; ++i) {
+      v4l2_buffer buf;
+      initBuffer(buf, i);
+      if (xioctl(VIDIOC_QUERYBUF, &buf) < 0)
+        fail("VIDIOC_QUERYBUF");
+
+      m_buffers[i].length = buf.length;
+      m_buffers[i].start = ::mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, m_fd, buf.m.offset);
+      if (m_buffers[i].start == MAP_FAILED) {
+        m_buffers[i].start = NULL;
+        fail("mmap");
+      }
+
+      if (xioctl(VIDIOC_QBUF, &buf) < 0)
+        fail("VIDIOC_QBUF");
+    }
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(VIDIOC_STREAMON, &type) < 0)
+      fail("VIDIOC_STREAMON");
+    m_streaming = true;
+  }
+
+  //! Issue an ioctl, retrying if interrupted.
+  int xioctl(unsigned long request, void *arg) {
+    int rv;
+    do
+      rv = ::ioctl(m_fd, request, arg);
+    while (rv < 0 && errno == EINTR);
+    return rv;
+  }
+
+  //! Prepare a buffer descriptor.
+  void initBuffer(v4l2_buffer &buf, unsigned index) {
+    std::memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+  }
+
+  //! Request a frame format, keeping what the driver agreed to.
+  void setFormat(unsigned width, unsigned height, uint32_t pixel_format) {
+    v4l2_format fmt;
+    std::memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width = width;
+    fmt.fmt.pix.height = height;
+    fmt.fmt.pix.pixelformat = pixel_format;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    if (xioctl(VIDIOC_S_FMT, &fmt) < 0)
+      fail("VIDIOC_S_FMT");
+    m_format = fmt.fmt.pix;
+  }
+
+  //! Report the last error. The device is left open: frames handed out
+  //! may still be in use by other threads, and only the owner knows
+  //! when it is safe to close().
+  void fail(const std::string &what) {
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+  }
+};
+} // namespace RPiCam
+} // namespace Vision
+
+#endif
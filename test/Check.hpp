@@ -0,0 +1,82 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef TEST_CHECK_HPP_INCLUDED_
+#define TEST_CHECK_HPP_INCLUDED_
+
+// ISO C++ 98 headers.
+#include <cstdio>
+
+namespace Test {
+//! Number of failed checks.
+inline unsigned &failures(void) {
+  static unsigned count = 0;
+  return count;
+}
+
+//! Report the outcome of a test program.
+//! @param[in] name program name.
+//! @return process exit status.
+inline int report(const char *name) {
+  if (failures() == 0) {
+    std::printf("%s: all checks passed\n", name);
+    return 0;
+  }
+
+  std::printf("%s: %u checks failed\n", name, failures());
+  return 1;
+}
+} // namespace Test
+
+//! Check a condition, reporting it when false without stopping.
+#define CHECK(cond)                                                          \
+  do {                                                                       \
+    if (!(cond)) {                                                           \
+      std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);   \
+      ++Test::failures();                                                    \
+    }                                                                        \
+  } while (0)
+
+//! Check that a statement throws an exception of the given type.
+#define CHECK_THROWS(stmt, type)                                             \
+  do {                                                                       \
+    bool thrown = false;                                                     \
+    try {                                                                    \
+      stmt;                                                                  \
+    } catch (const type &) {                                                 \
+      thrown = true;                                                         \
+    }                                                                        \
+    if (!thrown) {                                                           \
+      std::printf("%s:%d: %s did not throw %s\n", __FILE__, __LINE__, #stmt, \
+                  #type);                                                    \
+      ++Test::failures();                                                    \
+    }                                                                        \
+  } while (0)
+
+#endif
@@ -0,0 +1,202 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef TEST_FAKE_I2C_ADAPTER_HPP_INCLUDED_
+#define TEST_FAKE_I2C_ADAPTER_HPP_INCLUDED_
+
+// ISO C++ 11 headers.
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+// Local headers.
+#include "../src/Sensors/Common/I2CBus.hpp"
+
+namespace Test {
+//! I2C adapter backed by register maps, one per device address. Writes
+//! set the register pointer and store values, reads return values from
+//! the pointer on, as most register mapped devices do. Transfers are
+//! checked against the rules of the BCM2835 controller and counted.
+class FakeI2CAdapter : public Sensors::Common::I2CAdapter {
+public:
+  //! One combined transfer.
+  struct Transfer {
+    //! Device address.
+    uint16_t address;
+    //! Number of messages.
+    unsigned messages;
+    //! Number of bytes, without device addressing.
+    size_t bytes;
+  };
+
+  FakeI2CAdapter(void)
+      : m_delay(0.0), m_active(false), m_overlaps(0), m_held(false) {}
+
+  //! Make each transfer last some time.
+  //! @param[in] delay transfer duration (s).
+  void setDelay(double delay) { m_delay = delay; }
+
+  //! Block transfers until release() is called.
+  void hold(void) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_held = true;
+  }
+
+  //! Let held transfers go on.
+  void release(void) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_held = false;
+    m_released.notify_all();
+  }
+
+  //! Set a register.
+  void setRegister(uint16_t address, uint8_t reg, uint8_t value) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_registers[address][reg] = value;
+  }
+
+  //! Get a register.
+  uint8_t getRegister(uint16_t address, uint8_t reg) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_registers[address][reg];
+  }
+
+  //! @return transfers performed so far, oldest first.
+  std::vector<Transfer> getTransfers(void) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_transfers;
+  }
+
+  //! Forget the transfers performed so far.
+  void clearTransfers(void) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_transfers.clear();
+  }
+
+  //! @return number of transfers that started while another was running.
+  unsigned getOverlaps(void) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_overlaps;
+  }
+
+  void transfer(struct i2c_msg *msgs, unsigned count) {
+    for (unsigned i = 0; i < count; ++i) {
+      if ((msgs[i].flags & I2C_M_RD) && i != count - 1)
+        throw std::runtime_error("read before the last message");
+      if (!(msgs[i].flags & I2C_M_RD) && msgs[i].len == 0)
+        throw std::runtime_error("empty write");
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_active)
+      ++m_overlaps;
+    m_active = true;
+
+    Transfer t = {msgs[0].addr, count, 0};
+    for (unsigned i = 0; i < count; ++i) {
+      t.bytes += msgs[i].len;
+      access(msgs[i]);
+    }
+    m_transfers.push_back(t);
+
+    while (m_held)
+      m_released.wait(lock);
+
+    lock.unlock();
+    if (m_delay > 0)
+      std::this_thread::sleep_for(std::chrono::duration<double>(m_delay));
+    lock.lock();
+    m_active = false;
+  }
+
+protected:
+  //! Called with the adapter lock held when a register is read.
+  virtual uint8_t readRegister(uint16_t address, uint8_t reg) {
+    return m_registers[address][reg];
+  }
+
+  //! Called with the adapter lock held when a register is written.
+  virtual void writeRegister(uint16_t address, uint8_t reg, uint8_t value) {
+    m_registers[address][reg] = value;
+  }
+
+  //! Check if the register pointer moves on after accessing a register.
+  //! Data port registers, such as FIFOs, keep it in place.
+  virtual bool autoIncrement(uint16_t address, uint8_t reg) {
+    (void)address;
+    (void)reg;
+    return true;
+  }
+
+private:
+  //! Registers of each device.
+  std::map<uint16_t, std::map<uint8_t, uint8_t>> m_registers;
+  //! Register pointer of each device.
+  std::map<uint16_t, uint8_t> m_pointer;
+  //! Transfers performed.
+  std::vector<Transfer> m_transfers;
+  //! Transfer duration (s).
+  double m_delay;
+  //! A transfer is running.
+  bool m_active;
+  //! Number of overlapping transfers.
+  unsigned m_overlaps;
+  //! Transfers are held.
+  bool m_held;
+  //! Signalled when transfers are released.
+  std::condition_variable m_released;
+  //! Lock.
+  std::mutex m_mutex;
+
+  void access(const struct i2c_msg &msg) {
+    uint8_t &pointer = m_pointer[msg.addr];
+    if (msg.flags & I2C_M_RD) {
+      for (unsigned i = 0; i < msg.len; ++i) {
+        msg.buf[i] = readRegister(msg.addr, pointer);
+        pointer += autoIncrement(msg.addr, pointer) ? 1 : 0;
+      }
+      return;
+    }
+
+    pointer = msg.buf[0];
+    for (unsigned i = 1; i < msg.len; ++i) {
+      writeRegister(msg.addr, pointer, msg.buf[i]);
+      pointer += autoIncrement(msg.addr, pointer) ? 1 : 0;
+    }
+  }
+};
+} // namespace Test
+
+#endif
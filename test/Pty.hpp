@@ -0,0 +1,131 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef TEST_PTY_HPP_INCLUDED_
+#define TEST_PTY_HPP_INCLUDED_
+
+// ISO C++ 11 headers.
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+
+// POSIX headers.
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace Test {
+//! Pseudo terminal pair in raw mode. The device side stands for the
+//! serial port of a driver, the sensor side for the sensor.
+class Pty {
+public:
+  Pty(void) {
+    m_sensor = ::posix_openpt(O_RDWR | O_NOCTTY);
+    if (m_sensor < 0 || ::grantpt(m_sensor) < 0 || ::unlockpt(m_sensor) < 0)
+      fail("posix_openpt");
+
+    m_path = ::ptsname(m_sensor);
+    m_device = ::open(m_path.c_str(), O_RDWR | O_NOCTTY);
+    if (m_device < 0)
+      fail("open");
+
+    struct termios tio;
+    ::tcgetattr(m_device, &tio);
+    ::cfmakeraw(&tio);
+    ::tcsetattr(m_device, TCSANOW, &tio);
+  }
+
+  ~Pty(void) {
+    ::close(m_device);
+    ::close(m_sensor);
+  }
+
+  //! @return device side path.
+  const std::string &getPath(void) const { return m_path; }
+
+  //! @return device side descriptor.
+  int getDevice(void) const { return m_device; }
+
+  //! @return sensor side descriptor.
+  int getSensor(void) const { return m_sensor; }
+
+  //! Write all bytes.
+  //! @param[in] fd descriptor.
+  //! @param[in] data bytes.
+  //! @param[in] size number of bytes.
+  static void writeAll(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+      ssize_t rv = ::write(fd, data, size);
+      if (rv < 0 && errno == EINTR)
+        continue;
+      if (rv < 0)
+        fail("write");
+      data += rv;
+      size -= rv;
+    }
+  }
+
+  //! Read what is available, waiting for it.
+  //! @param[in] fd descriptor.
+  //! @param[out] data bytes.
+  //! @param[in] size buffer size.
+  //! @param[in] timeout maximum wait (s).
+  //! @return number of bytes read, zero on timeout.
+  static size_t read(int fd, uint8_t *data, size_t size, double timeout) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (::poll(&pfd, 1, (int)(timeout * 1000)) <= 0)
+      return 0;
+
+    ssize_t rv = ::read(fd, data, size);
+    if (rv < 0)
+      fail("read");
+    return rv;
+  }
+
+private:
+  //! Sensor side.
+  int m_sensor;
+  //! Device side.
+  int m_device;
+  //! Device side path.
+  std::string m_path;
+
+  static void fail(const char *what) {
+    throw std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+  }
+};
+} // namespace Test
+
+#endif
@@ -0,0 +1,203 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// Checks the shared I2C bus against a fake adapter: transaction limits,
+// the read-last rule of the BCM2835 controller, arbitration by priority
+// then deadline, and mutual exclusion under load. Build with:
+//   g++ -std=c++11 -O2 -pthread -o i2c_bus test/i2c_bus.cpp
+
+// ISO C++ 11 headers.
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Local headers.
+#include "Check.hpp"
+#include "FakeI2CAdapter.hpp"
+
+using Sensors::Common::I2CAdapter;
+using Sensors::Common::I2CBus;
+using Sensors::Common::I2CDevice;
+using Sensors::Common::I2CTransaction;
+using Test::FakeI2CAdapter;
+
+static FakeI2CAdapter *s_adapter = NULL;
+
+static I2CAdapter *createFake(const std::string &) {
+  s_adapter = new FakeI2CAdapter;
+  return s_adapter;
+}
+
+static void sleep(double seconds) {
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+static void testOpen(void) {
+  std::shared_ptr<I2CBus> a = I2CBus::open("fake-0", &createFake);
+  FakeI2CAdapter *adapter = s_adapter;
+  std::shared_ptr<I2CBus> b = I2CBus::open("fake-0", &createFake);
+  CHECK(a == b);
+  CHECK(s_adapter == adapter);
+
+  std::shared_ptr<I2CBus> c = I2CBus::open("fake-1", &createFake);
+  CHECK(c != a);
+  CHECK(s_adapter != adapter);
+}
+
+static void testTransactions(void) {
+  std::shared_ptr<I2CBus> bus = I2CBus::open("fake-2", &createFake);
+  FakeI2CAdapter &adapter = *s_adapter;
+  I2CDevice dev(bus, 0x68, 0, 0.001);
+
+  // As many writes as allowed, in one transfer.
+  I2CTransaction full;
+  for (unsigned i = 0; i < I2CTransaction::c_max_ops; ++i)
+    full.write((uint8_t)i, (uint8_t)(0x80 + i));
+  CHECK_THROWS(full.write(0x20, 0), std::length_error);
+  CHECK_THROWS(full.read(0x20, NULL, 1), std::length_error);
+  dev.execute(full);
+  std::vector<FakeI2CAdapter::Transfer> t = adapter.getTransfers();
+  CHECK(t.size() == 1);
+  CHECK(t[0].address == 0x68);
+  CHECK(t[0].messages == I2CTransaction::c_max_ops);
+  CHECK(t[0].bytes == 2 * I2CTransaction::c_max_ops);
+  CHECK(adapter.getRegister(0x68, 0x0f) == 0x8f);
+
+  // Writes followed by a single read, in one transfer.
+  adapter.clearTransfers();
+  uint8_t data[4] = {0};
+  I2CTransaction mixed;
+  for (unsigned i = 0; i < I2CTransaction::c_max_ops - 1; ++i)
+    mixed.write((uint8_t)(0x40 + i), (uint8_t)i);
+  mixed.read(0x0c, data, 4);
+  dev.execute(mixed);
+  t = adapter.getTransfers();
+  CHECK(t.size() == 1);
+  CHECK(t[0].messages == I2CTransaction::c_max_ops + 1);
+  CHECK(t[0].bytes == 2 * (I2CTransaction::c_max_ops - 1) + 1 + 4);
+  CHECK(data[0] == 0x8c && data[3] == 0x8f);
+
+  // Nothing may follow a read.
+  I2CTransaction closed;
+  closed.read(0x00, data, 1);
+  CHECK_THROWS(closed.read(0x01, data, 1), std::logic_error);
+  CHECK_THROWS(closed.write(0x01, 0), std::logic_error);
+
+  // Empty transactions do not reach the bus.
+  adapter.clearTransfers();
+  I2CTransaction empty;
+  dev.execute(empty);
+  CHECK(adapter.getTransfers().empty());
+
+  I2CDevice::Stats s = dev.takeStats();
+  CHECK(s.transactions == 2);
+  CHECK(s.bytes == 4 * I2CTransaction::c_max_ops + 3);
+  CHECK(dev.takeStats().transactions == 0);
+}
+
+static void testArbitration(void) {
+  std::shared_ptr<I2CBus> bus = I2CBus::open("fake-3", &createFake);
+  FakeI2CAdapter &adapter = *s_adapter;
+
+  I2CDevice holder(bus, 0x10, 0, 1.0);
+  I2CDevice low(bus, 0x20, 0, 0.001);
+  I2CDevice late(bus, 0x30, 1, 0.5);
+  I2CDevice early(bus, 0x31, 1, 0.1);
+  I2CDevice high(bus, 0x40, 2, 1.0);
+
+  // Hold the bus, queue the others in an order unrelated to the grant
+  // order, then let them go.
+  adapter.hold();
+  std::thread t0([&] { holder.write(0x00, 0); });
+  sleep(0.05);
+  std::thread t1([&] { low.write(0x00, 0); });
+  sleep(0.02);
+  std::thread t2([&] { late.write(0x00, 0); });
+  sleep(0.02);
+  std::thread t3([&] { early.write(0x00, 0); });
+  sleep(0.02);
+  std::thread t4([&] { high.write(0x00, 0); });
+  sleep(0.05);
+  adapter.release();
+  t0.join();
+  t1.join();
+  t2.join();
+  t3.join();
+  t4.join();
+
+  // Highest priority first, then the earliest deadline.
+  std::vector<FakeI2CAdapter::Transfer> t = adapter.getTransfers();
+  CHECK(t.size() == 5);
+  if (t.size() == 5) {
+    CHECK(t[0].address == 0x10);
+    CHECK(t[1].address == 0x40);
+    CHECK(t[2].address == 0x31);
+    CHECK(t[3].address == 0x30);
+    CHECK(t[4].address == 0x20);
+  }
+
+  CHECK(low.takeStats().max_wait > 0.1);
+}
+
+static void testExclusion(void) {
+  std::shared_ptr<I2CBus> bus = I2CBus::open("fake-4", &createFake);
+  FakeI2CAdapter &adapter = *s_adapter;
+  adapter.setDelay(0.0001);
+
+  const unsigned c_threads = 6;
+  const unsigned c_transactions = 1000;
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < c_threads; ++i) {
+    threads.push_back(std::thread([&, i] {
+      I2CDevice dev(bus, (uint8_t)(0x50 + i), i % 2, 0.001 * (i + 1));
+      uint8_t value;
+      for (unsigned j = 0; j < c_transactions; ++j) {
+        dev.write(0x01, (uint8_t)j);
+        value = dev.read(0x01);
+        if (value != (uint8_t)j)
+          ++Test::failures();
+      }
+    }));
+  }
+  for (unsigned i = 0; i < c_threads; ++i)
+    threads[i].join();
+
+  CHECK(adapter.getOverlaps() == 0);
+  CHECK(adapter.getTransfers().size() == 2 * c_threads * c_transactions);
+  CHECK(bus->getBusyTime() > 0);
+}
+
+int main(void) {
+  testOpen();
+  testTransactions();
+  testArbitration();
+  testExclusion();
+  return Test::report("i2c_bus");
+}
@@ -0,0 +1,254 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// Runs the TFmini Plus configuration commands against a sensor emulator
+// on the other side of a pseudo terminal. The emulator keeps streaming
+// data frames while output is enabled, acknowledges supported settings
+// and rejects or ignores the others. Build with:
+//   g++ -std=c++11 -O2 -pthread -o lidar_command test/lidar_command.cpp
+
+// ISO C++ 11 headers.
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// POSIX headers.
+#include <termios.h>
+
+// Local headers.
+#include "../src/Sensors/LiDAR/Command.hpp"
+#include "../src/Sensors/LiDAR/Parser.hpp"
+#include "Check.hpp"
+#include "Pty.hpp"
+
+using namespace Sensors::LiDAR;
+using Test::Pty;
+
+//! TFmini Plus command handling.
+class Emulator {
+public:
+  explicit Emulator(int fd)
+      : rate(100), format(OF_STANDARD_CM), baud(115200), output(true),
+        saved(false), ignored(0), data_frames(0), m_fd(fd), m_stop(false),
+        m_thread([this] { run(); }) {}
+
+  ~Emulator(void) {
+    m_stop = true;
+    m_thread.join();
+  }
+
+  //! Settings, read once the commands were answered.
+  std::atomic<unsigned> rate;
+  std::atomic<unsigned> format;
+  std::atomic<unsigned> baud;
+  std::atomic<bool> output;
+  std::atomic<bool> saved;
+  //! Command left unanswered.
+  std::atomic<unsigned> ignored;
+  //! Data frames sent.
+  std::atomic<unsigned> data_frames;
+
+private:
+  int m_fd;
+  std::atomic<bool> m_stop;
+  std::vector<uint8_t> m_input;
+  std::thread m_thread;
+
+  void run(void) {
+    uint8_t bfr[64];
+    while (!m_stop) {
+      size_t rv = Pty::read(m_fd, bfr, sizeof(bfr), 0.001);
+      m_input.insert(m_input.end(), bfr, bfr + rv);
+      while (decode())
+        ;
+
+      if (output)
+        sendData();
+    }
+  }
+
+  void sendData(void) {
+    uint8_t frame[Parser::c_frame_size] = {
+        Parser::c_header, Parser::c_header, 0x5a, 0x00, 0x5a, 0x04, 0x20,
+        0x08, 0};
+    for (unsigned i = 0; i < Parser::c_frame_size - 1; ++i)
+      frame[8] += frame[i];
+    Pty::writeAll(m_fd, frame, sizeof(frame));
+    ++data_frames;
+  }
+
+  //! Handle the first complete command in the input.
+  //! @return true if input was consumed.
+  bool decode(void) {
+    size_t start = 0;
+    while (start < m_input.size() && m_input[start] != c_command_header)
+      ++start;
+    m_input.erase(m_input.begin(), m_input.begin() + start);
+    if (m_input.size() < 2)
+      return false;
+
+    size_t len = m_input[1];
+    if (len < 4 || len > c_command_max_size) {
+      m_input.erase(m_input.begin());
+      return true;
+    }
+    if (m_input.size() < len)
+      return false;
+
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len - 1; ++i)
+      sum += m_input[i];
+    if (sum == m_input[len - 1])
+      handle(m_input[2], &m_input[3], len - 4);
+    m_input.erase(m_input.begin(), m_input.begin() + len);
+    return true;
+  }
+
+  void handle(uint8_t id, const uint8_t *payload, size_t size) {
+    if (id == ignored)
+      return;
+
+    switch (id) {
+      case CMD_FRAME_RATE: {
+        unsigned value = payload[0] | (payload[1] << 8);
+        if (value <= 1000) {
+          rate = value;
+          reply(id, payload, size);
+        } else {
+          uint8_t current[2] = {(uint8_t)(rate & 0xff), (uint8_t)(rate >> 8)};
+          reply(id, current, 2);
+        }
+        break;
+      }
+      case CMD_OUTPUT_FORMAT:
+        format = payload[0];
+        reply(id, payload, size);
+        break;
+      case CMD_BAUD_RATE:
+        baud = payload[0] | (payload[1] << 8) | (payload[2] << 16)
+               | ((unsigned)payload[3] << 24);
+        reply(id, payload, size);
+        break;
+      case CMD_OUTPUT_ENABLE:
+        output = payload[0] != 0;
+        reply(id, payload, size);
+        break;
+      case CMD_SAVE_SETTINGS: {
+        uint8_t status = 0;
+        saved = true;
+        reply(id, &status, 1);
+        break;
+      }
+    }
+  }
+
+  void reply(uint8_t id, const uint8_t *payload, size_t size) {
+    uint8_t frame[c_command_max_size];
+    size_t len = encodeCommand(id, payload, size, frame);
+    Pty::writeAll(m_fd, frame, len);
+  }
+};
+
+//! Device side of the pseudo terminal, as used by sendCommand().
+struct Port {
+  int fd;
+
+  void flushInput(void) { ::tcflush(fd, TCIFLUSH); }
+
+  void write(const uint8_t *data, size_t size) {
+    Pty::writeAll(fd, data, size);
+  }
+
+  size_t read(uint8_t *data, size_t size, double timeout) {
+    return Pty::read(fd, data, size, timeout);
+  }
+};
+
+int main(void) {
+  Pty pty;
+  Emulator sensor(pty.getSensor());
+  Port port = {pty.getDevice()};
+  uint8_t data[4];
+
+  // Let some data frames through first, as after power up.
+  ::usleep(20000);
+
+  // The configuration sequence of the LiDAR task.
+  data[0] = 0;
+  CHECK(sendCommand(port, CMD_OUTPUT_ENABLE, data, 1, 0.5) == CR_ACCEPTED);
+  CHECK(!sensor.output);
+
+  data[0] = 1000 & 0xff;
+  data[1] = 1000 >> 8;
+  CHECK(sendCommand(port, CMD_FRAME_RATE, data, 2, 0.5) == CR_ACCEPTED);
+  CHECK(sensor.rate == 1000);
+
+  data[0] = OF_STANDARD_MM;
+  CHECK(sendCommand(port, CMD_OUTPUT_FORMAT, data, 1, 0.5) == CR_ACCEPTED);
+  CHECK(sensor.format == OF_STANDARD_MM);
+
+  unsigned baud = 460800;
+  for (unsigned i = 0; i < 4; ++i)
+    data[i] = (baud >> (8 * i)) & 0xff;
+  CHECK(sendCommand(port, CMD_BAUD_RATE, data, 4, 0.5) == CR_ACCEPTED);
+  CHECK(sensor.baud == baud);
+
+  CHECK(sendCommand(port, CMD_SAVE_SETTINGS, NULL, 0, 0.5) == CR_ACCEPTED);
+  CHECK(sensor.saved);
+
+  data[0] = 1;
+  CHECK(sendCommand(port, CMD_OUTPUT_ENABLE, data, 1, 0.5) == CR_ACCEPTED);
+  CHECK(sensor.output);
+
+  // Answered while data frames are streaming.
+  unsigned frames = sensor.data_frames;
+  ::usleep(20000);
+  CHECK(sensor.data_frames > frames);
+  data[0] = 250 & 0xff;
+  data[1] = 250 >> 8;
+  CHECK(sendCommand(port, CMD_FRAME_RATE, data, 2, 0.5) == CR_ACCEPTED);
+  CHECK(sensor.rate == 250);
+
+  // Unsupported rate: the sensor answers with the rate in use.
+  data[0] = 2000 & 0xff;
+  data[1] = 2000 >> 8;
+  CHECK(sendCommand(port, CMD_FRAME_RATE, data, 2, 0.5) == CR_REJECTED);
+  CHECK(sensor.rate == 250);
+
+  // No answer.
+  sensor.ignored = CMD_OUTPUT_FORMAT;
+  data[0] = OF_STANDARD_CM;
+  CHECK(sendCommand(port, CMD_OUTPUT_FORMAT, data, 1, 0.2) == CR_TIMEOUT);
+
+  std::printf("lidar command: %u data frames streamed around the "
+              "commands\n",
+              (unsigned)sensor.data_frames);
+  return Test::report("lidar_command");
+}
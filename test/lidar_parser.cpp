@@ -0,0 +1,185 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// Feeds a synthetic TFmini Plus stream through a pseudo terminal into the
+// frame parser, read in chunks as the LiDAR reader does. The stream mixes
+// valid frames with line noise, stray header bytes and frames with a bad
+// checksum, written in chunks of random size. Checks that every valid
+// frame is decoded once and in order, and that drops are counted.
+// Build with:
+//   g++ -std=c++11 -O2 -pthread -o lidar_parser test/lidar_parser.cpp
+
+// ISO C++ 11 headers.
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// Local headers.
+#include "../src/Sensors/LiDAR/Parser.hpp"
+#include "Check.hpp"
+#include "Pty.hpp"
+
+using Sensors::LiDAR::Frame;
+using Sensors::LiDAR::Parser;
+using Test::Pty;
+
+//! Synthetic TFmini Plus output.
+struct Stream {
+  //! Bytes as sent.
+  std::vector<uint8_t> bytes;
+  //! Valid frames, in order.
+  std::vector<Frame> frames;
+  //! Number of frames with a bad checksum.
+  unsigned bad_frames;
+  //! Number of noise bytes.
+  unsigned noise_bytes;
+
+  explicit Stream(unsigned count) : bad_frames(0), noise_bytes(0) {
+    unsigned seed = 7;
+    for (unsigned i = 0; i < count; ++i) {
+      Frame f;
+      f.distance = (uint16_t)(30 + i % 1200);
+      f.strength = (uint16_t)(100 + i % 900);
+      f.temperature = 20.0f + (i % 16) * 0.125f;
+
+      uint8_t frame[Parser::c_frame_size];
+      encode(f, frame);
+
+      unsigned r = random(seed) % 100;
+      if (r < 3) {
+        // Corrupted in transit.
+        frame[2 + random(seed) % 6] ^= 0x10;
+        ++bad_frames;
+      } else {
+        frames.push_back(f);
+      }
+      bytes.insert(bytes.end(), frame, frame + sizeof(frame));
+
+      if (r >= 95)
+        addNoise(seed);
+    }
+  }
+
+  static unsigned random(unsigned &seed) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xffff;
+  }
+
+  static void encode(const Frame &f, uint8_t *frame) {
+    uint16_t temperature = (uint16_t)((f.temperature + 256.0f) * 8.0f);
+    frame[0] = Parser::c_header;
+    frame[1] = Parser::c_header;
+    frame[2] = f.distance & 0xff;
+    frame[3] = f.distance >> 8;
+    frame[4] = f.strength & 0xff;
+    frame[5] = f.strength >> 8;
+    frame[6] = temperature & 0xff;
+    frame[7] = temperature >> 8;
+    frame[8] = 0;
+    for (unsigned i = 0; i < Parser::c_frame_size - 1; ++i)
+      frame[8] += frame[i];
+  }
+
+  //! Line noise, with lone header bytes but never two in a row, nor one
+  //! right before the next frame.
+  void addNoise(unsigned &seed) {
+    unsigned size = 1 + random(seed) % 20;
+    for (unsigned i = 0; i < size; ++i) {
+      uint8_t byte = (uint8_t)random(seed);
+      bool header = (i % 5 == 2);
+      if (header && i + 1 < size)
+        byte = Parser::c_header;
+      else if (byte == Parser::c_header)
+        byte = 0x00;
+      bytes.push_back(byte);
+    }
+    noise_bytes += size;
+  }
+};
+
+int main(void) {
+  const unsigned c_frames = 20000;
+  Stream stream(c_frames);
+  Pty pty;
+
+  // The sensor writes in chunks of random size.
+  std::thread sensor([&] {
+    unsigned seed = 3;
+    size_t sent = 0;
+    while (sent < stream.bytes.size()) {
+      size_t size = 1 + Stream::random(seed) % 64;
+      if (size > stream.bytes.size() - sent)
+        size = stream.bytes.size() - sent;
+      Pty::writeAll(pty.getSensor(), &stream.bytes[sent], size);
+      sent += size;
+    }
+  });
+
+  // Read like the LiDAR reader: one read of whatever is there, then every
+  // complete frame.
+  Parser parser;
+  std::vector<Frame> frames;
+  unsigned reads = 0;
+  uint8_t bfr[256];
+  size_t received = 0;
+  while (received < stream.bytes.size()) {
+    size_t rv = Pty::read(pty.getDevice(), bfr, sizeof(bfr), 2.0);
+    if (rv == 0)
+      break;
+    ++reads;
+    received += rv;
+    parser.push(bfr, rv);
+
+    Frame f;
+    while (parser.next(f))
+      frames.push_back(f);
+  }
+  sensor.join();
+
+  CHECK(received == stream.bytes.size());
+  CHECK(frames.size() == stream.frames.size());
+  bool same = frames.size() == stream.frames.size();
+  for (size_t i = 0; same && i < frames.size(); ++i) {
+    same = frames[i].distance == stream.frames[i].distance
+           && frames[i].strength == stream.frames[i].strength
+           && frames[i].temperature == stream.frames[i].temperature;
+  }
+  CHECK(same);
+  CHECK(parser.getFrames() == stream.frames.size());
+  CHECK(parser.getBadFrames() == stream.bad_frames);
+  CHECK(parser.getSkippedBytes() == stream.noise_bytes);
+
+  std::printf("lidar: %zu frames, %llu bad, %llu noise bytes, %.2f frames "
+              "per read\n",
+              frames.size(), (unsigned long long)parser.getBadFrames(),
+              (unsigned long long)parser.getSkippedBytes(),
+              (double)frames.size() / reads);
+
+  return Test::report("lidar_parser");
+}
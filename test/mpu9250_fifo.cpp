@@ -0,0 +1,277 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// Runs the MPU-9250 FIFO path against an in-process simulator of the
+// device registers and FIFO. Checks frame decoding and alignment, that no
+// sample is lost or repeated across reads, the rebuilt timestamps and the
+// recovery from overflows. Build with:
+//   g++ -std=c++11 -O2 -pthread -o mpu9250_fifo test/mpu9250_fifo.cpp
+
+// ISO C++ 11 headers.
+#include <cmath>
+#include <cstdio>
+#include <deque>
+
+// Local headers.
+#include "../src/Sensors/MPU9250/Device.hpp"
+#include "Check.hpp"
+#include "FakeI2CAdapter.hpp"
+
+using Sensors::Common::I2CAdapter;
+using Sensors::Common::I2CBus;
+using Sensors::MPU9250::Device;
+using Sensors::MPU9250::FifoClock;
+using Test::FakeI2CAdapter;
+namespace Reg = Sensors::MPU9250;
+
+//! MPU-9250 register map with the FIFO of accelerometer and gyroscope
+//! frames. Sample k reads accelerometer (k, -k, 16384) and gyroscope
+//! (2k, 0, -k).
+class Simulator : public FakeI2CAdapter {
+public:
+  Simulator(void)
+      : m_next(0), m_overflow(false), m_count(0), m_partial_size(0) {
+    setRegister(Device::c_address, Reg::WHO_AM_I, Device::c_who_am_i);
+  }
+
+  //! Sample the sensors.
+  //! @param[in] samples number of samples.
+  void tick(unsigned samples) {
+    for (unsigned i = 0; i < samples; ++i) {
+      uint8_t frame[Device::c_fifo_frame_size];
+      encode(m_next++, frame);
+      push(frame, sizeof(frame));
+    }
+  }
+
+  //! Push the first bytes of the next frame only.
+  //! @param[in] size number of bytes.
+  void tickPartial(size_t size) {
+    encode(m_next, m_partial);
+    push(m_partial, size);
+    m_partial_size = size;
+  }
+
+  //! Push the rest of a partial frame.
+  void completePartial(void) {
+    push(m_partial + m_partial_size,
+         Device::c_fifo_frame_size - m_partial_size);
+    ++m_next;
+  }
+
+  //! @return bytes in the FIFO.
+  size_t getFifoSize(void) { return m_fifo.size(); }
+
+protected:
+  uint8_t readRegister(uint16_t address, uint8_t reg) {
+    switch (reg) {
+      case Reg::INT_STATUS: {
+        // Clear on read.
+        uint8_t status = m_overflow ? 0x10 : 0x00;
+        m_overflow = false;
+        return status;
+      }
+      case Reg::FIFO_COUNTH:
+        m_count = m_fifo.size();
+        return (uint8_t)(m_count >> 8);
+      case Reg::FIFO_COUNTH + 1:
+        return (uint8_t)(m_count & 0xff);
+      case Reg::FIFO_R_W: {
+        if (m_fifo.empty())
+          return 0xff;
+        uint8_t value = m_fifo.front();
+        m_fifo.pop_front();
+        return value;
+      }
+      default:
+        return FakeI2CAdapter::readRegister(address, reg);
+    }
+  }
+
+  void writeRegister(uint16_t address, uint8_t reg, uint8_t value) {
+    if (reg == Reg::USER_CTRL && (value & 0x04))
+      m_fifo.clear();
+    FakeI2CAdapter::writeRegister(address, reg, value & ~0x04);
+  }
+
+  bool autoIncrement(uint16_t, uint8_t reg) { return reg != Reg::FIFO_R_W; }
+
+private:
+  //! FIFO contents.
+  std::deque<uint8_t> m_fifo;
+  //! Index of the next sample.
+  unsigned m_next;
+  //! Overflow interrupt pending.
+  bool m_overflow;
+  //! FIFO count latched when its high byte is read.
+  size_t m_count;
+  //! Frame being pushed in two steps.
+  uint8_t m_partial[Device::c_fifo_frame_size];
+  //! Bytes of the partial frame already pushed.
+  size_t m_partial_size;
+
+  static void encode(unsigned k, uint8_t *frame) {
+    int16_t values[6] = {(int16_t)k, (int16_t)-k, 16384,
+                         (int16_t)(2 * k), 0, (int16_t)-k};
+    for (unsigned i = 0; i < 6; ++i) {
+      frame[2 * i] = (uint8_t)((uint16_t)values[i] >> 8);
+      frame[2 * i + 1] = (uint8_t)((uint16_t)values[i] & 0xff);
+    }
+  }
+
+  void push(const uint8_t *data, size_t size) {
+    // Enabled for accelerometer and gyroscope only.
+    if (!(FakeI2CAdapter::readRegister(Device::c_address, Reg::USER_CTRL)
+          & 0x40)
+        || FakeI2CAdapter::readRegister(Device::c_address, Reg::FIFO_EN)
+               != 0x78)
+      return;
+
+    // The oldest bytes are overwritten.
+    for (size_t i = 0; i < size; ++i) {
+      if (m_fifo.size() == Device::c_fifo_size) {
+        m_fifo.pop_front();
+        m_overflow = true;
+      }
+      m_fifo.push_back(data[i]);
+    }
+  }
+};
+
+static Simulator *s_sim = NULL;
+
+static I2CAdapter *createSimulator(const std::string &) {
+  s_sim = new Simulator;
+  return s_sim;
+}
+
+//! Check that samples are consecutive.
+static bool consecutive(const Device::Sample *samples, int count,
+                        unsigned first) {
+  for (int i = 0; i < count; ++i) {
+    int16_t k = (int16_t)(first + i);
+    const Device::Sample &s = samples[i];
+    if (s.accel[0] != k || s.accel[1] != -k || s.accel[2] != 16384
+        || s.gyro[0] != (int16_t)(2 * k) || s.gyro[1] != 0 || s.gyro[2] != -k)
+      return false;
+  }
+  return true;
+}
+
+int main(void) {
+  std::shared_ptr<I2CBus> bus = I2CBus::open("sim", &createSimulator);
+  Simulator &sim = *s_sim;
+  Device dev(bus, 1, 0.02);
+  Device::Sample samples[Device::c_fifo_frames];
+
+  CHECK(dev.probe());
+  double period = dev.setup(1000);
+  CHECK(period == 0.001);
+
+  // Nothing is queued before the FIFO is enabled.
+  sim.tick(10);
+  CHECK(sim.getFifoSize() == 0);
+  dev.resetFifo();
+  CHECK(dev.readFifo(samples) == 0);
+
+  // One read drains everything, in three transfers.
+  unsigned next = 10;
+  sim.tick(20);
+  sim.clearTransfers();
+  CHECK(dev.readFifo(samples) == 20);
+  CHECK(consecutive(samples, 20, next));
+  CHECK(sim.getTransfers().size() == 3);
+  CHECK(sim.getFifoSize() == 0);
+  next += 20;
+
+  // Partial frames stay in the FIFO for the next read.
+  sim.tick(5);
+  sim.tickPartial(7);
+  CHECK(dev.readFifo(samples) == 5);
+  CHECK(consecutive(samples, 5, next));
+  CHECK(sim.getFifoSize() == 7);
+  next += 5;
+  sim.completePartial();
+  sim.tick(2);
+  CHECK(dev.readFifo(samples) == 3);
+  CHECK(consecutive(samples, 3, next));
+  next += 3;
+
+  // Stream at 1 kHz, read every 20 ms with a varying delay: every sample
+  // is read once, timestamped at its sampling time.
+  FifoClock clock(period);
+  double t0 = 1000.0;
+  unsigned streamed = 0;
+  double max_error = 0;
+  bool ordered = true;
+  double previous = 0;
+  sim.clearTransfers();
+  for (unsigned read = 0; read < 100; ++read) {
+    sim.tick(20);
+    streamed += 20;
+    double delay = 0.0002 * (read % 4);
+    int n = dev.readFifo(samples);
+    CHECK(n == 20);
+    if (n <= 0)
+      continue;
+
+    ordered = ordered && consecutive(samples, n, next);
+    next += n;
+
+    // The newest sample was taken at t0 + (streamed - 1) * period.
+    double first = clock.update(n, t0 + (streamed - 1) * period + delay);
+    for (int i = 0; i < n; ++i) {
+      double tstamp = first + i * period;
+      double truth = t0 + (streamed - n + i) * period;
+      if (std::fabs(tstamp - truth) > max_error)
+        max_error = std::fabs(tstamp - truth);
+      if (streamed > (unsigned)n || i > 0)
+        ordered = ordered && std::fabs(tstamp - previous - period) < 1e-9;
+      previous = tstamp;
+    }
+  }
+  size_t transfers = sim.getTransfers().size();
+  CHECK(ordered);
+  CHECK(max_error < 1e-9);
+  std::printf("fifo: %u samples, %.3f transfers per sample, timestamp "
+              "error %.1f us\n",
+              streamed, (double)transfers / streamed, max_error * 1e6);
+  CHECK(transfers == 300);
+
+  // Overflow: the FIFO is reset and reading resumes.
+  sim.tick(50);
+  CHECK(dev.readFifo(samples) < 0);
+  CHECK(sim.getFifoSize() == 0);
+  next += 50;
+  sim.tick(4);
+  CHECK(dev.readFifo(samples) == 4);
+  CHECK(consecutive(samples, 4, next));
+
+  return Test::report("mpu9250_fifo");
+}
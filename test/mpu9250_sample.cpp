@@ -0,0 +1,142 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// Runs the MPU-9250 sample path against a fake I2C bus. Checks that one
+// accelerometer and gyroscope sample takes a single burst transfer and is
+// decoded correctly, and compares its bus cost with reading the twelve
+// data registers one at a time. Build with:
+//   g++ -std=c++11 -O2 -pthread -o mpu9250_sample test/mpu9250_sample.cpp
+
+// ISO C++ 11 headers.
+#include <cstdio>
+#include <vector>
+
+// Local headers.
+#include "../src/Sensors/MPU9250/Device.hpp"
+#include "Check.hpp"
+#include "FakeI2CAdapter.hpp"
+
+using Sensors::Common::I2CAdapter;
+using Sensors::Common::I2CBus;
+using Sensors::MPU9250::Device;
+using Test::FakeI2CAdapter;
+
+static FakeI2CAdapter *s_adapter = NULL;
+
+static I2CAdapter *createFake(const std::string &) {
+  s_adapter = new FakeI2CAdapter;
+  return s_adapter;
+}
+
+//! Bus time of transfers, counting a start or repeated start per message,
+//! nine clocks per byte including the address and a stop per transfer.
+//! @param[in] transfers transfers.
+//! @param[in] clock bus clock (Hz).
+//! @return bus time (s).
+static double busTime(const std::vector<FakeI2CAdapter::Transfer> &transfers,
+                      double clock) {
+  double bits = 0;
+  for (size_t i = 0; i < transfers.size(); ++i)
+    bits += transfers[i].messages * 10 + transfers[i].bytes * 9 + 1;
+  return bits / clock;
+}
+
+static void report(const char *name,
+                   const std::vector<FakeI2CAdapter::Transfer> &transfers,
+                   unsigned samples) {
+  size_t bytes = 0;
+  for (size_t i = 0; i < transfers.size(); ++i)
+    bytes += transfers[i].bytes;
+
+  std::printf("%-10s %6.1f transfers %6.1f bytes %8.1f us @ 100 kHz "
+              "%8.1f us @ 400 kHz per sample\n",
+              name, (double)transfers.size() / samples,
+              (double)bytes / samples,
+              busTime(transfers, 100e3) * 1e6 / samples,
+              busTime(transfers, 400e3) * 1e6 / samples);
+}
+
+int main(void) {
+  std::shared_ptr<I2CBus> bus = I2CBus::open("fake", &createFake);
+  FakeI2CAdapter &adapter = *s_adapter;
+  Device dev(bus, 1, 0.001);
+
+  // Identity and setup.
+  CHECK(!dev.probe());
+  adapter.setRegister(Device::c_address, Sensors::MPU9250::WHO_AM_I, 0x71);
+  CHECK(dev.probe());
+
+  adapter.clearTransfers();
+  CHECK(dev.setup(250) == 0.004);
+  CHECK(adapter.getRegister(Device::c_address, 0x19) == 3);
+  CHECK(adapter.getRegister(Device::c_address, 0x1a) == 1);
+  CHECK(adapter.getRegister(Device::c_address, 0x1d) == 1);
+  CHECK(adapter.getTransfers().size() == 2);
+  CHECK(dev.setup(1000) == 0.001);
+  CHECK(adapter.getRegister(Device::c_address, 0x19) == 0);
+
+  // Accelerometer 1, -2, 16384; temperature; gyroscope -1, 300, -32768.
+  const uint8_t regs[Device::c_sample_size] = {
+      0x00, 0x01, 0xff, 0xfe, 0x40, 0x00, 0x12, 0x34,
+      0xff, 0xff, 0x01, 0x2c, 0x80, 0x00};
+  for (unsigned i = 0; i < Device::c_sample_size; ++i)
+    adapter.setRegister(Device::c_address, (uint8_t)(0x3b + i), regs[i]);
+
+  const unsigned c_samples = 1000;
+  int16_t accel[3];
+  int16_t gyro[3];
+
+  adapter.clearTransfers();
+  for (unsigned i = 0; i < c_samples; ++i)
+    dev.readSample(accel, gyro);
+  std::vector<FakeI2CAdapter::Transfer> burst = adapter.getTransfers();
+
+  CHECK(accel[0] == 1 && accel[1] == -2 && accel[2] == 16384);
+  CHECK(gyro[0] == -1 && gyro[1] == 300 && gyro[2] == -32768);
+  CHECK(burst.size() == c_samples);
+  CHECK(burst[0].messages == 2);
+  CHECK(burst[0].bytes == 1 + Device::c_sample_size);
+
+  // The register at a time path it replaces, for comparison.
+  adapter.clearTransfers();
+  for (unsigned i = 0; i < c_samples; ++i) {
+    for (unsigned j = 0; j < 6; ++j) {
+      dev.getI2C().read((uint8_t)(0x3b + 2 * j));
+      dev.getI2C().read((uint8_t)(0x3b + 2 * j + 1));
+    }
+  }
+  std::vector<FakeI2CAdapter::Transfer> bytewise = adapter.getTransfers();
+  CHECK(bytewise.size() == 12 * c_samples);
+
+  report("burst", burst, c_samples);
+  report("bytewise", bytewise, c_samples);
+  CHECK(busTime(burst, 400e3) < busTime(bytewise, 400e3));
+
+  return Test::report("mpu9250_sample");
+}
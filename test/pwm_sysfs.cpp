@@ -0,0 +1,206 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// Checks the thruster PWM channel against a sysfs tree made of plain files
+// in a temporary directory: setup order, exact-length writes, skipping of
+// unchanged duty cycles, and the cost of a persistent descriptor over an
+// open per write. Build with:
+//   g++ -std=c++11 -O2 -o pwm_sysfs test/pwm_sysfs.cpp
+
+// ISO C++ 11 headers.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// POSIX headers.
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Local headers.
+#include "../src/Actuators/BR_T200/PwmChannel.hpp"
+#include "Check.hpp"
+
+using Actuators::BR_T200::PwmChannel;
+
+//! Attributes of a sysfs PWM channel.
+static const char *c_attributes[] = {"duty_cycle", "period", "enable"};
+
+//! Read a whole file.
+static std::string readFile(const std::string &file) {
+  std::string data;
+  std::FILE *f = std::fopen(file.c_str(), "r");
+  if (f == NULL)
+    return data;
+
+  char bfr[64];
+  size_t n;
+  while ((n = std::fread(bfr, 1, sizeof(bfr), f)) > 0)
+    data.append(bfr, n);
+  std::fclose(f);
+  return data;
+}
+
+//! Empty a file.
+static void truncateFile(const std::string &file) {
+  if (::truncate(file.c_str(), 0) != 0)
+    std::perror(file.c_str());
+}
+
+//! Create a channel directory with empty attribute files.
+static std::string createChannel(const std::string &root) {
+  std::string chip = root + "/pwmchip0";
+  std::string path = chip + "/pwm0";
+  ::mkdir(chip.c_str(), 0755);
+  ::mkdir(path.c_str(), 0755);
+  for (unsigned i = 0; i < 3; ++i) {
+    std::string file = path + "/" + c_attributes[i];
+    int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0)
+      ::close(fd);
+  }
+  return path;
+}
+
+static void removeChannel(const std::string &root) {
+  std::string path = root + "/pwmchip0/pwm0";
+  for (unsigned i = 0; i < 3; ++i)
+    ::unlink((path + "/" + c_attributes[i]).c_str());
+  ::rmdir(path.c_str());
+  ::rmdir((root + "/pwmchip0").c_str());
+}
+
+static void testSetup(const std::string &root) {
+  std::string path = createChannel(root);
+  PwmChannel pwm(path);
+  pwm.enable(20000000, 1500000);
+
+  // Values go out without terminators or padding.
+  CHECK(readFile(path + "/period") == "20000000");
+  CHECK(readFile(path + "/duty_cycle") == "1500000");
+  CHECK(readFile(path + "/enable") == "1");
+  CHECK(pwm.getDutyCycle() == 1500000);
+
+  // Unchanged values are not written at all.
+  truncateFile(path + "/duty_cycle");
+  CHECK(!pwm.setDutyCycle(1500000));
+  CHECK(readFile(path + "/duty_cycle").empty());
+  CHECK(pwm.getWrites() == 0);
+
+  // Each change is one write of exactly the digits.
+  CHECK(pwm.setDutyCycle(1100000));
+  CHECK(readFile(path + "/duty_cycle") == "1100000");
+  truncateFile(path + "/duty_cycle");
+  CHECK(pwm.setDutyCycle(999000));
+  CHECK(readFile(path + "/duty_cycle") == "999000");
+  CHECK(pwm.getWrites() == 2);
+
+  pwm.disable();
+  CHECK(readFile(path + "/enable") == "0");
+  removeChannel(root);
+}
+
+static void testSlew(const std::string &root) {
+  std::string path = createChannel(root);
+  PwmChannel pwm(path);
+  pwm.enable(20000000, 1500000);
+
+  // A slow ramp at a high update rate repeats most pulse widths: only
+  // the changes reach the file.
+  unsigned changes = 0;
+  uint32_t last = 1500000;
+  for (unsigned i = 0; i < 5000; ++i) {
+    uint32_t duty_cycle = 1500000 + (i / 10) * 1000;
+    changes += duty_cycle != last ? 1 : 0;
+    last = duty_cycle;
+    pwm.setDutyCycle(duty_cycle);
+  }
+  CHECK(changes == 499);
+  CHECK(pwm.getWrites() == changes);
+  CHECK(readFile(path + "/duty_cycle") == "1999000");
+
+  pwm.disable();
+  removeChannel(root);
+}
+
+static void testErrors(const std::string &root) {
+  PwmChannel missing(root + "/pwmchip9/pwm0");
+  CHECK_THROWS(missing.enable(20000000, 1500000), std::runtime_error);
+  // Nothing to undo.
+  missing.disable();
+}
+
+static void testTiming(const std::string &root) {
+  std::string path = createChannel(root);
+  PwmChannel pwm(path);
+  pwm.enable(20000000, 1500000);
+
+  const unsigned c_updates = 20000;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < c_updates; ++i)
+    pwm.setDutyCycle(1500000 + (i % 2) * 1000 + 1000);
+  double persistent = std::chrono::duration<double, std::nano>(
+                          std::chrono::steady_clock::now() - start)
+                          .count() /
+                      c_updates;
+
+  start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < c_updates; ++i)
+    pwm.writeAttribute("duty_cycle", 1500000 + (i % 2) * 1000 + 1000);
+  double reopen = std::chrono::duration<double, std::nano>(
+                      std::chrono::steady_clock::now() - start)
+                      .count() /
+                  c_updates;
+
+  CHECK(pwm.getWrites() == c_updates);
+  std::printf("duty cycle update: %.0f ns with pwrite, %.0f ns with "
+              "open/write/close\n",
+              persistent, reopen);
+
+  pwm.disable();
+  removeChannel(root);
+}
+
+int main(void) {
+  char root[] = "/tmp/pwm_sysfs.XXXXXX";
+  if (::mkdtemp(root) == NULL) {
+    std::perror("mkdtemp");
+    return 1;
+  }
+
+  testSetup(root);
+  testSlew(root);
+  testErrors(root);
+  testTiming(root);
+
+  ::rmdir(root);
+  return Test::report("pwm_sysfs");
+}
@@ -0,0 +1,156 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// Checks the LiDAR range filter on a synthetic approach: closing speed and
+// time to contact under measurement noise, isolated outliers and weak or
+// saturated returns, and starting over after a gap. Build with:
+//   g++ -std=c++11 -O2 -o range_filter test/range_filter.cpp
+
+// ISO C++ 11 headers.
+#include <cmath>
+#include <random>
+
+// Local headers.
+#include "../src/Sensors/LiDAR/RangeFilter.hpp"
+#include "Check.hpp"
+
+using Sensors::LiDAR::RangeFilter;
+using Sensors::LiDAR::c_max_gap;
+
+//! Sample period of the sensor (s).
+static const double c_period = 0.01;
+
+static void testApproach(void) {
+  RangeFilter filter(0.5f, 0.02f, 100);
+  std::mt19937 rng(1);
+  std::normal_distribution<float> noise(0.0f, 0.02f);
+
+  // Approach from 10 m at 0.5 m/s; every 97th return is a spurious near
+  // echo and every 53rd is too weak or saturated to trust.
+  const float c_speed = 0.5f;
+  unsigned dropped = 0;
+  unsigned count = 0;
+  double speed_error = 0.0;
+  double contact_error = 0.0;
+  for (unsigned i = 0; i < 1600; ++i) {
+    double t = i * c_period;
+    float range = 10.0f - c_speed * (float)t;
+    float distance = range + noise(rng);
+    uint16_t strength = 500;
+    if (i % 97 == 0)
+      distance = 0.2f;
+    if (i % 53 == 0)
+      strength = (i % 106 == 0) ? 0xffff : 20;
+
+    bool used = filter.update(t, distance, strength);
+    CHECK(used == (strength == 500));
+    dropped += used ? 0 : 1;
+
+    // Measure once the filter has settled.
+    if (t < 2.0)
+      continue;
+    CHECK(std::fabs(filter.getRange() - range) < 0.05f);
+    CHECK(filter.getTimeToContact() > 0.0f);
+    float e = filter.getClosingSpeed() - c_speed;
+    speed_error += e * e;
+    float contact = range / c_speed;
+    contact_error += std::fabs(filter.getTimeToContact() - contact) / contact;
+    ++count;
+  }
+
+  // The speed estimate of a single update is noisy at this range noise;
+  // check it on average.
+  speed_error = std::sqrt(speed_error / count);
+  contact_error /= count;
+  CHECK(dropped == 31);
+  CHECK(speed_error < 0.1);
+  CHECK(contact_error < 0.15);
+  std::printf("closing speed error %.3f m/s RMS, time to contact error "
+              "%.1f%% on average\n",
+              speed_error, 100.0 * contact_error);
+}
+
+static void testReceding(void) {
+  RangeFilter filter(0.5f, 0.02f, 100);
+  for (unsigned i = 0; i < 500; ++i)
+    filter.update(i * c_period, 2.0f + 0.3f * (float)(i * c_period), 500);
+  CHECK(filter.getClosingSpeed() < -0.25f);
+  CHECK(filter.getTimeToContact() < 0.0f);
+}
+
+static void testGap(void) {
+  RangeFilter filter(0.5f, 0.02f, 100);
+  for (unsigned i = 0; i < 300; ++i)
+    filter.update(i * c_period, 5.0f - 1.0f * (float)(i * c_period), 500);
+  CHECK(filter.getClosingSpeed() > 0.9f);
+
+  // After a long gap the old state is stale: start from the new range
+  // with no speed.
+  CHECK(filter.update(10.0, 8.0f, 500));
+  CHECK(filter.isValid());
+  CHECK(filter.getRange() == 8.0f);
+  CHECK(filter.getClosingSpeed() == 0.0f);
+
+  // A measurement stamped slightly earlier, as when the reader thread
+  // stamps out of order, only corrects the estimate.
+  CHECK(filter.update(9.99, 8.02f, 500));
+  CHECK(filter.getRange() > 8.0f && filter.getRange() < 8.02f);
+  CHECK(std::fabs(filter.getClosingSpeed()) < 1.0f);
+  CHECK(filter.update(10.01, 8.0f, 500));
+  CHECK(std::fabs(filter.getRange() - 8.0f) < 0.05f);
+
+  // Time going back more than the maximum gap starts over.
+  CHECK(filter.update(10.01 - 2 * c_max_gap, 7.0f, 500));
+  CHECK(filter.getRange() == 7.0f);
+}
+
+static void testStep(void) {
+  RangeFilter filter(0.5f, 0.02f, 100);
+  double t = 0.0;
+  for (unsigned i = 0; i < 200; ++i, t += c_period)
+    filter.update(t, 6.0f, 500);
+
+  // A new object in front: the gate rejects the step until the filter
+  // gives up on the old one and follows the new range.
+  bool followed = false;
+  for (unsigned i = 0; i < 2 * RangeFilter::c_max_rejections + 5;
+       ++i, t += c_period) {
+    filter.update(t, 3.0f, 500);
+    followed = std::fabs(filter.getRange() - 3.0f) < 0.05f;
+  }
+  CHECK(followed);
+}
+
+int main(void) {
+  testApproach();
+  testReceding();
+  testGap();
+  testStep();
+  return Test::report("range_filter");
+}
@@ -0,0 +1,15 @@
+#! /bin/sh
+# Build and run the standalone tests that need no hardware. Run from the
+# repository root: sh test/run.sh
+
+set -e
+out=${TMPDIR:-/tmp}/mini-asv-test
+mkdir -p "$out"
+
+status=0
+for src in test/*.cpp; do
+  name=$(basename "$src" .cpp)
+  g++ -std=c++11 -O2 -Wall -pthread -o "$out/$name" "$src" -lutil
+  "$out/$name" || status=1
+done
+exit $status
@@ -0,0 +1,135 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+#ifndef TOOLS_DATASET_HPP_INCLUDED_
+#define TOOLS_DATASET_HPP_INCLUDED_
+
+// ISO C++ 11 headers.
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/core.hpp>
+
+namespace Tools {
+//! Horizontal half field of view of the camera (deg), as MAX_PICAM_ANGLE
+//! in the RPiCam task.
+static const double c_max_angle = 31.1;
+
+//! Default camera matrix of the RPiCam task, row-major.
+static const double c_camera[] = {681.9474487304688, 0, 279.387553359592862,
+                                  0, 679.4100341796875, 240.90015807337113,
+                                  0, 0, 1};
+
+//! Default distortion coefficients of the RPiCam task.
+static const double c_distortion[] = {
+    -0.4624503562479969, -0.43432558990654135, 0.001974482671297278,
+    -0.008023538703377298, 2.9986277588121113};
+
+//! Ground truth of a recorded frame, in undistorted frame pixels.
+struct Label {
+  //! True if the target is in view.
+  bool present;
+  //! Target centre.
+  cv::Point2f centre;
+  //! Target diameter.
+  float diameter;
+};
+
+//! Labels by image file name.
+typedef std::map<std::string, Label> Labels;
+
+//! Check if the rest of a labels line has only empty fields.
+inline bool emptyFields(const char *rest) {
+  return *rest == ',' && rest[std::strspn(rest, ", \t\r\n")] == '\0';
+}
+
+//! Read a labels file. Each line holds an image file name, without
+//! directory, and the target centre and diameter in undistorted frame
+//! pixels: "file,x,y,diameter". Frames without a target leave the other
+//! fields empty. Lines that do not parse, such as a header, are skipped.
+//! @param[in] path labels file.
+//! @return labels.
+inline Labels readLabels(const std::string &path) {
+  std::FILE *f = std::fopen(path.c_str(), "r");
+  if (f == NULL)
+    throw std::runtime_error("unable to open " + path);
+
+  Labels labels;
+  char line[512];
+  while (std::fgets(line, sizeof(line), f) != NULL) {
+    char name[256];
+    float x, y, diameter;
+    int n = std::sscanf(line, "%255[^,\r\n],%f,%f,%f", name, &x, &y,
+                        &diameter);
+    if (n == 4) {
+      Label label = {true, cv::Point2f(x, y), diameter};
+      labels[name] = label;
+    } else if (n == 1 && emptyFields(line + std::strlen(name))) {
+      Label label = {false, cv::Point2f(0, 0), 0};
+      labels[name] = label;
+    }
+  }
+  std::fclose(f);
+  return labels;
+}
+
+//! File name of a path, without directory.
+inline std::string baseName(const std::string &path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+//! Undistortion maps of the task's default calibration, in fixed-point
+//! format.
+//! @param[in] size frame size.
+//! @param[out] map_1 CV_16SC2 coordinates.
+//! @param[out] map_2 CV_16UC1 interpolation indices.
+inline void defaultMaps(cv::Size size, cv::Mat &map_1, cv::Mat &map_2) {
+  cv::Mat camera(3, 3, CV_64F, (void *)c_camera);
+  cv::Mat distortion(1, 5, CV_64F, (void *)c_distortion);
+  cv::initUndistortRectifyMap(camera, distortion, cv::Mat(), camera, size,
+                              CV_16SC2, map_1, map_2);
+}
+
+//! Heading to a target, as the RPiCam task computes heading_ref.
+//! @param[in] x target centre column, undistorted.
+//! @param[in] width frame width.
+//! @return heading (rad).
+inline double heading(double x, int width) {
+  return std::atan((x - width / 2) / width
+                   * std::tan(c_max_angle * M_PI / 180));
+}
+} // namespace Tools
+
+#endif
@@ -0,0 +1,331 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// Compares the single-pass CircleDetector of the RPiCam task with the
+// cv::SimpleBlobDetector it replaced, both with the task's parameters, on
+// a labelled image set: time per frame and how often each one picks the
+// docking target. The old task took the last keypoint SimpleBlobDetector
+// returned, so that choice is scored along with its largest keypoint.
+// Images go through the task's preprocessing (RedMask with the default
+// calibration, blur and closing) and labels give the target in
+// undistorted frame pixels, as described in tools/Dataset.hpp. Without
+// arguments, a synthetic set of masks with targets and clutter is used.
+// Build with:
+//   CV=$(pkg-config --cflags --libs opencv4)
+//   SRC=tools/circle_detector_bench.cpp
+//   g++ -std=c++11 -O2 -o circle_detector_bench $SRC $CV
+
+// ISO C++ 11 headers.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string>
+#include <vector>
+
+// POSIX headers.
+#include <unistd.h>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+// Local headers.
+#include "../src/Vision/RPiCam/CircleDetector.hpp"
+#include "../src/Vision/RPiCam/ImageSequence.hpp"
+#include "../src/Vision/RPiCam/RedMask.hpp"
+#include "Dataset.hpp"
+
+using Tools::Label;
+using Vision::RPiCam::CircleDetector;
+using Vision::RPiCam::ImageSequence;
+using Vision::RPiCam::RedMask;
+
+//! Frame size of the synthetic set.
+static const cv::Size c_size(640, 480);
+
+//! Mask with its ground truth.
+struct Sample {
+  cv::Mat mask;
+  Label label;
+};
+
+//! Detection score of one detector.
+struct Score {
+  const char *name;
+  std::vector<double> times;
+  //! Targets found.
+  unsigned hits;
+  //! Targets not found.
+  unsigned misses;
+  //! Detections away from the target, or with no target in view.
+  unsigned false_alarms;
+  //! Sum of centre errors of hits (pixels).
+  double centre_error;
+  //! Sum of relative diameter errors of hits.
+  double size_error;
+
+  explicit Score(const char *n)
+      : name(n), hits(0), misses(0), false_alarms(0), centre_error(0),
+        size_error(0) {}
+
+  //! Score the keypoint chosen for a frame, if any.
+  void add(const Label &label, const cv::KeyPoint *chosen) {
+    if (chosen == NULL) {
+      misses += label.present ? 1 : 0;
+      return;
+    }
+
+    if (!label.present) {
+      ++false_alarms;
+      return;
+    }
+
+    cv::Point2f d = chosen->pt - label.centre;
+    double error = std::sqrt(d.x * d.x + d.y * d.y);
+    if (error > std::max(5.0, 0.25 * label.diameter)) {
+      ++false_alarms;
+      ++misses;
+      return;
+    }
+
+    ++hits;
+    centre_error += error;
+    size_error += std::fabs(chosen->size - label.diameter) / label.diameter;
+  }
+
+  void print(void) {
+    std::sort(times.begin(), times.end());
+    double sum = 0;
+    for (size_t i = 0; i < times.size(); ++i)
+      sum += times[i];
+    std::printf("%-24s %7.3f ms  p95 %7.3f ms  hits %4u  misses %4u  "
+                "false %4u  centre %5.2f px  size %5.1f%%\n",
+                name, 1e3 * sum / times.size(),
+                1e3 * times[(size_t)(0.95 * (times.size() - 1))], hits,
+                misses, false_alarms, hits ? centre_error / hits : 0.0,
+                hits ? 100.0 * size_error / hits : 0.0);
+  }
+};
+
+static double since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                       - start)
+      .count();
+}
+
+//! Smoothing and closing of the task's preprocessing stage.
+static void postprocess(cv::Mat &mask) {
+  static const cv::Mat kernel =
+      cv::getStructuringElement(cv::MORPH_RECT, cv::Size(11, 11));
+  cv::GaussianBlur(mask, mask, cv::Size(13, 13), 3);
+  cv::morphologyEx(mask, mask, cv::MORPH_CLOSE, kernel);
+}
+
+//! Masks of a recorded, labelled image directory.
+static std::vector<Sample> loadSet(const std::string &dir,
+                                   const std::string &labels_file) {
+  Tools::Labels labels = Tools::readLabels(labels_file);
+  ImageSequence seq;
+  if (!seq.open(dir))
+    throw std::runtime_error("no images in " + dir);
+
+  cv::Mat map_1, map_2;
+  Tools::defaultMaps(seq.getSize(), map_1, map_2);
+  RedMask red_mask;
+  red_mask.setMaps(map_1, map_2, seq.getSize());
+
+  std::vector<Sample> set;
+  cv::Mat image;
+  std::string file;
+  while (seq.read(image)) {
+    file = Tools::baseName(seq.getFile());
+    Tools::Labels::const_iterator label = labels.find(file);
+    if (label == labels.end())
+      continue;
+
+    Sample sample;
+    red_mask.apply(image, sample.mask);
+    postprocess(sample.mask);
+    sample.label = label->second;
+    set.push_back(sample);
+  }
+
+  if (set.empty())
+    throw std::runtime_error("no labelled images in " + dir);
+  return set;
+}
+
+//! Synthetic masks: a target in most frames, among elongated, concave
+//! and small blobs that the filters must reject.
+static std::vector<Sample> synthesiseSet(unsigned count) {
+  std::vector<Sample> set;
+  cv::RNG rng(1);
+
+  for (unsigned i = 0; i < count; ++i) {
+    Sample sample;
+    sample.mask = cv::Mat(c_size, CV_8UC1, cv::Scalar(255));
+    cv::Mat &mask = sample.mask;
+
+    // Clutter.
+    cv::Point pole(rng.uniform(0, c_size.width), rng.uniform(0, 200));
+    cv::ellipse(mask, pole, cv::Size(8, 90), rng.uniform(0.0, 180.0), 0, 360,
+                cv::Scalar(0), cv::FILLED);
+    cv::Point moon(rng.uniform(80, c_size.width - 80),
+                   rng.uniform(300, c_size.height - 60));
+    cv::circle(mask, moon, 50, cv::Scalar(0), cv::FILLED);
+    cv::circle(mask, moon + cv::Point(25, -10), 45, cv::Scalar(255),
+               cv::FILLED);
+    for (unsigned j = 0; j < 20; ++j)
+      cv::circle(mask,
+                 cv::Point(rng.uniform(0, c_size.width),
+                           rng.uniform(0, c_size.height)),
+                 rng.uniform(1, 6), cv::Scalar(0), cv::FILLED);
+
+    // Target, kept clear of the clutter.
+    sample.label.present = rng.uniform(0, 5) != 0;
+    sample.label.centre = cv::Point2f(0, 0);
+    sample.label.diameter = 0;
+    if (sample.label.present) {
+      int radius = rng.uniform(20, 110);
+      cv::Point centre(rng.uniform(radius, c_size.width - radius),
+                       rng.uniform(radius, c_size.height - radius));
+      cv::circle(mask, centre, radius + 12, cv::Scalar(255), cv::FILLED);
+      cv::circle(mask, centre, radius, cv::Scalar(0), cv::FILLED);
+      sample.label.centre = cv::Point2f(centre.x, centre.y);
+      sample.label.diameter = 2 * radius + 1;
+    }
+
+    postprocess(mask);
+    set.push_back(sample);
+  }
+  return set;
+}
+
+int main(int argc, char **argv) {
+  unsigned repeats = 3;
+  unsigned synthetic = 200;
+
+  int opt;
+  while ((opt = ::getopt(argc, argv, "r:n:")) != -1) {
+    switch (opt) {
+      case 'r':
+        repeats = std::max(1, std::atoi(optarg));
+        break;
+      case 'n':
+        synthetic = std::max(1, std::atoi(optarg));
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+
+  if (optind != argc && optind != argc - 2) {
+    std::fprintf(stderr,
+                 "Usage: %s [-r <repeats>] [-n <synthetic frames>] "
+                 "[<image directory> <labels file>]\n",
+                 argv[0]);
+    return 1;
+  }
+
+  try {
+    std::vector<Sample> set = optind < argc
+                                  ? loadSet(argv[optind], argv[optind + 1])
+                                  : synthesiseSet(synthetic);
+    cv::Size size = set[0].mask.size();
+
+    // Parameters of the RPiCam task.
+    cv::SimpleBlobDetector::Params params;
+    params.filterByArea = true;
+    params.minArea = 1000;
+    params.maxArea = 4 * M_PI * std::pow(size.width, 2);
+    params.filterByCircularity = true;
+    params.minCircularity = 0.8;
+    params.filterByConvexity = true;
+    params.minConvexity = 0.3;
+    params.filterByInertia = true;
+    params.minInertiaRatio = 0.01;
+
+    CircleDetector detector;
+    detector.setParams(params);
+    cv::Ptr<cv::SimpleBlobDetector> blob_detector =
+        cv::SimpleBlobDetector::create(params);
+
+    Score single("CircleDetector");
+    Score last("SimpleBlob, last");
+    Score largest("SimpleBlob, largest");
+    std::vector<cv::KeyPoint> keypoints;
+
+    for (size_t i = 0; i < set.size(); ++i) {
+      const Sample &sample = set[i];
+
+      for (unsigned r = 0; r < repeats; ++r) {
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        detector.detect(sample.mask, keypoints);
+        single.times.push_back(since(start));
+      }
+      single.add(sample.label, keypoints.empty() ? NULL : &keypoints.front());
+
+      for (unsigned r = 0; r < repeats; ++r) {
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        blob_detector->detect(sample.mask, keypoints);
+        double t = since(start);
+        last.times.push_back(t);
+        largest.times.push_back(t);
+      }
+      const cv::KeyPoint *big = NULL;
+      for (size_t k = 0; k < keypoints.size(); ++k) {
+        if (big == NULL || keypoints[k].size > big->size)
+          big = &keypoints[k];
+      }
+      last.add(sample.label, keypoints.empty() ? NULL : &keypoints.back());
+      largest.add(sample.label, big);
+    }
+
+    unsigned targets = 0;
+    for (size_t i = 0; i < set.size(); ++i)
+      targets += set[i].label.present ? 1 : 0;
+    std::printf("%zu frames of %dx%d, %u with the target, %u repeats\n",
+                set.size(), size.width, size.height, targets, repeats);
+    single.print();
+    last.print();
+    largest.print();
+  } catch (std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,626 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// Measures the cost of one Madgwick filter update for each kernel: the
+// original task code, which promotes to double, the single precision
+// scalar kernel, the NEON/SSE kernel when built for it, and the batch
+// API over FIFO sized batches. Also reports how far each one drifts from
+// the original on the same synthetic 1 kHz stream.
+//
+// Given IMU and magnetic field recordings of Sensors.Recorder, ring files
+// or their rawrec2csv CSV, replays them instead as the MPU9250 task fuses
+// them: every IMU sample with its recorded time step, the newest magnetic
+// field sample folded in. Reports the cost per update of the original and
+// new kernels and their heading error against a reference: a CSV of time
+// and heading (degrees), such as a GPS course or an external compass, or
+// by default the tilt compensated compass heading of each sample, which
+// is where the filter settles at rest. Build with:
+//   g++ -std=c++11 -O2 -o madgwick_bench tools/madgwick_bench.cpp
+// adding -mfpu=neon on 32 bit ARM.
+
+// ISO C++ 11 headers.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// POSIX headers.
+#include <unistd.h>
+
+// Local headers.
+#include "../src/Sensors/Common/RingFile.hpp"
+#include "../src/Sensors/MPU9250/Madgwick.hpp"
+
+using Sensors::Common::RingFile;
+using Sensors::MPU9250::ImuSamples;
+using Sensors::MPU9250::Madgwick;
+
+//! Filter update of the original MPU9250 task, kept as the baseline. The
+//! 0.5 literals and sqrt promote parts of it to double.
+struct Original {
+  float beta = 0.1f;
+  float q0 = 1.0f, q1 = 0.0f, q2 = 0.0f, q3 = 0.0f;
+
+  float invSqrt(float x) {
+    float tmp = 1 / (sqrt(x));
+    return tmp;
+  }
+
+  void update(float gx, float gy, float gz, float ax, float ay, float az,
+              float mx, float my, float mz, double deltaT) {
+    float recipNorm;
+    float s0, s1, s2, s3;
+    float qDot1, qDot2, qDot3, qDot4;
+    float hx, hy;
+    float _2q0mx, _2q0my, _2q0mz, _2q1mx, _2bx, _2bz, _4bx, _4bz, _8bx, _8bz,
+        _2q0, _2q1, _2q2, _2q3, q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2,
+        q2q3, q3q3;
+
+    qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+    qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+    qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+    qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+    if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
+      recipNorm = invSqrt(ax * ax + ay * ay + az * az);
+      ax *= recipNorm;
+      ay *= recipNorm;
+      az *= recipNorm;
+
+      recipNorm = invSqrt(mx * mx + my * my + mz * mz);
+      mx *= recipNorm;
+      my *= recipNorm;
+      mz *= recipNorm;
+
+      _2q0mx = 2.0f * q0 * mx;
+      _2q0my = 2.0f * q0 * my;
+      _2q0mz = 2.0f * q0 * mz;
+      _2q1mx = 2.0f * q1 * mx;
+      _2q0 = 2.0f * q0;
+      _2q1 = 2.0f * q1;
+      _2q2 = 2.0f * q2;
+      _2q3 = 2.0f * q3;
+      q0q0 = q0 * q0;
+      q0q1 = q0 * q1;
+      q0q2 = q0 * q2;
+      q0q3 = q0 * q3;
+      q1q1 = q1 * q1;
+      q1q2 = q1 * q2;
+      q1q3 = q1 * q3;
+      q2q2 = q2 * q2;
+      q2q3 = q2 * q3;
+      q3q3 = q3 * q3;
+
+      hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 +
+           _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+      hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 +
+           my * q2q2 + _2q2 * mz * q3 - my * q3q3;
+      _2bx = sqrt(hx * hx + hy * hy);
+      _2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 +
+             _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
+      _4bx = 2.0f * _2bx;
+      _4bz = 2.0f * _2bz;
+      _8bx = 2.0f * _4bx;
+      _8bz = 2.0f * _4bz;
+
+      s0 = -_2q2 * (2.0f * (q1q3 - q0q2) - ax) +
+           _2q1 * (2.0f * (q0q1 + q2q3) - ay) +
+           -_4bz * q2 *
+               (_4bx * (0.5 - q2q2 - q3q3) + _4bz * (q1q3 - q0q2) - mx) +
+           (-_4bx * q3 + _4bz * q1) *
+               (_4bx * (q1q2 - q0q3) + _4bz * (q0q1 + q2q3) - my) +
+           _4bx * q2 * (_4bx * (q0q2 + q1q3) + _4bz * (0.5 - q1q1 - q2q2) - mz);
+      s1 =
+          _2q3 * (2.0f * (q1q3 - q0q2) - ax) +
+          _2q0 * (2.0f * (q0q1 + q2q3) - ay) +
+          -4.0f * q1 * (2.0f * (0.5 - q1q1 - q2q2) - az) +
+          _4bz * q3 * (_4bx * (0.5 - q2q2 - q3q3) + _4bz * (q1q3 - q0q2) - mx) +
+          (_4bx * q2 + _4bz * q0) *
+              (_4bx * (q1q2 - q0q3) + _4bz * (q0q1 + q2q3) - my) +
+          (_4bx * q3 - _8bz * q1) *
+              (_4bx * (q0q2 + q1q3) + _4bz * (0.5 - q1q1 - q2q2) - mz);
+      s2 = -_2q0 * (2.0f * (q1q3 - q0q2) - ax) +
+           _2q3 * (2.0f * (q0q1 + q2q3) - ay) +
+           (-4.0f * q2) * (2.0f * (0.5 - q1q1 - q2q2) - az) +
+           (-_8bx * q2 - _4bz * q0) *
+               (_4bx * (0.5 - q2q2 - q3q3) + _4bz * (q1q3 - q0q2) - mx) +
+           (_4bx * q1 + _4bz * q3) *
+               (_4bx * (q1q2 - q0q3) + _4bz * (q0q1 + q2q3) - my) +
+           (_4bx * q0 - _8bz * q2) *
+               (_4bx * (q0q2 + q1q3) + _4bz * (0.5 - q1q1 - q2q2) - mz);
+      s3 = _2q1 * (2.0f * (q1q3 - q0q2) - ax) +
+           _2q2 * (2.0f * (q0q1 + q2q3) - ay) +
+           (-_8bx * q3 + _4bz * q1) *
+               (_4bx * (0.5 - q2q2 - q3q3) + _4bz * (q1q3 - q0q2) - mx) +
+           (-_4bx * q0 + _4bz * q2) *
+               (_4bx * (q1q2 - q0q3) + _4bz * (q0q1 + q2q3) - my) +
+           (_4bx * q1) *
+               (_4bx * (q0q2 + q1q3) + _4bz * (0.5 - q1q1 - q2q2) - mz);
+      recipNorm = invSqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);
+      s0 *= recipNorm;
+      s1 *= recipNorm;
+      s2 *= recipNorm;
+      s3 *= recipNorm;
+
+      qDot1 -= beta * s0;
+      qDot2 -= beta * s1;
+      qDot3 -= beta * s2;
+      qDot4 -= beta * s3;
+    }
+
+    q0 += qDot1 * deltaT;
+    q1 += qDot2 * deltaT;
+    q2 += qDot3 * deltaT;
+    q3 += qDot4 * deltaT;
+
+    recipNorm = invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    q0 *= recipNorm;
+    q1 *= recipNorm;
+    q2 *= recipNorm;
+    q3 *= recipNorm;
+  }
+};
+
+//! Synthetic 1 kHz stream of a vehicle yawing and rolling slowly, with
+//! sensor noise, in structure-of-arrays layout.
+struct Stream {
+  std::vector<float> gx, gy, gz, ax, ay, az, dt;
+  float mx, my, mz;
+
+  explicit Stream(size_t size)
+      : gx(size), gy(size), gz(size), ax(size), ay(size), az(size),
+        dt(size, 0.001f), mx(0.2f), my(0.05f), mz(0.4f) {
+    unsigned seed = 1;
+    for (size_t i = 0; i < size; ++i) {
+      double t = i * 0.001;
+      double roll = 0.2 * std::sin(0.5 * t);
+      gx[i] = (float)(0.1 * std::cos(0.5 * t) + noise(seed) * 0.01);
+      gy[i] = (float)(noise(seed) * 0.01);
+      gz[i] = (float)(0.3 + noise(seed) * 0.01);
+      ax[i] = (float)(noise(seed) * 0.05);
+      ay[i] = (float)(std::sin(roll) + noise(seed) * 0.05);
+      az[i] = (float)(std::cos(roll) + noise(seed) * 0.05);
+    }
+  }
+
+  static double noise(unsigned &seed) {
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 8) & 0xffff) / 32768.0 - 1.0;
+  }
+
+  ImuSamples batch(size_t first, size_t size) const {
+    ImuSamples s = {&gx[first], &gy[first], &gz[first], &ax[first],
+                    &ay[first], &az[first], &dt[first], size};
+    return s;
+  }
+};
+
+//! Largest component difference between quaternions, sign independent.
+static double distance(const float *a, const float *b) {
+  double plus = 0, minus = 0;
+  for (unsigned i = 0; i < 4; ++i) {
+    plus = std::fmax(plus, std::fabs(a[i] - b[i]));
+    minus = std::fmax(minus, std::fabs(a[i] + b[i]));
+  }
+  return std::fmin(plus, minus);
+}
+
+//! Time a run over the whole stream, best of several.
+//! @return ns per update.
+template <typename Run>
+static double timeIt(size_t size, Run run) {
+  double best = 1e30;
+  for (unsigned i = 0; i < 5; ++i) {
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    run();
+    double ns = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    best = std::fmin(best, ns / size);
+  }
+  return best;
+}
+
+//! Time the kernels on the synthetic stream.
+static int runSynthetic(size_t size) {
+  const size_t c_batch = 20;
+  size = size / c_batch * c_batch;
+  Stream s(size);
+
+  Original original;
+  Madgwick scalar;
+  Madgwick vector;
+  Madgwick batch;
+  float q_original[4];
+
+  double t_original = timeIt(size, [&] {
+    original = Original();
+    for (size_t i = 0; i < size; ++i)
+      original.update(s.gx[i], s.gy[i], s.gz[i], s.ax[i], s.ay[i], s.az[i],
+                      s.mx, s.my, s.mz, s.dt[i]);
+  });
+  q_original[0] = original.q0;
+  q_original[1] = original.q1;
+  q_original[2] = original.q2;
+  q_original[3] = original.q3;
+
+  double t_scalar = timeIt(size, [&] {
+    scalar.reset();
+    for (size_t i = 0; i < size; ++i)
+      scalar.updateScalar(s.gx[i], s.gy[i], s.gz[i], s.ax[i], s.ay[i],
+                          s.az[i], s.mx, s.my, s.mz, s.dt[i]);
+  });
+
+  double t_vector = timeIt(size, [&] {
+    vector.reset();
+    for (size_t i = 0; i < size; ++i)
+      vector.updateVector(s.gx[i], s.gy[i], s.gz[i], s.ax[i], s.ay[i],
+                          s.az[i], s.mx, s.my, s.mz, s.dt[i]);
+  });
+
+  double t_batch = timeIt(size, [&] {
+    batch.reset();
+    for (size_t i = 0; i < size; i += c_batch)
+      batch.update(s.batch(i, c_batch), s.mx, s.my, s.mz);
+  });
+
+#if defined(MADGWICK_NEON)
+  const char *simd = "NEON";
+#elif defined(MADGWICK_SSE)
+  const char *simd = "SSE";
+#else
+  const char *simd = "none, plain float lanes";
+#endif
+
+  std::printf("%zu updates, vector kernel: %s\n", size, simd);
+  std::printf("%-22s %8s %14s\n", "kernel", "ns", "vs original");
+  std::printf("%-22s %8.1f %14s\n", "original (double)", t_original, "-");
+  std::printf("%-22s %8.1f %14.2e\n", "scalar", t_scalar,
+              distance(scalar.getQuaternion(), q_original));
+  std::printf("%-22s %8.1f %14.2e\n", "vector", t_vector,
+              distance(vector.getQuaternion(), q_original));
+  std::printf("%-22s %8.1f %14.2e\n", "batch of 20", t_batch,
+              distance(batch.getQuaternion(), q_original));
+  return 0;
+}
+
+//! Recorded sample of the IMU or magnetic field stream.
+struct Record {
+  double tstamp;
+  float value[6];
+};
+
+static bool endsWith(const std::string &s, const char *suffix) {
+  size_t n = std::strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+//! Read a CSV of time and values, skipping lines that do not parse.
+static std::vector<Record> readCsv(const char *path, unsigned values) {
+  std::FILE *f = std::fopen(path, "r");
+  if (f == NULL)
+    throw std::runtime_error(std::string("unable to open ") + path);
+
+  std::vector<Record> v;
+  char line[512];
+  while (std::fgets(line, sizeof(line), f) != NULL) {
+    Record r;
+    char *p = line;
+    char *end;
+    r.tstamp = std::strtod(p, &end);
+    unsigned n = 0;
+    while (end != p && n < values && *end == ',') {
+      p = end + 1;
+      r.value[n] = std::strtof(p, &end);
+      n += end != p ? 1 : 0;
+    }
+    if (n == values)
+      v.push_back(r);
+  }
+  std::fclose(f);
+  return v;
+}
+
+//! Read a recording of a stream, ring file or CSV.
+static std::vector<Record> readStream(const char *path,
+                                      Sensors::Common::Stream stream,
+                                      unsigned values) {
+  if (endsWith(path, ".csv"))
+    return readCsv(path, values);
+
+  RingFile file(path);
+  if (file.getHeader().stream != (uint32_t)stream)
+    throw std::runtime_error(std::string(path) + ": unexpected stream");
+
+  std::vector<Record> v;
+  for (uint64_t i = 0; i < file.getCount(); ++i) {
+    const Sensors::Common::RingFileRecord &rec = file.getRecord(i);
+    Record r;
+    r.tstamp = rec.tstamp;
+    std::memcpy(r.value, rec.value, sizeof(r.value));
+    v.push_back(r);
+  }
+  return v;
+}
+
+//! Heading of a quaternion, as psi_magnetic of the MPU9250 task.
+static double heading(const float *q) {
+  return std::atan2(q[1] * q[2] + q[0] * q[3],
+                    0.5 - q[2] * q[2] - q[3] * q[3]);
+}
+
+//! Tilt compensated compass heading, in the frame of the filter.
+static double compass(const float *a, const float *m) {
+  double z[3] = {a[0], a[1], a[2]};
+  double y[3] = {z[1] * m[2] - z[2] * m[1], z[2] * m[0] - z[0] * m[2],
+                 z[0] * m[1] - z[1] * m[0]};
+  double x0 = y[1] * z[2] - y[2] * z[1];
+  // Normalising z and y scales both terms alike.
+  return std::atan2(y[0] * std::sqrt(z[0] * z[0] + z[1] * z[1] + z[2] * z[2]),
+                    x0);
+}
+
+//! Difference of two angles, in [-pi, pi].
+static double angleDiff(double a, double b) {
+  double d = std::fmod(a - b, 2 * M_PI);
+  if (d > M_PI)
+    d -= 2 * M_PI;
+  else if (d < -M_PI)
+    d += 2 * M_PI;
+  return d;
+}
+
+//! Heading error statistics.
+struct HeadingError {
+  unsigned count;
+  double sum, sum_sq, max;
+
+  HeadingError(void) : count(0), sum(0), sum_sq(0), max(0) {}
+
+  void add(double error) {
+    error = std::fabs(error);
+    ++count;
+    sum += error;
+    sum_sq += error * error;
+    max = std::fmax(max, error);
+  }
+
+  void print(const char *name, double ns) const {
+    const double deg = 180 / M_PI;
+    std::printf("%-22s %8.1f %10.2f %10.2f %10.2f\n", name, ns,
+                count ? deg * sum / count : 0.0,
+                count ? deg * std::sqrt(sum_sq / count) : 0.0, deg * max);
+  }
+};
+
+//! Replay recorded IMU and magnetic field streams through the filter.
+static int runReplay(const char *imu_path, const char *magn_path,
+                     const char *reference_path, const char *output_path,
+                     float beta, double settle) {
+  std::vector<Record> imu =
+      readStream(imu_path, Sensors::Common::SS_IMU, 6);
+  std::vector<Record> magn =
+      readStream(magn_path, Sensors::Common::SS_MAGNETIC_FIELD, 3);
+  std::vector<Record> reference;
+  if (reference_path != NULL)
+    reference = readCsv(reference_path, 1);
+  if (imu.size() < 2 || magn.empty())
+    throw std::runtime_error("not enough samples to replay");
+
+  // Nominal period, for the gap rule of the task.
+  std::vector<double> steps;
+  for (size_t i = 1; i < imu.size(); ++i)
+    steps.push_back(imu[i].tstamp - imu[i - 1].tstamp);
+  std::nth_element(steps.begin(), steps.begin() + steps.size() / 2,
+                   steps.end());
+  double period = steps[steps.size() / 2];
+
+  // Filter inputs, with the axis mapping of the task, from the first
+  // magnetic field sample on.
+  std::vector<float> in[7];
+  std::vector<float> field[3];
+  std::vector<double> tstamps;
+  size_t next_magn = 0;
+  float m[3] = {0, 0, 0};
+  double last = -1;
+  for (size_t i = 0; i < imu.size(); ++i) {
+    const Record &r = imu[i];
+    while (next_magn < magn.size() && magn[next_magn].tstamp <= r.tstamp) {
+      m[0] = magn[next_magn].value[0];
+      m[1] = -magn[next_magn].value[1];
+      m[2] = -magn[next_magn].value[2];
+      ++next_magn;
+    }
+    double dt = r.tstamp - last;
+    last = r.tstamp;
+    if (next_magn == 0)
+      continue;
+    if (dt <= 0 || dt > 10 * period)
+      dt = 0;
+
+    in[0].push_back(r.value[3]);
+    in[1].push_back(-r.value[4]);
+    in[2].push_back(-r.value[5]);
+    in[3].push_back(-r.value[0]);
+    in[4].push_back(r.value[1]);
+    in[5].push_back(r.value[2]);
+    in[6].push_back((float)dt);
+    for (unsigned k = 0; k < 3; ++k)
+      field[k].push_back(m[k]);
+    tstamps.push_back(r.tstamp);
+  }
+
+  size_t size = tstamps.size();
+  if (size == 0)
+    throw std::runtime_error("no IMU samples after the first magnetic "
+                             "field sample");
+
+  // Cost per update.
+  Original original;
+  Madgwick filter(beta);
+  double t_original = timeIt(size, [&] {
+    original = Original();
+    original.beta = beta;
+    for (size_t i = 0; i < size; ++i)
+      original.update(in[0][i], in[1][i], in[2][i], in[3][i], in[4][i],
+                      in[5][i], field[0][i], field[1][i], field[2][i],
+                      in[6][i]);
+  });
+  double t_filter = timeIt(size, [&] {
+    filter.reset();
+    for (size_t i = 0; i < size; ++i)
+      filter.update(in[0][i], in[1][i], in[2][i], in[3][i], in[4][i],
+                    in[5][i], field[0][i], field[1][i], field[2][i],
+                    in[6][i]);
+  });
+
+  // Heading error, once the filter has settled.
+  std::FILE *out = NULL;
+  if (output_path != NULL) {
+    out = std::fopen(output_path, "w");
+    if (out == NULL)
+      throw std::runtime_error(std::string("unable to open ") + output_path);
+    std::fprintf(out, "time,reference,original,filter\n");
+  }
+
+  original = Original();
+  original.beta = beta;
+  filter.reset();
+  HeadingError e_original, e_filter;
+  size_t next_ref = 0;
+  for (size_t i = 0; i < size; ++i) {
+    original.update(in[0][i], in[1][i], in[2][i], in[3][i], in[4][i],
+                    in[5][i], field[0][i], field[1][i], field[2][i],
+                    in[6][i]);
+    filter.update(in[0][i], in[1][i], in[2][i], in[3][i], in[4][i],
+                  in[5][i], field[0][i], field[1][i], field[2][i], in[6][i]);
+    if (tstamps[i] - tstamps[0] < settle)
+      continue;
+
+    double ref;
+    if (reference_path != NULL) {
+      // Nearest reference sample within a second.
+      while (next_ref + 1 < reference.size()
+             && std::fabs(reference[next_ref + 1].tstamp - tstamps[i])
+                    <= std::fabs(reference[next_ref].tstamp - tstamps[i]))
+        ++next_ref;
+      if (reference.empty()
+          || std::fabs(reference[next_ref].tstamp - tstamps[i]) > 1.0)
+        continue;
+      ref = reference[next_ref].value[0] * M_PI / 180;
+    } else {
+      float a[3] = {in[3][i], in[4][i], in[5][i]};
+      float f[3] = {field[0][i], field[1][i], field[2][i]};
+      ref = compass(a, f);
+    }
+
+    const float q_original[4] = {original.q0, original.q1, original.q2,
+                                 original.q3};
+    double h_original = heading(q_original);
+    double h_filter = heading(filter.getQuaternion());
+    e_original.add(angleDiff(h_original, ref));
+    e_filter.add(angleDiff(h_filter, ref));
+    if (out != NULL)
+      std::fprintf(out, "%.6f,%.3f,%.3f,%.3f\n", tstamps[i],
+                   ref * 180 / M_PI, h_original * 180 / M_PI,
+                   h_filter * 180 / M_PI);
+  }
+  if (out != NULL)
+    std::fclose(out);
+
+  std::printf("%zu IMU samples at %.1f Hz, %zu magnetic field samples, "
+              "%.1f s\n",
+              size, 1.0 / period, magn.size(),
+              tstamps.back() - tstamps.front());
+  std::printf("heading reference: %s, %u samples after %.0f s\n",
+              reference_path != NULL ? reference_path : "tilt compensated "
+                                                        "compass",
+              e_filter.count, settle);
+  std::printf("%-22s %8s %10s %10s %10s\n", "kernel", "ns", "mean deg",
+              "RMS deg", "max deg");
+  e_original.print("original (double)", t_original);
+  e_filter.print("float", t_filter);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  float beta = 0.1f;
+  double settle = 10.0;
+  const char *reference = NULL;
+  const char *output = NULL;
+
+  int opt;
+  while ((opt = ::getopt(argc, argv, "b:s:r:o:")) != -1) {
+    switch (opt) {
+      case 'b':
+        beta = (float)std::atof(optarg);
+        break;
+      case 's':
+        settle = std::atof(optarg);
+        break;
+      case 'r':
+        reference = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+
+  if (optind > argc || argc - optind > 2) {
+    std::fprintf(stderr,
+                 "Usage: %s [<updates>]\n"
+                 "       %s [-b <beta>] [-s <settling time>] "
+                 "[-r <reference csv>] [-o <csv file>] <imu recording> "
+                 "<magnetic field recording>\n",
+                 argv[0], argv[0]);
+    return 1;
+  }
+
+  try {
+    if (argc - optind == 2)
+      return runReplay(argv[optind], argv[optind + 1], reference, output,
+                       beta, settle);
+    return runSynthetic(optind < argc ? (size_t)std::atol(argv[optind])
+                                      : 200000);
+  } catch (std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+}
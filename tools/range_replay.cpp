@@ -0,0 +1,204 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// Replays a recorded LiDAR range stream through the range filter and
+// writes the filtered range, closing speed and time to contact as CSV.
+// Takes a ring file of the Sensors.Recorder range stream or its CSV from
+// rawrec2csv. When the recording holds the filter output of the live run,
+// reports how far the replay departs from it. Build with:
+//   g++ -std=c++11 -O2 -o range_replay tools/range_replay.cpp
+
+// ISO C++ 11 headers.
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+// POSIX headers.
+#include <unistd.h>
+
+// Local headers.
+#include "../src/Sensors/Common/RingFile.hpp"
+#include "../src/Sensors/LiDAR/RangeFilter.hpp"
+
+using Sensors::Common::RingFile;
+using Sensors::LiDAR::RangeFilter;
+
+//! Recorded range measurement.
+struct Measurement {
+  double tstamp;
+  float distance;
+  uint16_t strength;
+  //! Filtered range of the live run, negative if none.
+  float filtered;
+};
+
+static bool endsWith(const std::string &s, const char *suffix) {
+  size_t n = std::strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+//! Read a range CSV: time,distance,strength[,temperature,filtered,...].
+static std::vector<Measurement> readCsv(const char *path) {
+  std::FILE *f = std::fopen(path, "r");
+  if (f == NULL)
+    throw std::runtime_error(std::string("unable to open ") + path);
+
+  std::vector<Measurement> v;
+  char line[512];
+  while (std::fgets(line, sizeof(line), f) != NULL) {
+    double t, d, s, temp, filtered;
+    int n = std::sscanf(line, "%lf,%lf,%lf,%lf,%lf", &t, &d, &s, &temp,
+                        &filtered);
+    // Header or malformed line.
+    if (n < 3)
+      continue;
+    Measurement m = {t, (float)d, (uint16_t)s,
+                     n >= 5 ? (float)filtered : -1.0f};
+    v.push_back(m);
+  }
+  std::fclose(f);
+  return v;
+}
+
+//! Read a range ring file.
+static std::vector<Measurement> readRing(const char *path) {
+  RingFile file(path);
+  if (file.getHeader().stream != Sensors::Common::SS_RANGE)
+    throw std::runtime_error(std::string(path) + ": not a range stream");
+
+  std::vector<Measurement> v;
+  for (uint64_t i = 0; i < file.getCount(); ++i) {
+    const Sensors::Common::RingFileRecord &r = file.getRecord(i);
+    Measurement m = {r.tstamp, r.value[0], (uint16_t)r.value[1],
+                     r.value[3]};
+    v.push_back(m);
+  }
+  return v;
+}
+
+int main(int argc, char **argv) {
+  // Defaults of the LiDAR task.
+  float accel_noise = 0.5f;
+  float range_noise = 0.02f;
+  unsigned min_strength = 100;
+
+  int opt;
+  while ((opt = ::getopt(argc, argv, "q:r:s:")) != -1) {
+    switch (opt) {
+      case 'q':
+        accel_noise = (float)std::atof(optarg);
+        break;
+      case 'r':
+        range_noise = (float)std::atof(optarg);
+        break;
+      case 's':
+        min_strength = (unsigned)std::atoi(optarg);
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+
+  if (optind != argc - 1 && optind != argc - 2) {
+    std::fprintf(stderr,
+                 "Usage: %s [-q <accel noise>] [-r <range noise>] "
+                 "[-s <min strength>] <ring or csv file> [<csv file>]\n",
+                 argv[0]);
+    return 1;
+  }
+
+  try {
+    std::string input = argv[optind];
+    std::vector<Measurement> v = endsWith(input, ".csv")
+                                     ? readCsv(input.c_str())
+                                     : readRing(input.c_str());
+
+    std::FILE *out = stdout;
+    if (optind + 1 < argc) {
+      out = std::fopen(argv[optind + 1], "w");
+      if (out == NULL) {
+        std::perror(argv[optind + 1]);
+        return 1;
+      }
+    }
+
+    // Time the filter alone.
+    RangeFilter filter(accel_noise, range_noise, (uint16_t)min_strength);
+    std::vector<float> range(v.size()), speed(v.size()), contact(v.size());
+    std::vector<bool> used(v.size());
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for (size_t i = 0; i < v.size(); ++i) {
+      used[i] = filter.update(v[i].tstamp, v[i].distance, v[i].strength);
+      range[i] = filter.isValid() ? filter.getRange() : -1.0f;
+      speed[i] = filter.getClosingSpeed();
+      contact[i] = filter.getTimeToContact();
+    }
+    double ns = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+
+    std::fprintf(out, "time,distance,strength,used,filtered,closing_speed,"
+                      "contact_time\n");
+    size_t rejected = 0;
+    size_t compared = 0;
+    double max_diff = 0;
+    for (size_t i = 0; i < v.size(); ++i) {
+      std::fprintf(out, "%.6f,%.3f,%u,%d,%.4f,%.4f,%.3f\n", v[i].tstamp,
+                   v[i].distance, v[i].strength, used[i] ? 1 : 0, range[i],
+                   speed[i], contact[i]);
+      rejected += used[i] ? 0 : 1;
+      if (v[i].filtered >= 0 && range[i] >= 0) {
+        ++compared;
+        max_diff = std::fmax(max_diff, std::fabs(v[i].filtered - range[i]));
+      }
+    }
+    if (out != stdout)
+      std::fclose(out);
+
+    std::fprintf(stderr, "%zu measurements, %zu rejected, %.1f ns per "
+                         "update\n",
+                 v.size(), rejected, v.empty() ? 0.0 : ns / v.size());
+    if (compared > 0)
+      std::fprintf(stderr, "filtered range within %.4f m of the recording "
+                           "over %zu measurements\n",
+                   max_diff, compared);
+  } catch (std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,92 @@
+
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// Converts a ring file written by the Sensors.Recorder task to CSV,
+// oldest record first. Build with:
+//   g++ -std=c++11 -O2 -o rawrec2csv tools/rawrec2csv.cpp
+
+// ISO C++ 11 headers.
+#include <cstdio>
+#include <exception>
+
+// Local headers.
+#include "../src/Sensors/Common/RingFile.hpp"
+
+using Sensors::Common::RingFile;
+using Sensors::Common::RingFileHeader;
+using Sensors::Common::RingFileRecord;
+using Sensors::Common::StreamInfo;
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    std::fprintf(stderr, "Usage: %s <ring file> [<csv file>]\n", argv[0]);
+    return 1;
+  }
+
+  try {
+    RingFile file(argv[1]);
+    const RingFileHeader &h = file.getHeader();
+    const StreamInfo &info =
+        Sensors::Common::getStreamInfo((Sensors::Common::Stream)h.stream);
+
+    std::FILE *out = stdout;
+    if (argc == 3 && (out = std::fopen(argv[2], "w")) == NULL) {
+      std::perror(argv[2]);
+      return 1;
+    }
+
+    std::fprintf(out, "time,%s\n", info.columns);
+    uint64_t count = file.getCount();
+    for (uint64_t i = 0; i < count; ++i) {
+      const RingFileRecord &r = file.getRecord(i);
+      std::fprintf(out, "%.6f", r.tstamp);
+      for (unsigned j = 0; j < info.values; ++j)
+        std::fprintf(out, ",%.9g", r.value[j]);
+      std::fputc('\n', out);
+    }
+
+    if (h.head > h.capacity)
+      std::fprintf(stderr, "%s: %llu oldest records overwritten\n", argv[1],
+                   (unsigned long long)(h.head - h.capacity));
+    if (h.lost > 0)
+      std::fprintf(stderr, "%s: %llu samples lost while recording\n",
+                   argv[1], (unsigned long long)h.lost);
+
+    if (out != stdout && std::fclose(out) != 0) {
+      std::perror(argv[2]);
+      return 1;
+    }
+  } catch (std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,244 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// Compares the fused RedMask kernel with the OpenCV chain it replaces in
+// the RPiCam task (cv::remap, cv::cvtColor to HSV, cv::inRange) on
+// recorded frames: time per frame for the chain, the kernel and the
+// kernel split in row bands over threads, and how many mask pixels differ
+// from the chain. Frames come from an image directory, as recorded for
+// the task's replay backend, or are synthesised when none is given. The
+// undistortion maps are built from the task's default calibration. Build
+// with:
+//   CV=$(pkg-config --cflags --libs opencv4)
+//   g++ -std=c++11 -O2 -pthread -o red_mask_bench tools/red_mask_bench.cpp $CV
+// adding -mfpu=neon on 32 bit ARM.
+
+// ISO C++ 11 headers.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string>
+#include <thread>
+#include <vector>
+
+// POSIX headers.
+#include <unistd.h>
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+// Local headers.
+#include "../src/Vision/RPiCam/ImageSequence.hpp"
+#include "../src/Vision/RPiCam/RedMask.hpp"
+
+using Vision::RPiCam::ImageSequence;
+using Vision::RPiCam::RedMask;
+
+//! Default camera matrix of the RPiCam task, row-major.
+static const double c_camera[] = {681.9474487304688, 0, 279.387553359592862,
+                                  0, 679.4100341796875, 240.90015807337113,
+                                  0, 0, 1};
+//! Default distortion coefficients of the RPiCam task.
+static const double c_distortion[] = {
+    -0.4624503562479969, -0.43432558990654135, 0.001974482671297278,
+    -0.008023538703377298, 2.9986277588121113};
+
+//! Frame time distribution.
+struct Timing {
+  std::vector<double> samples;
+
+  void add(double t) { samples.push_back(t); }
+
+  void print(const char *name) {
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (size_t i = 0; i < samples.size(); ++i)
+      sum += samples[i];
+    std::printf("%-16s mean %7.3f ms  median %7.3f ms  p95 %7.3f ms\n", name,
+                1e3 * sum / samples.size(), 1e3 * at(0.5), 1e3 * at(0.95));
+  }
+
+  double at(double q) const {
+    return samples[(size_t)(q * (samples.size() - 1) + 0.5)];
+  }
+
+  double median(void) {
+    std::sort(samples.begin(), samples.end());
+    return at(0.5);
+  }
+};
+
+static double since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                       - start)
+      .count();
+}
+
+//! Synthetic docking frame: a red target over a noisy background with
+//! orange and grey clutter.
+static cv::Mat synthesise(unsigned i, cv::Size size) {
+  cv::Mat frame(size, CV_8UC3);
+  cv::RNG rng(i + 1);
+  rng.fill(frame, cv::RNG::UNIFORM, cv::Scalar::all(40),
+           cv::Scalar::all(200));
+  cv::Point centre(size.width / 4 + (i * 7) % (size.width / 2),
+                   size.height / 3 + (i * 3) % (size.height / 3));
+  cv::circle(frame, centre, 20 + i % 60, cv::Scalar(30, 20, 200),
+             cv::FILLED);
+  cv::circle(frame, cv::Point(size.width - centre.x, centre.y), 30,
+             cv::Scalar(0, 128, 255), cv::FILLED);
+  cv::rectangle(frame, cv::Rect(10, size.height - 80, 120, 60),
+                cv::Scalar::all(128), cv::FILLED);
+  return frame;
+}
+
+int main(int argc, char **argv) {
+  unsigned repeats = 5;
+  unsigned threads = 3;
+  unsigned synthetic = 100;
+
+  int opt;
+  while ((opt = ::getopt(argc, argv, "r:t:n:")) != -1) {
+    switch (opt) {
+      case 'r':
+        repeats = std::max(1, std::atoi(optarg));
+        break;
+      case 't':
+        threads = std::max(1, std::atoi(optarg));
+        break;
+      case 'n':
+        synthetic = std::max(1, std::atoi(optarg));
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+
+  if (optind != argc && optind != argc - 1) {
+    std::fprintf(stderr,
+                 "Usage: %s [-r <repeats>] [-t <threads>] "
+                 "[-n <synthetic frames>] [<image directory>]\n",
+                 argv[0]);
+    return 1;
+  }
+
+  try {
+    std::vector<cv::Mat> frames;
+    if (optind < argc) {
+      ImageSequence seq;
+      if (!seq.open(argv[optind]))
+        throw std::runtime_error(std::string("no images in ") + argv[optind]);
+      cv::Mat image;
+      while (seq.read(image))
+        frames.push_back(image.clone());
+    } else {
+      for (unsigned i = 0; i < synthetic; ++i)
+        frames.push_back(synthesise(i, cv::Size(640, 480)));
+    }
+
+    cv::Size size = frames[0].size();
+    cv::Mat camera(3, 3, CV_64F, (void *)c_camera);
+    cv::Mat distortion(1, 5, CV_64F, (void *)c_distortion);
+    cv::Mat map_1, map_2;
+    cv::initUndistortRectifyMap(camera, distortion, cv::Mat(), camera, size,
+                                CV_16SC2, map_1, map_2);
+
+    RedMask kernel;
+    kernel.setMaps(map_1, map_2, size);
+    cv::Rect whole(cv::Point(0, 0), size);
+
+    Timing chain, fused, banded;
+    cv::Mat undistorted, hsv, reference, mask;
+    uint64_t pixels = 0;
+    uint64_t mismatches = 0;
+
+    for (size_t i = 0; i < frames.size(); ++i) {
+      const cv::Mat &frame = frames[i];
+      if (frame.size() != size)
+        throw std::runtime_error("frames differ in size");
+
+      for (unsigned r = 0; r < repeats; ++r) {
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        cv::remap(frame, undistorted, map_1, map_2, cv::INTER_LINEAR);
+        cv::cvtColor(undistorted, hsv, cv::COLOR_BGR2HSV);
+        cv::inRange(hsv, cv::Scalar(10, 0, 0), cv::Scalar(170, 255, 255),
+                    reference);
+        chain.add(since(start));
+
+        start = std::chrono::steady_clock::now();
+        kernel.apply(frame, mask);
+        fused.add(since(start));
+
+        // Row bands over threads, as the task's preprocessing stage does.
+        // Thread start-up is included, which the task's pool does not pay.
+        start = std::chrono::steady_clock::now();
+        kernel.prepare(frame, mask, whole);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+          int begin = mask.rows * t / threads;
+          int end = mask.rows * (t + 1) / threads;
+          workers.push_back(std::thread([&, begin, end] {
+            kernel.applyRows(frame, mask, whole, begin, end);
+          }));
+        }
+        for (unsigned t = 0; t < threads; ++t)
+          workers[t].join();
+        banded.add(since(start));
+      }
+
+      cv::Mat diff;
+      cv::compare(mask, reference, diff, cv::CMP_NE);
+      mismatches += cv::countNonZero(diff);
+      pixels += mask.total();
+    }
+
+    std::printf("%zu frames of %dx%d, %u repeats\n", frames.size(),
+                size.width, size.height, repeats);
+    chain.print("opencv chain");
+    fused.print("fused");
+    char name[32];
+    std::snprintf(name, sizeof(name), "fused x%u", threads);
+    banded.print(name);
+    std::printf("speedup %.2fx single thread, %.2fx over %u threads\n",
+                chain.median() / fused.median(),
+                chain.median() / banded.median(), threads);
+    std::printf("mask pixels differing from the chain: %.4f%%\n",
+                100.0 * mismatches / pixels);
+  } catch (std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,248 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// Checks the V4L2 capture backend of the RPiCam task against a live
+// device, without a camera: the vivid virtual driver, or v4l2loopback fed
+// from a recording. It checks frame geometry, that frames are headers over
+// the mapped driver buffers, that a buffer only returns to the driver on
+// release, and the sequence numbers and timestamps. It also reports the
+// capture rate and the per-frame copy the old VideoCapture path made.
+// Build and run with:
+//   CV=$(pkg-config --cflags --libs opencv4)
+//   g++ -std=c++11 -O2 -o v4l2_capture_test tools/v4l2_capture_test.cpp $CV
+//   sudo modprobe vivid
+//   ./v4l2_capture_test -d /dev/video0
+// or, from a recording:
+//   sudo modprobe v4l2loopback video_nr=10 exclusive_caps=1
+//   ffmpeg -re -i dock.mp4 -f v4l2 -pix_fmt bgr24 /dev/video10 &
+//   ./v4l2_capture_test -d /dev/video10
+
+// ISO C++ 11 headers.
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <set>
+#include <string>
+#include <vector>
+
+// POSIX headers.
+#include <unistd.h>
+
+#include <opencv2/core.hpp>
+
+// Local headers.
+#include "../src/Vision/RPiCam/V4L2Capture.hpp"
+#include "../test/Check.hpp"
+
+using Vision::RPiCam::V4L2Capture;
+
+//! Time to wait for a frame (s).
+static const double c_timeout = 2.0;
+
+//! Monotonic clock (s), as stamped by V4L2 drivers.
+static double monotonic(void) {
+  timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//! Elapsed time since a reference (s).
+static double since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                       - start)
+      .count();
+}
+
+//! Check geometry and buffer mapping of captured frames, and that each
+//! driver buffer always comes back at the same address.
+static void testFrames(V4L2Capture &cap, unsigned count) {
+  std::vector<const uint8_t *> addresses;
+  std::set<const uint8_t *> distinct;
+  uint32_t last_sequence = 0;
+  double last_tstamp = 0;
+  unsigned skipped = 0;
+  double copy_time = 0;
+  cv::Mat copy;
+
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < count; ++i) {
+    V4L2Capture::Frame frame;
+    bool grabbed = cap.grab(frame, c_timeout);
+    CHECK(grabbed);
+    if (!grabbed)
+      return;
+
+    CHECK(frame.image.size() == cap.getSize());
+    CHECK(frame.image.channels() == 3 || frame.image.channels() == 2);
+    CHECK(frame.index >= 0);
+    if ((size_t)frame.index >= addresses.size())
+      addresses.resize(frame.index + 1, NULL);
+    if (addresses[frame.index] == NULL)
+      addresses[frame.index] = frame.image.data;
+    CHECK(addresses[frame.index] == frame.image.data);
+    distinct.insert(frame.image.data);
+
+    if (i > 0) {
+      CHECK(frame.sequence > last_sequence);
+      CHECK(frame.tstamp >= last_tstamp);
+      skipped += frame.sequence - last_sequence - 1;
+    }
+    last_sequence = frame.sequence;
+    last_tstamp = frame.tstamp;
+    if (frame.monotonic)
+      CHECK(std::fabs(monotonic() - frame.tstamp) < 1.0);
+
+    // What VideoCapture::read did for every frame.
+    std::chrono::steady_clock::time_point copy_start =
+        std::chrono::steady_clock::now();
+    frame.image.copyTo(copy);
+    copy_time += since(copy_start);
+
+    cap.release(frame);
+    CHECK(frame.index == -1 && frame.image.empty());
+  }
+  double elapsed = since(start);
+
+  // Frames are views of the mapped buffers, never copies.
+  CHECK(distinct.size() <= cap.getBufferCount());
+  std::printf("%u frames at %.1f fps, %u skipped by the driver, %zu "
+              "buffers in use\n",
+              count, count / elapsed, skipped, distinct.size());
+  std::printf("copy avoided: %.0f us per %dx%d frame\n",
+              1e6 * copy_time / count, cap.getSize().width,
+              cap.getSize().height);
+}
+
+//! Hold every buffer: capture must stall until one is released.
+static void testRelease(V4L2Capture &cap) {
+  unsigned buffers = cap.getBufferCount();
+  std::vector<V4L2Capture::Frame> held;
+  for (unsigned i = 0; i < buffers; ++i) {
+    V4L2Capture::Frame frame;
+    if (!cap.grab(frame, c_timeout))
+      break;
+    held.push_back(frame);
+  }
+  CHECK(held.size() == buffers);
+
+  V4L2Capture::Frame frame;
+  CHECK(!cap.grab(frame, 0.2));
+
+  // Images stay valid while held.
+  for (unsigned i = 0; i < held.size(); ++i)
+    CHECK(!held[i].image.empty());
+
+  // The released buffer is the only one the driver can fill.
+  int index = held.front().index;
+  cap.release(held.front());
+  CHECK(cap.grab(frame, c_timeout));
+  CHECK(frame.index == index);
+  cap.release(frame);
+
+  for (unsigned i = 0; i < held.size(); ++i)
+    cap.release(held[i]);
+}
+
+//! Report if buffers can be shared as DMABUF descriptors.
+static void testExport(V4L2Capture &cap) {
+  try {
+    int fd = cap.exportBuffer(0);
+    CHECK(fd >= 0);
+    ::close(fd);
+    std::printf("DMABUF export supported\n");
+  } catch (std::exception &e) {
+    std::printf("DMABUF export not supported: %s\n", e.what());
+  }
+}
+
+int main(int argc, char **argv) {
+  std::string device = "/dev/video0";
+  unsigned count = 300;
+  unsigned width = 640;
+  unsigned height = 480;
+  unsigned buffers = 4;
+
+  int opt;
+  while ((opt = ::getopt(argc, argv, "d:n:s:b:")) != -1) {
+    switch (opt) {
+      case 'd':
+        device = optarg;
+        break;
+      case 'n':
+        count = (unsigned)std::atoi(optarg);
+        break;
+      case 's':
+        if (std::sscanf(optarg, "%ux%u", &width, &height) != 2)
+          optind = argc + 1;
+        break;
+      case 'b':
+        buffers = (unsigned)std::atoi(optarg);
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+
+  if (optind != argc) {
+    std::fprintf(stderr,
+                 "Usage: %s [-d <device>] [-n <frames>] "
+                 "[-s <width>x<height>] [-b <buffers>]\n",
+                 argv[0]);
+    return 1;
+  }
+
+  try {
+    V4L2Capture cap;
+    cap.open(device, width, height, buffers);
+    CHECK(cap.isOpened());
+    const char *format = cap.getPixelFormat() == V4L2_PIX_FMT_BGR24
+                             ? "BGR24"
+                             : "YUYV";
+    std::printf("%s: %dx%d %s, %u buffers\n", device.c_str(),
+                cap.getSize().width, cap.getSize().height, format,
+                cap.getBufferCount());
+
+    testFrames(cap, count);
+    testRelease(cap);
+    testExport(cap);
+
+    cap.close();
+    CHECK(!cap.isOpened());
+  } catch (std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return Test::report("v4l2_capture_test");
+}
@@ -0,0 +1,410 @@
+//***************************************************************************
+// Copyright 2007-2020 Universidade do Porto - Faculdade de Engenharia      *
+// Laboratório de Sistemas e Tecnologia Subaquática (LSTS)                  *
+//***************************************************************************
+// This file is part of DUNE: Unified Navigation Environment.               *
+//                                                                          *
+// Commercial Licence Usage                                                 *
+// Licencees holding valid commercial DUNE licences may use this file in    *
+// accordance with the commercial licence agreement provided with the       *
+// Software or, alternatively, in accordance with the terms contained in a  *
+// written agreement between you and Faculdade de Engenharia da             *
+// Universidade do Porto. For licensing terms, conditions, and further      *
+// information contact lsts@fe.up.pt.                                       *
+//                                                                          *
+// Modified European Union Public Licence - EUPL v.1.1 Usage                *
+// Alternatively, this file may be used under the terms of the Modified     *
+// EUPL, Version 1.1 only (the "Licence"), appearing in the file LICENCE.md *
+// included in the packaging of this file. You may not use this work        *
+// except in compliance with the Licence. Unless required by applicable     *
+// law or agreed to in writing, software distributed under the Licence is   *
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF     *
+// ANY KIND, either express or implied. See the Licence for the specific    *
+// language governing permissions and limitations at                        *
+// https://github.com/LSTS/dune/blob/master/LICENCE.md and                  *
+// http://ec.europa.eu/idabc/eupl.html.                                     *
+//***************************************************************************
+// Author: Jorge Ferreira                                                   *
+//***************************************************************************
+
+// Replays a recorded docking sequence through the RPiCam detection
+// pipeline, one stage after the other as the task's threads would run
+// them: tracker window, red mask (remap and colour), morphology and
+// circle detection. Reports a timing histogram per stage, the frame rate
+// the pipeline sustains and, given labels, the heading_ref accuracy
+// against the ground truth. Frames come from an image directory, as for
+// the task's replay backend, with labels in the format described in
+// tools/Dataset.hpp; without arguments, a synthetic approach is used.
+// With -c, the red mask is computed by the OpenCV chain the task used to
+// run, cv::remap then cv::cvtColor and cv::inRange, timed separately.
+// Build with:
+//   CV=$(pkg-config --cflags --libs opencv4)
+//   g++ -std=c++11 -O2 -o vision_bench tools/vision_bench.cpp $CV
+
+// ISO C++ 11 headers.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string>
+#include <vector>
+
+// POSIX headers.
+#include <unistd.h>
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+// Local headers.
+#include "../src/Vision/RPiCam/CircleDetector.hpp"
+#include "../src/Vision/RPiCam/ImageSequence.hpp"
+#include "../src/Vision/RPiCam/RedMask.hpp"
+#include "../src/Vision/RPiCam/Tracker.hpp"
+#include "Dataset.hpp"
+
+using Tools::Label;
+using Vision::RPiCam::CircleDetector;
+using Vision::RPiCam::ImageSequence;
+using Vision::RPiCam::RedMask;
+using Vision::RPiCam::Tracker;
+
+//! Frame size of the synthetic sequence.
+static const cv::Size c_size(640, 480);
+//! Default valid region of the undistorted frame, as in the task.
+static const cv::Rect c_valid_region(7, 13, 623, 453);
+
+//! Distribution of stage times.
+class Histogram {
+public:
+  //! Number of bins shown.
+  static const unsigned c_bins = 10;
+
+  void add(double t) { m_samples.push_back(t); }
+
+  //! Total time (s).
+  double total(void) const {
+    double sum = 0;
+    for (size_t i = 0; i < m_samples.size(); ++i)
+      sum += m_samples[i];
+    return sum;
+  }
+
+  bool empty(void) const { return m_samples.empty(); }
+
+  void print(const char *name) {
+    if (m_samples.empty())
+      return;
+
+    std::vector<double> v = m_samples;
+    std::sort(v.begin(), v.end());
+    std::printf("%s: mean %.3f ms, median %.3f ms, p95 %.3f ms, p99 %.3f "
+                "ms, max %.3f ms\n",
+                name, 1e3 * total() / v.size(), 1e3 * at(v, 0.5),
+                1e3 * at(v, 0.95), 1e3 * at(v, 0.99), 1e3 * v.back());
+
+    // Bins up to the 99th percentile, the rest in the last one.
+    double width = at(v, 0.99) / (c_bins - 1);
+    if (width <= 0)
+      width = v.back() / c_bins + 1e-9;
+    unsigned counts[c_bins] = {0};
+    unsigned most = 0;
+    for (size_t i = 0; i < v.size(); ++i) {
+      unsigned bin = std::min((unsigned)(v[i] / width), c_bins - 1);
+      most = std::max(most, ++counts[bin]);
+    }
+    for (unsigned b = 0; b < c_bins; ++b) {
+      unsigned bar = counts[b] * 40 / most;
+      std::printf("  %7.3f ms%s %-40s %u\n", 1e3 * b * width,
+                  b == c_bins - 1 ? "+" : " ", std::string(bar, '#').c_str(),
+                  counts[b]);
+    }
+  }
+
+private:
+  std::vector<double> m_samples;
+
+  static double at(const std::vector<double> &v, double q) {
+    return v[(size_t)(q * (v.size() - 1) + 0.5)];
+  }
+};
+
+//! Frame of a sequence with its ground truth.
+struct Frame {
+  cv::Mat image;
+  //! False if the frame has no label.
+  bool labelled;
+  Label label;
+};
+
+static double since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                       - start)
+      .count();
+}
+
+//! Frames of a recorded image directory, with labels if given.
+static std::vector<Frame> loadSequence(const std::string &dir,
+                                       const std::string &labels_file) {
+  Tools::Labels labels;
+  if (!labels_file.empty())
+    labels = Tools::readLabels(labels_file);
+
+  ImageSequence seq;
+  if (!seq.open(dir))
+    throw std::runtime_error("no images in " + dir);
+
+  std::vector<Frame> frames;
+  Frame frame;
+  while (seq.read(frame.image)) {
+    Tools::Labels::const_iterator label =
+        labels.find(Tools::baseName(seq.getFile()));
+    frame.labelled = label != labels.end();
+    if (frame.labelled)
+      frame.label = label->second;
+    frames.push_back(frame);
+    frame.image = cv::Mat();
+  }
+  return frames;
+}
+
+//! Synthetic approach: the target drifts across the view and grows, and
+//! leaves it for a while. Labels are the drawn centres, undistorted.
+static std::vector<Frame> synthesiseSequence(unsigned count) {
+  cv::Mat camera(3, 3, CV_64F, (void *)Tools::c_camera);
+  cv::Mat distortion(1, 5, CV_64F, (void *)Tools::c_distortion);
+  cv::RNG rng(1);
+  std::vector<Frame> frames;
+
+  for (unsigned i = 0; i < count; ++i) {
+    Frame frame;
+    frame.image = cv::Mat(c_size, CV_8UC3);
+    rng.fill(frame.image, cv::RNG::UNIFORM, cv::Scalar::all(40),
+             cv::Scalar::all(200));
+    frame.labelled = true;
+    frame.label.present = (i % 200) < 170;
+    frame.label.centre = cv::Point2f(0, 0);
+    frame.label.diameter = 0;
+
+    if (frame.label.present) {
+      double s = (double)i / count;
+      cv::Point centre(
+          (int)(c_size.width / 2 + 150 * std::sin(2 * M_PI * 1.5 * s)),
+          (int)(c_size.height / 2 + 40 * std::sin(2 * M_PI * 0.7 * s)));
+      int radius = 25 + (int)(60 * s);
+      cv::circle(frame.image, centre, radius, cv::Scalar(30, 20, 200),
+                 cv::FILLED);
+
+      std::vector<cv::Point2f> raw(1, cv::Point2f(centre.x, centre.y));
+      std::vector<cv::Point2f> undistorted;
+      cv::undistortPoints(raw, undistorted, camera, distortion, cv::noArray(),
+                          camera);
+      frame.label.centre = undistorted[0];
+      frame.label.diameter = 2 * radius + 1;
+    }
+    frames.push_back(frame);
+  }
+  return frames;
+}
+
+int main(int argc, char **argv) {
+  unsigned synthetic = 600;
+  unsigned threads = 3;
+  double rate = 30.0;
+  bool chain = false;
+
+  int opt;
+  while ((opt = ::getopt(argc, argv, "n:t:f:c")) != -1) {
+    switch (opt) {
+      case 'n':
+        synthetic = std::max(1, std::atoi(optarg));
+        break;
+      case 't':
+        threads = std::max(1, std::atoi(optarg));
+        break;
+      case 'f':
+        rate = std::atof(optarg);
+        break;
+      case 'c':
+        chain = true;
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+
+  if (optind > argc || argc - optind > 2 || rate <= 0) {
+    std::fprintf(stderr,
+                 "Usage: %s [-c] [-t <threads>] [-f <frame rate>] "
+                 "[-n <synthetic frames>] [<image directory> "
+                 "[<labels file>]]\n",
+                 argv[0]);
+    return 1;
+  }
+
+  try {
+    std::vector<Frame> frames;
+    if (optind < argc)
+      frames = loadSequence(argv[optind],
+                            optind + 1 < argc ? argv[optind + 1] : "");
+    else
+      frames = synthesiseSequence(synthetic);
+    if (frames.empty())
+      throw std::runtime_error("no frames");
+
+    // Set up as the task does.
+    cv::Size size = frames[0].image.size();
+    cv::Mat map_1, map_2;
+    Tools::defaultMaps(size, map_1, map_2);
+    RedMask red_mask;
+    red_mask.setMaps(map_1, map_2, size);
+
+    Tracker tracker;
+    tracker.configure(c_valid_region & cv::Rect(cv::Point(0, 0), size), 3.0,
+                      5);
+
+    cv::SimpleBlobDetector::Params params;
+    params.filterByArea = true;
+    params.minArea = 1000;
+    params.maxArea = 4 * M_PI * std::pow(size.width, 2);
+    params.filterByCircularity = true;
+    params.minCircularity = 0.8;
+    params.filterByConvexity = true;
+    params.minConvexity = 0.3;
+    params.filterByInertia = true;
+    params.minInertiaRatio = 0.01;
+    CircleDetector detector;
+    detector.setParams(params);
+
+    cv::Mat kernel =
+        cv::getStructuringElement(cv::MORPH_RECT, cv::Size(11, 11));
+    cv::Mat undistorted, hsv, mask;
+    std::vector<cv::KeyPoint> keypoints;
+    Histogram remap_time, colour_time, mask_time, morphology_time,
+        detect_time, frame_time;
+
+    unsigned targets = 0, detections = 0, false_alarms = 0, absent = 0;
+    unsigned window_searches = 0;
+    double sum_error = 0, sum_sq_error = 0, max_error = 0;
+
+    std::chrono::steady_clock::time_point wall =
+        std::chrono::steady_clock::now();
+    for (size_t i = 0; i < frames.size(); ++i) {
+      const Frame &frame = frames[i];
+      if (frame.image.size() != size)
+        throw std::runtime_error("frames differ in size");
+      double tstamp = i / rate;
+
+      std::chrono::steady_clock::time_point start =
+          std::chrono::steady_clock::now();
+      window_searches += tracker.isTracking() ? 1 : 0;
+      cv::Rect window = tracker.getWindow(tstamp);
+
+      if (chain) {
+        std::chrono::steady_clock::time_point t =
+            std::chrono::steady_clock::now();
+        cv::remap(frame.image, undistorted, map_1, map_2, cv::INTER_LINEAR);
+        remap_time.add(since(t));
+
+        t = std::chrono::steady_clock::now();
+        cv::cvtColor(undistorted(window), hsv, cv::COLOR_BGR2HSV);
+        cv::inRange(hsv, cv::Scalar(10, 0, 0), cv::Scalar(170, 255, 255),
+                    mask);
+        colour_time.add(since(t));
+      } else {
+        std::chrono::steady_clock::time_point t =
+            std::chrono::steady_clock::now();
+        red_mask.prepare(frame.image, mask, window);
+        int bands = threads;
+        int rows = mask.rows;
+        cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range &range) {
+          for (int b = range.start; b < range.end; ++b)
+            red_mask.applyRows(frame.image, mask, window, rows * b / bands,
+                               rows * (b + 1) / bands);
+        });
+        mask_time.add(since(t));
+      }
+
+      std::chrono::steady_clock::time_point t =
+          std::chrono::steady_clock::now();
+      cv::GaussianBlur(mask, mask, cv::Size(13, 13), 3);
+      cv::morphologyEx(mask, mask, cv::MORPH_CLOSE, kernel);
+      morphology_time.add(since(t));
+
+      t = std::chrono::steady_clock::now();
+      detector.detect(mask, keypoints);
+      cv::KeyPoint *target = NULL;
+      double heading_ref = 0;
+      if (!keypoints.empty()) {
+        target = &keypoints.front();
+        target->pt += cv::Point2f(window.tl());
+        heading_ref = Tools::heading(target->pt.x, size.width);
+      }
+      tracker.update(tstamp, target);
+      detect_time.add(since(t));
+      frame_time.add(since(start));
+
+      if (!frame.labelled)
+        continue;
+
+      if (!frame.label.present) {
+        ++absent;
+        false_alarms += target != NULL ? 1 : 0;
+        continue;
+      }
+
+      ++targets;
+      if (target == NULL)
+        continue;
+
+      ++detections;
+      double error = std::fabs(
+          heading_ref - Tools::heading(frame.label.centre.x, size.width));
+      sum_error += error;
+      sum_sq_error += error * error;
+      max_error = std::max(max_error, error);
+    }
+    double elapsed = since(wall);
+
+    std::printf("%zu frames of %dx%d, red mask by %s\n", frames.size(),
+                size.width, size.height,
+                chain ? "the OpenCV chain" : "RedMask");
+    if (chain) {
+      remap_time.print("remap");
+      colour_time.print("colour");
+    } else {
+      char name[48];
+      std::snprintf(name, sizeof(name), "remap and colour (%u bands)",
+                    threads);
+      mask_time.print(name);
+    }
+    morphology_time.print("morphology");
+    detect_time.print("detect");
+    frame_time.print("frame");
+    std::printf("%.1f fps sequential, %.1f fps wall clock, %u frames "
+                "searched in a window\n",
+                frames.size() / frame_time.total(), frames.size() / elapsed,
+                window_searches);
+
+    if (targets + absent > 0) {
+      std::printf("target in %u labelled frames, detected in %u; %u false "
+                  "detections in %u frames without it\n",
+                  targets, detections, false_alarms, absent);
+    }
+    if (detections > 0) {
+      std::printf("heading_ref error: mean %.3f deg, RMS %.3f deg, max "
+                  "%.3f deg\n",
+                  sum_error / detections * 180 / M_PI,
+                  std::sqrt(sum_sq_error / detections) * 180 / M_PI,
+                  max_error * 180 / M_PI);
+    }
+  } catch (std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}